@@ -3,6 +3,7 @@
 #pragma hdrstop
 
 #include "IOThread_Params.h"
+#include <random>
 #include "read_file.h"
 #include "logger.h"
 
@@ -12,7 +13,8 @@
 IOThread_Params::IOThread_Params()
  : SecurityMode(UA_MESSAGESECURITYMODE_NONE), TrustList(NULL),
    TrustListSize(0), RevocationList(NULL), RevocationListSize(0),
-   timeout(5000), secureChannelLifeTime(10 * 60 * 1000)
+   timeout(5000), secureChannelLifeTime(10 * 60 * 1000),
+   reconnectMinMs(500), reconnectMaxMs(10000), severeCooldownMs(10000)
 {
 	UA_ByteString_init(&Certificate);
 	UA_ByteString_init(&PrivateKey);
@@ -24,6 +26,38 @@ IOThread_Params::~IOThread_Params()
 	UA_ByteString_clear(&PrivateKey);
 }
 
+// Exponential backoff with jitter: many connections failing at the same time
+// (e.g. PLCs restarting) don't retry all at the same time.
+DWORD IOThread_Params::ReconnectDelay(int retries) const
+{
+	DWORD delay = reconnectMinMs;
+	for (int i = 1; i < retries && delay < (DWORD)reconnectMaxMs; i++)
+		delay *= 2;
+	if (delay > (DWORD)reconnectMaxMs)
+		delay = reconnectMaxMs;
+	// +-25% jitter, from a generator per thread: the pool workers must not all draw the
+	// same sequence (rand() state is per thread in the multithreaded RTL, seeded alike)
+	DWORD jitter = delay / 4;
+	if (jitter > 0) {
+		static thread_local std::mt19937 gen(std::random_device()() ^ (unsigned)GetCurrentThreadId());
+		std::uniform_int_distribution<DWORD> dist(0, 2 * jitter);
+		delay = delay - jitter + dist(gen);
+	}
+	return delay;
+}
+
+// Same as UA_Client_connectUsername does, but for the async connect
+void IOThread_Params::SetUserNameIdentity(UA_ClientConfig *cc, const std::string& user, const std::string& pass)
+{
+	UA_UserNameIdentityToken* identityToken = UA_UserNameIdentityToken_new();
+	identityToken->userName = UA_STRING_ALLOC(user.c_str());
+	identityToken->password = UA_STRING_ALLOC(pass.c_str());
+	UA_ExtensionObject_clear(&cc->userIdentityToken);
+	cc->userIdentityToken.encoding = UA_EXTENSIONOBJECT_DECODED;
+	cc->userIdentityToken.content.decoded.type = &UA_TYPES[UA_TYPES_USERNAMEIDENTITYTOKEN];
+	cc->userIdentityToken.content.decoded.data = identityToken;
+}
+
 UA_StatusCode IOThread_Params::UpdateConfig(UA_ClientConfig *cc)
 {
 	if (logger) {
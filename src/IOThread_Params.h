@@ -13,12 +13,17 @@ public:
 	IOThread_Params();
 	virtual ~IOThread_Params();
 	UA_StatusCode UpdateConfig(UA_ClientConfig *cc);
+	DWORD ReconnectDelay(int retries) const;   // wait time before the next connect attempt
+	static void SetUserNameIdentity(UA_ClientConfig *cc, const std::string& user, const std::string& pass);
 
 	UA_MessageSecurityMode SecurityMode;
 	std::string CertificateFile;
 	std::string PrivateKeyFile;
 	int timeout;
 	int secureChannelLifeTime;
+	int reconnectMinMs;                 // reconnect backoff: doubles with every failed
+	int reconnectMaxMs;                 // attempt, up to the max (plus random jitter)
+	int severeCooldownMs;               // wait before recreating the client after severe errors
     UA_Logger *logger;
 
 private:
@@ -0,0 +1,293 @@
+//---------------------------------------------------------------------------
+
+#include <System.hpp>
+#pragma hdrstop
+
+#include "OpcUA_ClientPool.h"
+#include "logger.h"
+#pragma package(smart_init)
+//---------------------------------------------------------------------------
+extern bool gDllUnloadInProgress;
+
+// Longest a worker may wait for the CloseSession response when there is no async close
+static const UA_UInt32 DISCONNECT_TIMEOUT_MS = 100;
+
+//---------------------------------------------------------------------------
+TOpcUA_PoolSession::TOpcUA_PoolSession(const std::string& name, const std::string& url,
+	const std::string& user, const std::string& pass, int worker)
+	: Name(name), Worker(worker), Client(NULL), _url(url), _user(user), _pass(pass),
+	  _state(1), _connectRetries(0), _stateTicker(0), _waitMs(0)
+{
+}
+TOpcUA_PoolSession::~TOpcUA_PoolSession()
+{
+	if (Client) {
+		UA_Client_disconnect(Client);
+		UA_Client_delete(Client);
+	}
+}
+//---------------------------------------------------------------------------
+// Never blocks: the connect is async and the client is only polled (run_iterate 0)
+void TOpcUA_PoolSession::Step(TOpcUA_ClientPool* pool)
+{
+	const IOThread_Params* params = pool->GetParams();
+	UA_SecureChannelState chn_s;
+	UA_SessionState ss_s;
+	UA_StatusCode sc;
+
+	switch(_state) {
+	case 1: // create the client
+		if (Client) {
+			UA_Client_delete(Client);
+		}
+		Client = pool->NewClient(_user, _pass);
+		_state = 10;
+		break;
+
+	case 10: // start connecting
+		XTRACE(XPDIAG2, "%s: Starting to connect...", _url.c_str());
+		_stats.lastError = UA_Client_connectAsync(Client, _url.c_str());
+		if (_stats.lastError != UA_STATUSCODE_GOOD) {
+			XTRACE(XPERRORS, "%s: Connect failed. Retcode=%08Xh, Msg=%s", _url.c_str(), _stats.lastError, UA_StatusCode_name(_stats.lastError));
+			_state = 99;
+			break;
+		}
+		_stateTicker = GetTickCount();
+		_state = 11;
+		break;
+
+	case 11: // connecting
+		sc = UA_Client_run_iterate(Client, 0);
+		if (sc == UA_STATUSCODE_GOOD) {
+			UA_Client_getState(Client, &chn_s, &ss_s, &sc);
+		}
+		if (sc != UA_STATUSCODE_GOOD) {
+			XTRACE(XPERRORS, "%s: Connect failed. Retcode=%08Xh, Msg=%s", _url.c_str(), sc, UA_StatusCode_name(sc));
+			_stats.lastError = sc;
+			_state = 99;
+		}
+		else if (ss_s == UA_SESSIONSTATE_ACTIVATED) {
+			XTRACE(XPDIAG1, "%s: Connected.", _url.c_str());
+			_stats.cntConnects++;
+			_stats.msLastConnect = GetTickCount() - _stateTicker;
+			_stats.tLastConnected = Now();
+			_connectRetries = 0;
+			_state = 30;
+		}
+		else if (GetTickCount() - _stateTicker > (DWORD)params->timeout) {
+			XTRACE(XPERRORS, "%s: Connect timed out.", _url.c_str());
+			_stats.lastError = UA_STATUSCODE_BADTIMEOUT;
+			_state = 99;
+		}
+		break;
+
+	case 30: // connected, keep the session alive
+		sc = UA_Client_run_iterate(Client, 0);
+		if (sc == UA_STATUSCODE_GOOD) {
+			UA_Client_getState(Client, &chn_s, &ss_s, &sc);
+			if (sc == UA_STATUSCODE_GOOD && ss_s != UA_SESSIONSTATE_ACTIVATED)
+				sc = UA_STATUSCODE_BADSESSIONCLOSED;
+		}
+		if (sc != UA_STATUSCODE_GOOD) {
+			XTRACE(XPERRORS, "%s: Connection lost: %08Xh (%s)", _url.c_str(), sc, UA_StatusCode_name(sc));
+			_stats.lastError = sc;
+			_state = 99;
+		}
+		break;
+
+	case 99: // some error occurred, disconnect and retry later
+		UA_Client_getState(Client, &chn_s, &ss_s, &sc);
+#if defined(UA_OPEN62541_VER) && UA_OPEN62541_VER >= 1200
+		if (ss_s == UA_SESSIONSTATE_ACTIVATED && UA_Client_disconnectAsync(Client) == UA_STATUSCODE_GOOD) {
+			// close the session without waiting for the response, see 98
+			_stateTicker = GetTickCount();
+			_state = 98;
+			break;
+		}
+#endif
+		if (ss_s == UA_SESSIONSTATE_ACTIVATED) {
+			// the CloseSession request waits for its response, don't stall the other sessions of the worker
+			UA_ClientConfig* cc = UA_Client_getConfig(Client);
+			UA_UInt32 timeout = cc->timeout;
+			cc->timeout = DISCONNECT_TIMEOUT_MS;
+			UA_Client_disconnect(Client);
+			cc->timeout = timeout;
+		} else {
+			UA_Client_disconnect(Client);       // only closes the channel
+		}
+		_state = 97;
+		break;
+
+	case 98: // closing the session
+		UA_Client_run_iterate(Client, 0);
+		UA_Client_getState(Client, &chn_s, &ss_s, &sc);
+		if (chn_s != UA_SECURECHANNELSTATE_CLOSED && GetTickCount() - _stateTicker <= (DWORD)params->timeout)
+			break;
+		if (chn_s != UA_SECURECHANNELSTATE_CLOSED) {
+			XTRACE(XPERRORS, "%s: Disconnect timed out.", _url.c_str());
+			_stats.lastError = UA_STATUSCODE_BADTIMEOUT;     // start over with a new client
+		}
+		_state = 97;
+		break;
+
+	case 97: // disconnected, retry later
+		_stats.cntFailures++;
+		_connectRetries++;
+		_waitMs = params->ReconnectDelay(_connectRetries);
+		_stateTicker = GetTickCount();
+		_state = 910;
+		break;
+
+	case 910: // wait with backoff
+		if (GetTickCount() - _stateTicker > _waitMs) {
+			// a connection with an error needs a new client
+			// --> see https://www.open62541.org/doc/1.3/client.html#connect-to-a-server
+			_state = (_stats.lastError & 0x80000000) ? 1 : 10;
+		}
+		break;
+	}
+}
+//---------------------------------------------------------------------------
+__fastcall TOpcUA_PoolWorker::TOpcUA_PoolWorker(TOpcUA_ClientPool* pool, int index)
+	: TThread(true), _pool(pool), _index(index) // always create suspended
+{
+}
+void __fastcall TOpcUA_PoolWorker::Execute()
+{
+	NameThreadForDebugging(System::String(L"OpcUA_PoolWorker"));
+	while (!Terminated && !gDllUnloadInProgress) {
+		try {
+			_pool->Iterate(_index);
+		}
+		catch (...) {
+		}
+		Sleep(_pool->GetInterval());
+	}
+}
+//---------------------------------------------------------------------------
+TOpcUA_ClientPool::TOpcUA_ClientPool(IOThread_Params* params, int workers, DWORD intervalMs)
+	: _params(params), _intervalMs(intervalMs)
+{
+	InitializeCriticalSection(&_csParams);
+	InitializeSRWLock(&_srw);
+	if (workers < 1)
+		workers = 1;
+	for (int i = 0; i < workers; i++) {
+		TOpcUA_PoolWorker* worker = new TOpcUA_PoolWorker(this, i);
+		_workers.push_back(worker);
+		worker->Start();
+	}
+	XTRACE(XPDIAG2, "OPC-UA client pool started with %d workers", workers);
+}
+TOpcUA_ClientPool::~TOpcUA_ClientPool()
+{
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i]->Terminate();
+	for (size_t i = 0; i < _workers.size(); i++) {
+		_workers[i]->WaitFor();
+		delete _workers[i];
+	}
+	for (size_t i = 0; i < _sessions.size(); i++)
+		delete _sessions[i];
+	DeleteCriticalSection(&_csParams);
+}
+UA_Client* TOpcUA_ClientPool::NewClient(const std::string& user, const std::string& pass)
+{
+	UA_Client* client = UA_Client_new();
+	if (!client) {
+		XTRACE(XPFATAL, "TOpcUA_ClientPool::NewClient: OUT OF MEMORY!");
+		exit(-1);
+	}
+	UA_ClientConfig* cc = UA_Client_getConfig(client);
+	EnterCriticalSection(&_csParams);
+	_params->UpdateConfig(cc);
+	LeaveCriticalSection(&_csParams);
+	if (user.length() > 0) {
+		IOThread_Params::SetUserNameIdentity(cc, user, pass);
+	}
+	return client;
+}
+TOpcUA_PoolSession* TOpcUA_ClientPool::Add(const std::string& name, const std::string& url,
+	const std::string& user, const std::string& pass)
+{
+	AcquireSRWLockExclusive(&_srw);
+	TOpcUA_PoolSession* session = NULL;
+	bool exists = false;
+	std::vector<size_t> load(_workers.size(), 0);
+	for (size_t i = 0; i < _sessions.size(); i++) {
+		exists = exists || _sessions[i]->Name == name;
+		load[_sessions[i]->Worker]++;
+	}
+	if (!exists) {
+		size_t worker = 0;
+		for (size_t i = 1; i < load.size(); i++) {
+			if (load[i] < load[worker])
+				worker = i;
+		}
+		session = new TOpcUA_PoolSession(name, url, user, pass, (int)worker);
+		_sessions.push_back(session);
+	}
+	ReleaseSRWLockExclusive(&_srw);
+	return session;
+}
+bool TOpcUA_ClientPool::Remove(const std::string& name)
+{
+	TOpcUA_PoolSession* session = NULL;
+	AcquireSRWLockExclusive(&_srw);
+	for (size_t i = 0; i < _sessions.size(); i++) {
+		if (_sessions[i]->Name == name) {
+			session = _sessions[i];
+			_sessions.erase(_sessions.begin() + i);
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&_srw);
+	// the workers don't see it anymore
+	delete session;
+	return session != NULL;
+}
+TOpcUA_PoolSession* TOpcUA_ClientPool::Find(const std::string& name)
+{
+	// the list is only changed by the lua thread, so no lock needed for reading
+	for (size_t i = 0; i < _sessions.size(); i++) {
+		if (_sessions[i]->Name == name)
+			return _sessions[i];
+	}
+	return NULL;
+}
+void TOpcUA_ClientPool::GetStats(Stats& stats)
+{
+	stats = Stats();
+	AcquireSRWLockShared(&_srw);
+	for (size_t i = 0; i < _sessions.size(); i++) {
+		TOpcUA_PoolSession* session = _sessions[i];
+		TOpcUA_PoolSession::Stats s;
+		session->Lock.Enter();
+		session->GetStats(s);
+		session->Lock.Leave();
+		stats.cntSessions++;
+		if (s.state == 30)
+			stats.cntConnected++;
+		else if (s.state >= 1 && s.state < 30)
+			stats.cntConnecting++;
+		else
+			stats.cntWaiting++;
+		stats.cntConnects += s.cntConnects;
+		stats.cntFailures += s.cntFailures;
+	}
+	ReleaseSRWLockShared(&_srw);
+}
+void TOpcUA_ClientPool::Iterate(int worker)
+{
+	AcquireSRWLockShared(&_srw);
+	for (size_t i = 0; i < _sessions.size(); i++) {
+		TOpcUA_PoolSession* session = _sessions[i];
+		// skip sessions busy with a lua request, their client is polled by that request
+		if (session->Worker != worker || !session->Lock.TryEnter())
+			continue;
+		session->Step(this);
+		session->Lock.Leave();
+	}
+	ReleaseSRWLockShared(&_srw);
+}
+//---------------------------------------------------------------------------
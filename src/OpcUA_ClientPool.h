@@ -0,0 +1,105 @@
+//---------------------------------------------------------------------------
+
+#ifndef OpcUA_ClientPoolH
+#define OpcUA_ClientPoolH
+//---------------------------------------------------------------------------
+#include <System.Classes.hpp>
+//---------------------------------------------------------------------------
+#include <open62541.h>
+#include <string>
+#include <vector>
+#include "IOThread_Params.h"
+#include "OpcUA_NetworkThread.h"
+//---------------------------------------------------------------------------
+class TOpcUA_ClientPool;
+//---------------------------------------------------------------------------
+// One client session of the pool. The state numbers follow TOpcUA_IOThread::StateMachine.
+// All members are protected by lock (the pool worker only steps the session if it
+// can get the lock, so a lua request holding it is never blocked by the worker).
+class TOpcUA_PoolSession
+{
+public:
+	TOpcUA_PoolSession(const std::string& name, const std::string& url,
+		const std::string& user, const std::string& pass, int worker);
+	~TOpcUA_PoolSession();
+	void Step(TOpcUA_ClientPool* pool);
+	bool IsConnected() { return _state == 30; }
+	bool IsConnecting() { return _state >= 1 && _state < 30; }
+
+	class Stats {
+	public:
+		Stats() : state(0), cntConnects(0), cntFailures(0), lastError(UA_STATUSCODE_GOOD), msLastConnect(0) {}
+		int             state;
+		uint32_t        cntConnects;
+		uint32_t        cntFailures;
+		UA_StatusCode   lastError;
+		uint32_t        msLastConnect;      // duration of the last successful connect
+		TDateTime       tLastConnected;
+	};
+	void GetStats(Stats& stats) {
+		stats = _stats;
+		stats.state = _state;
+	}
+
+	const std::string   Name;
+	const int           Worker;             // index of the worker thread stepping this session
+	TOpcUA_ClientLock   Lock;
+	UA_Client*          Client;             // recreated after severe errors, check under the lock
+private:
+	std::string         _url, _user, _pass;
+	int                 _state;
+	int                 _connectRetries;
+	DWORD               _stateTicker;       // start of the current connect / wait
+	DWORD               _waitMs;            // reconnect delay
+	Stats               _stats;
+};
+//---------------------------------------------------------------------------
+class TOpcUA_PoolWorker : public TThread
+{
+protected:
+	void __fastcall Execute();
+public:
+	__fastcall TOpcUA_PoolWorker(TOpcUA_ClientPool* pool, int index);
+private:
+	TOpcUA_ClientPool*  _pool;
+	int                 _index;
+};
+//---------------------------------------------------------------------------
+// Many client sessions (e.g. one per PLC), connected and kept alive by a small,
+// fixed number of worker threads. Each session is assigned to the worker with
+// the fewest sessions, the workers step their sessions round robin without blocking.
+class TOpcUA_ClientPool
+{
+public:
+	TOpcUA_ClientPool(IOThread_Params* params, int workers, DWORD intervalMs);
+	~TOpcUA_ClientPool();
+	TOpcUA_PoolSession* Add(const std::string& name, const std::string& url,
+		const std::string& user = "", const std::string& pass = "");   // NULL if the name exists
+	bool Remove(const std::string& name);
+	TOpcUA_PoolSession* Find(const std::string& name);                   // lua thread only
+
+	class Stats {
+	public:
+		Stats() : cntSessions(0), cntConnected(0), cntConnecting(0), cntWaiting(0), cntConnects(0), cntFailures(0) {}
+		uint32_t    cntSessions;
+		uint32_t    cntConnected;
+		uint32_t    cntConnecting;
+		uint32_t    cntWaiting;     // failed, waiting for the next attempt
+		uint32_t    cntConnects;
+		uint32_t    cntFailures;
+	};
+	void GetStats(Stats& stats);
+	DWORD GetInterval() { return _intervalMs; }
+	const IOThread_Params* GetParams() { return _params; }
+	UA_Client* NewClient(const std::string& user, const std::string& pass);
+	void Iterate(int worker);       // worker threads only
+private:
+	IOThread_Params*    _params;
+	CRITICAL_SECTION    _csParams;  // UpdateConfig is not reentrant (certificates)
+	DWORD               _intervalMs;
+	SRWLOCK             _srw;       // protects the session list: shared while iterating, exclusive to change
+	std::vector<TOpcUA_PoolSession*> _sessions;
+	std::vector<TOpcUA_PoolWorker*>  _workers;
+};
+//---------------------------------------------------------------------------
+#endif
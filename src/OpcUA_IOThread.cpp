@@ -26,7 +26,7 @@ extern bool gDllUnloadInProgress;
 using namespace he::Symbols;
 
 __fastcall TOpcUA_IOThread::TOpcUA_IOThread(IOThread_Params* params)
-	: TThread(true), _params(params), _client(NULL), _state(0), _oldConnectStatus(0) // always create suspended
+	: TThread(true), _params(params), _client(NULL), _state(0), _oldConnectStatus(0), _connectRetries(0), _waitMs(0) // always create suspended
 {
 	XTRACE(XPDIAG2, "OPC-UA IOThread instantiated");
 	InitializeCriticalSection(&_cs);
@@ -150,27 +150,75 @@ void TOpcUA_IOThread::StateMachine()
 		break;
 
 	case 10: { // "Connecting": Initialized, try to setup and start.
-		// Do a blocking connect.
+		// Start an async connect, the lib does the work in run_iterate (see above)
 		XTRACE(XPDIAG2, "%s: Starting to connect...", _url.c_str());
 		_lasterr = 0;
-		if (this->_user.length() == 0) {
-			_lasterr = UA_Client_connect(_client, _url.c_str());
-		} else {
-			_lasterr = UA_Client_connectUsername(_client, _url.c_str(), _user.c_str(), _pass.c_str());
+		if (this->_user.length() > 0) {
+			IOThread_Params::SetUserNameIdentity(UA_Client_getConfig(_client), _user, _pass);
 		}
+		_lasterr = UA_Client_connectAsync(_client, _url.c_str());
 		if(_lasterr != UA_STATUSCODE_GOOD) {
 			XTRACE(XPERRORS, "%s: Connect failed. Retcode=%d (%08Xh), Msg=%s", _url.c_str(), _lasterr, _lasterr, UA_StatusCode_name(_lasterr));
 			_state = 99;
 		}
 		else {
-	        _typeDB.Clear();
+			_stateTicker = GetTickCount();
+			_state = 11;
+		}
+	}
+	break;
+
+	case 11: { // Wait until the session is activated
+		UA_SecureChannelState chn_s;
+		UA_SessionState ss_s;
+		UA_StatusCode sc;
+		UA_Client_getState(_client, &chn_s, &ss_s, &sc);
+		if (sc != UA_STATUSCODE_GOOD) {
+			_lasterr = sc;
+			XTRACE(XPERRORS, "%s: Connect failed. Retcode=%d (%08Xh), Msg=%s", _url.c_str(), _lasterr, _lasterr, UA_StatusCode_name(_lasterr));
+			_state = 99;
+		}
+		else if (ss_s == UA_SESSIONSTATE_ACTIVATED) {
+			// after a reconnect try to reuse what we resolved before
+			_state = _resume.Valid ? 19 : 20;
+		}
+		else if (GetTickCount() - _stateTicker > (DWORD)_params->timeout) {
+			_lasterr = UA_STATUSCODE_BADTIMEOUT;
+			XTRACE(XPERRORS, "%s: Connect timed out.", _url.c_str());
+			_state = 99;
+		}
+	}
+	break;
+
+	case 19: { // Reconnected, check if the resolved node IDs and types are still valid
+		// One read of the data types and the server's namespace array and start time
+		// replaces the full resolution below. If the server restarted or its address
+		// space changed, fall back to the full resolution.
+		ResumeInfo info;
+		UA_StatusCode rc = readResumeInfo(info);
+		if (UA_STATUSCODE_GOOD != rc || !info.TypesUnchanged ||
+			info.StartTime != _resume.StartTime || info.Namespaces != _resume.Namespaces) {
+			XTRACE(XPDIAG1, "%s: Server or types changed (%08Xh), resolving again...", _url.c_str(), rc);
+			_resume.Valid = false;
 			_state = 20;
+			break;
 		}
+		XTRACE(XPDIAG2, "%s: Reconnected, reusing the resolved types...", _url.c_str());
+		_stats.cntReconnects++;
+		_stats.cntCyclesCurrent = 0;
+		_statsLastCycles = 0;
+		UA_NodeId_clear(&_wr.nidRegistered);    // registrations are per session
+		UA_NodeId_clear(&_rd.nidRegistered);
+		registerCyclicNodes();
+		_state = 21;
+		_stats.tLastConnected = Now();
+		_statsTicker = GetTickCount();
 	}
 	break;
 
 	case 20: // Connected, reading node IDs
 		XTRACE(XPDIAG2, "%s: Connected, reading type definitions...", _url.c_str());
+		_typeDB.Clear();
 		_stats.cntReconnects++;
 		_stats.cntCyclesCurrent = 0;
 		_statsLastCycles = 0;
@@ -188,6 +236,10 @@ void TOpcUA_IOThread::StateMachine()
 			_state = 99;
 			break;
 		}
+		// let the server know the nodes we use cyclically
+		registerCyclicNodes();
+		// remember the server state to validate the resolution after reconnects
+		_resume.Valid = (UA_STATUSCODE_GOOD == readResumeInfo(_resume));
 		_connectRetries = 0;
 		_state = 21;
 //		// init write value
@@ -303,6 +355,7 @@ void TOpcUA_IOThread::StateMachine()
 		UA_Client_disconnect(_client);
 		_stateTicker = GetTickCount();
 		_connectRetries++;
+		_waitMs = _params->ReconnectDelay(_connectRetries);
 		_state = 900;
 		break;
 
@@ -340,10 +393,8 @@ void TOpcUA_IOThread::StateMachine()
 		}
 		else {
 			// not a severe error, so reuse the client - but wait a bit more
-			if (_connectRetries > 10) {
-				_connectRetries = 10;       // limit to 10s retry time
-			}
-			if (GetTickCount() - _stateTicker > (1000*_connectRetries)) {
+			// (exponential backoff with jitter, see IOThread_Params::ReconnectDelay)
+			if (GetTickCount() - _stateTicker > _waitMs) {
 				XTRACE(XPDIAG1, "%s: Wait done, reconnecting", _url.c_str());
 				_state = 10;
 			}
@@ -351,8 +402,9 @@ void TOpcUA_IOThread::StateMachine()
 		break;
 
 	case 920:
-		// we had a severe error - create a new client, but wait 10 seconds!
-		if (GetTickCount() - _stateTicker > 10000) {
+		// we had a severe error - create a new client, but wait for the cooldown
+		// (at least the backoff delay)
+		if (GetTickCount() - _stateTicker > (DWORD)_params->severeCooldownMs && GetTickCount() - _stateTicker > _waitMs) {
 			// recreate a new client
 			XTRACE(XPWARN, "%s: Deleting OPC-UA client due to severe error.", _url.c_str());
 			UA_Client_delete(_client);
@@ -448,11 +500,11 @@ UA_StatusCode TOpcUA_IOThread::readwriteCyclic()
 		// Now write:
 		if (_wr.Encoding.length() > 0) {
 			// CoDeSys RasPi hack:
-			retval_wr = writeExtensionObjectValue(_wr.nidNodeId, _wr.nidEncoding, &tmp);
+			retval_wr = writeExtensionObjectValue(_wr.ioNodeId(), _wr.nidEncoding, &tmp);
 		} else {
 			// Default: use data type
 //			retval_wr = writeExtensionObjectValue(_wr.nidNodeId, _wr.nidDataType, &tmp);
-			retval_wr = writeExtensionObjectValue(_wr.nidNodeId, _wr.ExpandedNodeId, &tmp);
+			retval_wr = writeExtensionObjectValue(_wr.ioNodeId(), _wr.ExpandedNodeId, &tmp);
 		}
 		// Clean the temporary variable
 		UA_ByteString_clear(&tmp);
@@ -466,7 +518,7 @@ UA_StatusCode TOpcUA_IOThread::readwriteCyclic()
 	UA_Variant var;
 	UA_Variant_init(&var);
 	//UA_NodeId ExpandedNodeId;
-	retval_rd = TOpcUA_IOThread::readExtensionObjectValue(_rd.nidNodeId, &var, NULL);
+	retval_rd = TOpcUA_IOThread::readExtensionObjectValue(_rd.ioNodeId(), &var, NULL);
 	if (UA_STATUSCODE_GOOD == retval_rd) {
 		// check
 		if (UA_Variant_isScalar(&var) && (var.type == &UA_TYPES[UA_TYPES_STRING] || var.type == &UA_TYPES[UA_TYPES_BYTESTRING])) {
@@ -885,6 +937,7 @@ UA_StatusCode TOpcUA_IOThread::initCyclicInfo(TOpcUA_IOThread::CyclicNode& cycNo
 	UA_NodeId_clear(&cycNode.nidNodeId);
 	UA_NodeId_clear(&cycNode.nidDataType);
 	UA_NodeId_clear(&cycNode.nidEncoding);
+	UA_NodeId_clear(&cycNode.nidRegistered);    // registrations are per session
 	UA_NodeClass_clear(&cycNode.nidNodeClass);
 //	UA_Variant_clear(&cycNode.varInitVal);
 	cycNode.InitialReadLength = 0;
@@ -982,6 +1035,87 @@ UA_StatusCode TOpcUA_IOThread::initCyclicInfo(TOpcUA_IOThread::CyclicNode& cycNo
 	return retval;
 }
 //---------------------------------------------------------------------------
+// Register the resolved read/write nodes (RegisterNodes service). The server returns
+// handles it can look up fast, which are then used for the cyclic requests instead
+// of the (string) node IDs. This is optional: if the server does not support it, we
+// continue with the resolved node IDs. The registration ends with the session.
+void TOpcUA_IOThread::registerCyclicNodes()
+{
+	UA_NodeId nodes[2];
+	nodes[0] = _wr.nidNodeId;
+	nodes[1] = _rd.nidNodeId;
+	UA_RegisterNodesRequest request;
+	UA_RegisterNodesRequest_init(&request);
+	request.nodesToRegister = nodes;
+	request.nodesToRegisterSize = 2;
+	UA_RegisterNodesResponse response = UA_Client_Service_registerNodes(_client, request);
+	UA_StatusCode retval = response.responseHeader.serviceResult;
+	if (UA_STATUSCODE_GOOD == retval && response.registeredNodeIdsSize == 2) {
+		UA_NodeId_copy(&response.registeredNodeIds[0], &_wr.nidRegistered);
+		UA_NodeId_copy(&response.registeredNodeIds[1], &_rd.nidRegistered);
+		XTRACE(XPDIAG1, "%s: Cyclic nodes registered.", _url.c_str());
+	} else {
+		XTRACE(XPDIAG1, "%s: RegisterNodes failed (%08Xh), using the resolved node IDs.", _url.c_str(), retval);
+	}
+	UA_RegisterNodesResponse_clear(&response);
+}
+//---------------------------------------------------------------------------
+// Read the data types of the cyclic nodes and the server's namespace array and
+// start time with a single request. TypesUnchanged is set, if the data types are
+// the same as resolved by initCyclicInfo.
+UA_StatusCode TOpcUA_IOThread::readResumeInfo(ResumeInfo& info)
+{
+	UA_ReadValueId ids[4];
+	for (int i = 0; i < 4; i++) {
+		UA_ReadValueId_init(&ids[i]);
+		ids[i].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+	ids[0].nodeId = _wr.nidNodeId;
+	ids[0].attributeId = UA_ATTRIBUTEID_DATATYPE;
+	ids[1].nodeId = _rd.nidNodeId;
+	ids[1].attributeId = UA_ATTRIBUTEID_DATATYPE;
+	ids[2].nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_NAMESPACEARRAY);
+	ids[3].nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_STARTTIME);
+	UA_ReadRequest request;
+	UA_ReadRequest_init(&request);
+	request.nodesToRead = ids;
+	request.nodesToReadSize = 4;
+	UA_ReadResponse response = UA_Client_Service_read(_client, request);
+	UA_StatusCode retval = response.responseHeader.serviceResult;
+	if (UA_STATUSCODE_GOOD == retval && response.resultsSize != 4) {
+		retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+	}
+	for (size_t i = 0; UA_STATUSCODE_GOOD == retval && i < 4; i++) {
+		if (response.results[i].status != UA_STATUSCODE_GOOD) {
+			retval = response.results[i].status;
+		}
+	}
+	if (UA_STATUSCODE_GOOD == retval) {
+		const UA_Variant& wrType = response.results[0].value;
+		const UA_Variant& rdType = response.results[1].value;
+		const UA_Variant& nsArray = response.results[2].value;
+		const UA_Variant& startTime = response.results[3].value;
+		info.TypesUnchanged =
+			UA_Variant_hasScalarType(&wrType, &UA_TYPES[UA_TYPES_NODEID]) &&
+			UA_NodeId_equal((UA_NodeId*)wrType.data, &_wr.nidDataType) &&
+			UA_Variant_hasScalarType(&rdType, &UA_TYPES[UA_TYPES_NODEID]) &&
+			UA_NodeId_equal((UA_NodeId*)rdType.data, &_rd.nidDataType);
+		info.Namespaces.clear();
+		if (UA_Variant_hasArrayType(&nsArray, &UA_TYPES[UA_TYPES_STRING])) {
+			const UA_String* ns = (const UA_String*)nsArray.data;
+			for (size_t i = 0; i < nsArray.arrayLength; i++) {
+				info.Namespaces.push_back(std::string((const char*)ns[i].data, ns[i].length));
+			}
+		}
+		info.StartTime = 0;
+		if (UA_Variant_hasScalarType(&startTime, &UA_TYPES[UA_TYPES_DATETIME])) {
+			info.StartTime = *(UA_DateTime*)startTime.data;
+		}
+	}
+	UA_ReadResponse_clear(&response);
+	return retval;
+}
+//---------------------------------------------------------------------------
 void TOpcUA_IOThread::Init(
 	const char* endpoint_url,   // "opc.tcp://10.10.2.27:4840"
 	int ns,         		// namespace
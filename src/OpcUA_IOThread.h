@@ -7,6 +7,7 @@
 //---------------------------------------------------------------------------
 #include <open62541.h>
 #include <string>
+#include <vector>
 #include "IOThread_Params.h"
 #include "Symbols.h"
 //---------------------------------------------------------------------------
@@ -59,6 +60,7 @@ private:
 			UA_NodeId_init(&nidNodeId);
 			UA_NodeId_init(&nidDataType);
 			UA_NodeId_init(&nidEncoding);
+			UA_NodeId_init(&nidRegistered);
 			UA_NodeClass_init(&nidNodeClass);
 			UA_Variant_init(&varInitVal);
 		}
@@ -66,6 +68,7 @@ private:
 			UA_NodeId_clear(&nidNodeId);
 			UA_NodeId_clear(&nidDataType);
 			UA_NodeId_clear(&nidEncoding);
+			UA_NodeId_clear(&nidRegistered);
 			UA_NodeClass_clear(&nidNodeClass);
 			UA_Variant_clear(&varInitVal);
 		}
@@ -81,11 +84,27 @@ private:
 		UA_NodeId 			nidDataType;        // the data type nodeID
 		UA_NodeId 			nidEncoding;        // the encoding nodeID
 		UA_NodeId 			ExpandedNodeId;     // The BLOB encoding as returned from the "ReadExtensionObject" initial call
+		UA_NodeId 			nidRegistered;      // alias of nidNodeId returned by RegisterNodes (null if not registered)
 		UA_NodeClass 		nidNodeClass;       // the variable nodeID (to read/write)
 		UA_Variant          varInitVal;         // initial value (read to get size of extension objects)
 		int                 InitialReadLength;
 		he::Symbols::TypeNode SymbolDef;
+		// the node ID to use for cyclic read/write
+		const UA_NodeId& ioNodeId() const {
+			return UA_NodeId_isNull(&nidRegistered) ? nidNodeId : nidRegistered;
+		}
+	};
+	// What the resolution of the cyclic nodes depends on. Compared after a
+	// reconnect to decide, if the resolved node IDs and types can be reused.
+	class ResumeInfo {
+	public:
+		ResumeInfo() : Valid(false), TypesUnchanged(false), StartTime(0) {}
+		bool                Valid;
+		bool                TypesUnchanged;
+		std::vector<std::string> Namespaces;    // the server's namespace array
+		UA_DateTime         StartTime;          // ServerStatus.StartTime
 	};
+	ResumeInfo          _resume;
 	UA_Client* 			_client;
     IOThread_Params*    _params;
 	CRITICAL_SECTION 	_cs;
@@ -101,12 +120,15 @@ private:
     UA_StatusCode       _lasterr;
 	DWORD               _stateTicker;
     int                 _connectRetries;
+	DWORD               _waitMs;            // reconnect delay
 	void StateMachine();
 	void ThreadSleep(DWORD ms);
 	void InitClientConfig();
 	UA_StatusCode readExtensionObjectValue(const UA_NodeId nodeId, UA_Variant *outValue, UA_NodeId* pExpandedNodeId);
 	UA_StatusCode writeExtensionObjectValue(const UA_NodeId nodeId, const UA_NodeId& dataTypeNodeId, const UA_ByteString *newValue);
 	UA_StatusCode initCyclicInfo(TOpcUA_IOThread::CyclicNode& cycNode);
+	void registerCyclicNodes();
+	UA_StatusCode readResumeInfo(ResumeInfo& info);
 	UA_StatusCode readwriteCyclic();
 	UA_StatusCode readStructureDefinition(UA_NodeId& nidNodeId, const std::string& Name, he::Symbols::TypeNode& sym, int offset = 0, int level = 0);
 	UA_StatusCode readNodeNames(UA_NodeId& nidNodeId, String& nameBrowse, String& nameDisplay);
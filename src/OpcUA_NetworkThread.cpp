@@ -0,0 +1,164 @@
+//---------------------------------------------------------------------------
+
+#include <System.hpp>
+#pragma hdrstop
+
+#include "OpcUA_NetworkThread.h"
+#include "logger.h"
+#pragma package(smart_init)
+//---------------------------------------------------------------------------
+extern bool gDllUnloadInProgress;
+
+//---------------------------------------------------------------------------
+UA_SOCKET OpcUA_OpenWakeupSocket(const char* owner)
+{
+	UA_SOCKET s = UA_socket(AF_INET, SOCK_DGRAM, 0);
+	if (s == UA_INVALID_SOCKET) {
+		XTRACE(XPERRORS, "OPC-UA %s: cannot create wakeup socket", owner);
+		return UA_INVALID_SOCKET;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	int len = sizeof(addr);
+	if (UA_bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		getsockname(s, (struct sockaddr*)&addr, &len) != 0 ||
+		UA_connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		XTRACE(XPERRORS, "OPC-UA %s: cannot bind wakeup socket", owner);
+		UA_close(s);
+		return UA_INVALID_SOCKET;
+	}
+	UA_socket_set_nonblocking(s);
+	return s;
+}
+void OpcUA_WaitWakeupSocket(UA_SOCKET s, DWORD ms)
+{
+	if (s == UA_INVALID_SOCKET) {
+		Sleep(ms);
+		return;
+	}
+	fd_set fds;
+	FD_ZERO(&fds);
+	UA_fd_set(s, &fds);
+	struct timeval tv;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	UA_select((UA_Int32)(s + 1), &fds, NULL, NULL, &tv);
+}
+void OpcUA_DrainWakeupSocket(UA_SOCKET s)
+{
+	if (s == UA_INVALID_SOCKET)
+		return;
+	char buf[16];
+	while (UA_recv(s, buf, sizeof(buf), 0) > 0)
+		;
+}
+//---------------------------------------------------------------------------
+TOpcUA_EventQueue::TOpcUA_EventQueue()
+	: _head(&_stub), _tail(&_stub), _stub(TOpcUA_ClientEvent::Notification)
+{
+}
+TOpcUA_EventQueue::~TOpcUA_EventQueue()
+{
+	// free whatever was not fetched
+	TOpcUA_ClientEvent* ev;
+	while ((ev = Pop()) != NULL) {
+		delete ev;
+	}
+}
+void TOpcUA_EventQueue::Push(TOpcUA_ClientEvent* ev)
+{
+	ev->next.store(NULL, std::memory_order_relaxed);
+	TOpcUA_ClientEvent* prev = _head.exchange(ev, std::memory_order_acq_rel);
+	prev->next.store(ev, std::memory_order_release);
+}
+TOpcUA_ClientEvent* TOpcUA_EventQueue::Pop()
+{
+	TOpcUA_ClientEvent* tail = _tail;
+	TOpcUA_ClientEvent* next = tail->next.load(std::memory_order_acquire);
+	if (tail == &_stub) {
+		if (next == NULL)
+			return NULL;
+		_tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next != NULL) {
+		_tail = next;
+		return tail;
+	}
+	if (tail != _head.load(std::memory_order_acquire)) {
+		// a producer is in the middle of a push, get it next time
+		return NULL;
+	}
+	Push(&_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next != NULL) {
+		_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------------------------
+__fastcall TOpcUA_NetworkThread::TOpcUA_NetworkThread(UA_Client* client, TOpcUA_ClientLock* lock, DWORD intervalMs)
+	: TThread(true), _client(client), _lock(lock), _intervalMs(intervalMs), _signaled(false),
+	  _wakeup(UA_INVALID_SOCKET), _lastStatus(UA_STATUSCODE_GOOD) // always create suspended
+{
+	XTRACE(XPDIAG2, "OPC-UA network thread instantiated");
+	// makes the pending events visible to socket based event loops (GetPollFd)
+	_wakeup = OpcUA_OpenWakeupSocket("network thread");
+}
+__fastcall TOpcUA_NetworkThread::~TOpcUA_NetworkThread()
+{
+	if (_wakeup != UA_INVALID_SOCKET) {
+		UA_close(_wakeup);
+	}
+}
+//---------------------------------------------------------------------------
+void __fastcall TOpcUA_NetworkThread::Execute()
+{
+	NameThreadForDebugging(System::String(L"OpcUA_NetworkThread"));
+	while (!Terminated && !gDllUnloadInProgress) {
+		_lock->Enter();
+		_lastStatus = UA_Client_run_iterate(_client, 0);
+		_lock->Leave();
+		// don't hold the lock while waiting, lua needs it for its requests
+		Sleep(_intervalMs);
+	}
+}
+//---------------------------------------------------------------------------
+void TOpcUA_NetworkThread::Post(TOpcUA_ClientEvent* ev)
+{
+	_queue.Push(ev);
+	if (!_signaled.exchange(true) && _wakeup != UA_INVALID_SOCKET) {
+		char c = 0;
+		UA_send(_wakeup, &c, 1, 0);
+	}
+}
+TOpcUA_ClientEvent* TOpcUA_NetworkThread::Fetch()
+{
+	TOpcUA_ClientEvent* ev = _queue.Pop();
+	if (ev != NULL)
+		return ev;
+	// Queue empty: consume the wakeup datagrams unconditionally (non blocking). A Post sends
+	// its datagram after setting the flag, so it may arrive after an earlier Fetch cleared it.
+	OpcUA_DrainWakeupSocket(_wakeup);
+	_signaled.store(false);
+	// an event posted before the flag was cleared did not send a new datagram
+	return _queue.Pop();
+}
+bool TOpcUA_NetworkThread::WaitForEvents(DWORD ms)
+{
+	if (_signaled.load())
+		return true;
+	OpcUA_WaitWakeupSocket(_wakeup, ms);
+	return _signaled.load();
+}
+int TOpcUA_NetworkThread::GetPollFd()
+{
+	return (int)_wakeup;
+}
+//---------------------------------------------------------------------------
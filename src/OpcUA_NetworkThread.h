@@ -0,0 +1,112 @@
+//---------------------------------------------------------------------------
+
+#ifndef OpcUA_NetworkThreadH
+#define OpcUA_NetworkThreadH
+//---------------------------------------------------------------------------
+#include <System.Classes.hpp>
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <open62541.h>
+//---------------------------------------------------------------------------
+// Serializes the access to an UA_Client. open62541 clients are not thread safe,
+// so every call into the client must hold this lock as soon as a network thread
+// runs beside the lua thread. The lock is recursive (critical section).
+class TOpcUA_ClientLock
+{
+public:
+	TOpcUA_ClientLock() { InitializeCriticalSection(&_cs); }
+	~TOpcUA_ClientLock() { DeleteCriticalSection(&_cs); }
+	void Enter() { EnterCriticalSection(&_cs); }
+	bool TryEnter() { return TryEnterCriticalSection(&_cs) != 0; }
+	void Leave() { LeaveCriticalSection(&_cs); }
+
+	class Guard {
+	public:
+		Guard(TOpcUA_ClientLock* lock) : _lock(lock) { _lock->Enter(); }
+		~Guard() { _lock->Leave(); }
+	private:
+		TOpcUA_ClientLock* _lock;
+	};
+private:
+	CRITICAL_SECTION _cs;
+};
+//---------------------------------------------------------------------------
+// Wakeup socket: a loopback UDP socket connected to itself. It is readable while a
+// datagram is pending, so queued work is visible to socket based event loops
+// (select/poll, luv, skynet). UA_INVALID_SOCKET if it cannot be created.
+UA_SOCKET OpcUA_OpenWakeupSocket(const char* owner);
+void OpcUA_WaitWakeupSocket(UA_SOCKET s, DWORD ms);     // until readable, at most ms
+void OpcUA_DrainWakeupSocket(UA_SOCKET s);              // non blocking
+//---------------------------------------------------------------------------
+// Something that happened in the client, to be handed over to lua
+struct TOpcUA_ClientEvent
+{
+	enum Type { Notification, StateChange, AsyncResponse, SubscriptionDeleted };
+
+	TOpcUA_ClientEvent(Type t) : next(NULL), type(t), subId(0), monId(0), monContext(NULL),
+		channelState(UA_SECURECHANNELSTATE_CLOSED), sessionState(UA_SESSIONSTATE_CLOSED),
+		connectStatus(UA_STATUSCODE_GOOD), requestId(0), userdata(NULL), response(NULL) {
+		UA_DataValue_init(&value);
+	}
+	~TOpcUA_ClientEvent() {
+		UA_DataValue_clear(&value);
+	}
+
+	std::atomic<TOpcUA_ClientEvent*> next;
+	Type                  type;
+	// Notification, SubscriptionDeleted
+	UA_UInt32             subId;
+	UA_UInt32             monId;
+	void*                 monContext;
+	UA_DataValue          value;            // owned by the event until it is taken
+	// StateChange
+	UA_SecureChannelState channelState;
+	UA_SessionState       sessionState;
+	UA_StatusCode         connectStatus;
+	// AsyncResponse
+	UA_UInt32             requestId;
+	void*                 userdata;         // the request context, knows the response type
+	void*                 response;         // owned by the receiver
+};
+//---------------------------------------------------------------------------
+// Lock free intrusive multi producer / single consumer queue (D. Vyukov).
+// Push may be called from any thread, Pop only from one (the lua) thread.
+class TOpcUA_EventQueue
+{
+public:
+	TOpcUA_EventQueue();
+	~TOpcUA_EventQueue();
+	void Push(TOpcUA_ClientEvent* ev);
+	TOpcUA_ClientEvent* Pop();              // NULL if empty
+private:
+	std::atomic<TOpcUA_ClientEvent*> _head;
+	TOpcUA_ClientEvent*   _tail;
+	TOpcUA_ClientEvent    _stub;
+};
+//---------------------------------------------------------------------------
+// Runs the client's network processing (UA_Client_run_iterate) in the background,
+// so keep alives, publish requests etc. are handled independent of lua. All events
+// for lua are queued and fetched by the lua thread (see UA_Client_Proxy::poll).
+class TOpcUA_NetworkThread : public TThread
+{
+protected:
+	void __fastcall Execute();
+public:
+	__fastcall TOpcUA_NetworkThread(UA_Client* client, TOpcUA_ClientLock* lock, DWORD intervalMs);
+	__fastcall ~TOpcUA_NetworkThread();
+	void Post(TOpcUA_ClientEvent* ev);      // any thread
+	TOpcUA_ClientEvent* Fetch();            // lua thread only, NULL if there are no more events
+	bool WaitForEvents(DWORD ms);           // lua thread only, true if events are pending
+	int GetPollFd();                        // readable as long as events are pending
+	UA_StatusCode GetLastStatus() { return _lastStatus; }
+private:
+	UA_Client*          _client;
+	TOpcUA_ClientLock*  _lock;
+	DWORD               _intervalMs;
+	TOpcUA_EventQueue   _queue;
+	std::atomic<bool>   _signaled;          // a wakeup datagram is pending
+	UA_SOCKET           _wakeup;            // loopback UDP socket connected to itself
+	volatile UA_StatusCode _lastStatus;
+};
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,1219 @@
+//---------------------------------------------------------------------------
+
+#include <System.hpp>
+#pragma hdrstop
+
+#include <stdlib.h>
+#include <string.h>
+#include "OpcUA_NodeSet.h"
+#include "logger.h"
+#pragma package(smart_init)
+//---------------------------------------------------------------------------
+TOpcUA_XmlReader::TOpcUA_XmlReader()
+	: _file(NULL), _pos(0), _len(0), _depth(0), _line(1), _pendingEnd(false)
+{
+}
+TOpcUA_XmlReader::~TOpcUA_XmlReader()
+{
+	if (_file)
+		fclose(_file);
+}
+bool TOpcUA_XmlReader::Open(const char* path)
+{
+	_file = fopen(path, "rb");
+	return _file != NULL;
+}
+//---------------------------------------------------------------------------
+int TOpcUA_XmlReader::Peek()
+{
+	if (_pos == _len) {
+		_pos = 0;
+		_len = _file ? fread(_buf, 1, sizeof(_buf), _file) : 0;
+		if (_len == 0)
+			return EOF;
+	}
+	return (unsigned char)_buf[_pos];
+}
+int TOpcUA_XmlReader::Get()
+{
+	int c = Peek();
+	if (c != EOF) {
+		_pos++;
+		if (c == '\n')
+			_line++;
+	}
+	return c;
+}
+// Consume everything up to and including the given terminator
+bool TOpcUA_XmlReader::SkipPast(const char* end)
+{
+	size_t len = strlen(end), matched = 0;
+	int c;
+	while ((c = Get()) != EOF) {
+		if (c == end[matched]) {
+			if (++matched == len)
+				return true;
+		}
+		else
+			matched = (c == end[0]) ? 1 : 0;
+	}
+	return false;
+}
+void TOpcUA_XmlReader::Decode(std::string& s)
+{
+	size_t amp = s.find('&');
+	if (amp == std::string::npos)
+		return;
+	std::string out;
+	out.reserve(s.size());
+	out.append(s, 0, amp);
+	for (size_t i = amp; i < s.size(); i++) {
+		if (s[i] != '&') {
+			out += s[i];
+			continue;
+		}
+		size_t semi = s.find(';', i);
+		if (semi == std::string::npos) {
+			out += s[i];
+			continue;
+		}
+		std::string ent = s.substr(i + 1, semi - i - 1);
+		if (ent == "lt") out += '<';
+		else if (ent == "gt") out += '>';
+		else if (ent == "amp") out += '&';
+		else if (ent == "quot") out += '"';
+		else if (ent == "apos") out += '\'';
+		else if (!ent.empty() && ent[0] == '#') {
+			unsigned long cp = (ent.size() > 1 && (ent[1] == 'x' || ent[1] == 'X'))
+				? strtoul(ent.c_str() + 2, NULL, 16) : strtoul(ent.c_str() + 1, NULL, 10);
+			// UTF-8 encode
+			if (cp < 0x80) out += (char)cp;
+			else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+			else if (cp < 0x10000) { out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); }
+			else { out += (char)(0xF0 | (cp >> 18)); out += (char)(0x80 | ((cp >> 12) & 0x3F)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); }
+		}
+		else {
+			out.append(s, i, semi - i + 1);     // unknown entity, keep it
+		}
+		i = semi;
+	}
+	s.swap(out);
+}
+static void stripPrefix(std::string& name)
+{
+	size_t colon = name.find(':');
+	if (colon != std::string::npos)
+		name.erase(0, colon + 1);
+}
+//---------------------------------------------------------------------------
+TOpcUA_XmlReader::Token TOpcUA_XmlReader::Next()
+{
+	if (_pendingEnd) {
+		_pendingEnd = false;
+		_depth--;
+		return EndElement;
+	}
+	for (;;) {
+		int c = Peek();
+		if (c == EOF)
+			return EndOfFile;
+		if (c != '<') {
+			_text.clear();
+			bool blank = true;
+			while ((c = Peek()) != EOF && c != '<') {
+				if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+					blank = false;
+				_text += (char)Get();
+			}
+			if (blank)
+				continue;               // whitespace between elements
+			Decode(_text);
+			return Characters;
+		}
+		Get();
+		c = Peek();
+		if (c == '?') {                 // <?xml ... ?>
+			if (!SkipPast("?>"))
+				return Error;
+			continue;
+		}
+		if (c == '!') {
+			Get();
+			if (Peek() == '-') {        // <!-- comment -->
+				if (!SkipPast("-->"))
+					return Error;
+				continue;
+			}
+			if (Peek() == '[') {        // <![CDATA[ ... ]]>
+				if (!SkipPast("["))
+					return Error;
+				if (!SkipPast("["))
+					return Error;
+				_text.clear();
+				while ((c = Get()) != EOF) {
+					_text += (char)c;
+					if (_text.size() >= 3 && _text.compare(_text.size() - 3, 3, "]]>") == 0) {
+						_text.resize(_text.size() - 3);
+						return Characters;
+					}
+				}
+				return Error;
+			}
+			if (!SkipPast(">"))         // <!DOCTYPE ...>
+				return Error;
+			continue;
+		}
+		if (c == '/') {                 // </name>
+			Get();
+			_name.clear();
+			while ((c = Get()) != EOF && c != '>')
+				if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+					_name += (char)c;
+			if (c == EOF)
+				return Error;
+			stripPrefix(_name);
+			_depth--;
+			return EndElement;
+		}
+		// <name attr="value" ...> or <name .../>
+		_name.clear();
+		_attrs.clear();
+		while ((c = Peek()) != EOF && c != '>' && c != '/' && c != ' ' && c != '\t' && c != '\r' && c != '\n')
+			_name += (char)Get();
+		stripPrefix(_name);
+		for (;;) {
+			while ((c = Peek()) == ' ' || c == '\t' || c == '\r' || c == '\n')
+				Get();
+			if (c == EOF)
+				return Error;
+			if (c == '/') {
+				Get();
+				if (Get() != '>')
+					return Error;
+				_pendingEnd = true;
+				break;
+			}
+			if (c == '>') {
+				Get();
+				break;
+			}
+			std::string attr, value;
+			while ((c = Peek()) != EOF && c != '=' && c != ' ' && c != '\t' && c != '\r' && c != '\n')
+				attr += (char)Get();
+			while ((c = Peek()) == ' ' || c == '\t' || c == '\r' || c == '\n')
+				Get();
+			if (Get() != '=')
+				return Error;
+			while ((c = Peek()) == ' ' || c == '\t' || c == '\r' || c == '\n')
+				Get();
+			int quote = Get();
+			if (quote != '"' && quote != '\'')
+				return Error;
+			while ((c = Get()) != EOF && c != quote)
+				value += (char)c;
+			if (c == EOF)
+				return Error;
+			Decode(value);
+			_attrs.push_back(std::make_pair(attr, value));
+		}
+		_depth++;
+		return StartElement;
+	}
+}
+void TOpcUA_XmlReader::Skip()
+{
+	int depth = _depth - 1;
+	Token t;
+	while ((t = Next()) != EndOfFile && t != Error) {
+		if (t == EndElement && _depth == depth)
+			return;
+	}
+}
+std::string TOpcUA_XmlReader::ReadText()
+{
+	std::string s;
+	int depth = _depth - 1;
+	Token t;
+	while ((t = Next()) != EndOfFile && t != Error) {
+		if (t == Characters)
+			s += _text;
+		else if (t == StartElement)
+			Skip();
+		else if (t == EndElement && _depth == depth)
+			break;
+	}
+	return s;
+}
+const char* TOpcUA_XmlReader::Attr(const char* name) const
+{
+	for (size_t i = 0; i < _attrs.size(); i++) {
+		if (_attrs[i].first == name)
+			return _attrs[i].second.c_str();
+	}
+	return NULL;
+}
+//---------------------------------------------------------------------------
+TOpcUA_NodeSetNode::TOpcUA_NodeSetNode()
+	: NodeClass(UA_NODECLASS_UNSPECIFIED), ValueRank(UA_VALUERANK_SCALAR),
+	  AccessLevel(UA_ACCESSLEVELMASK_READ), EventNotifier(0), IsAbstract(false),
+	  Symmetric(false), Historizing(false), MinimumSamplingInterval(0)
+{
+	UA_NodeId_init(&NodeId);
+	UA_QualifiedName_init(&BrowseName);
+	UA_LocalizedText_init(&DisplayName);
+	UA_LocalizedText_init(&Description);
+	UA_LocalizedText_init(&InverseName);
+	UA_NodeId_init(&ParentNodeId);
+	UA_NodeId_init(&DataType);
+	UA_Variant_init(&Value);
+}
+TOpcUA_NodeSetNode::~TOpcUA_NodeSetNode()
+{
+	UA_NodeId_clear(&NodeId);
+	UA_QualifiedName_clear(&BrowseName);
+	UA_LocalizedText_clear(&DisplayName);
+	UA_LocalizedText_clear(&Description);
+	UA_LocalizedText_clear(&InverseName);
+	UA_NodeId_clear(&ParentNodeId);
+	UA_NodeId_clear(&DataType);
+	UA_Variant_clear(&Value);
+	for (size_t i = 0; i < References.size(); i++) {
+		UA_NodeId_clear(&References[i].ReferenceType);
+		UA_NodeId_clear(&References[i].Target);
+	}
+	for (size_t i = 0; i < Fields.size(); i++)
+		UA_NodeId_clear(&Fields[i].DataType);
+}
+// The ids are copied
+void TOpcUA_NodeSetNode::AddReference(const UA_NodeId& referenceType, const UA_NodeId& target, bool isForward)
+{
+	Reference ref;
+	UA_NodeId_copy(&referenceType, &ref.ReferenceType);
+	UA_NodeId_copy(&target, &ref.Target);
+	ref.IsForward = isForward;
+	References.push_back(ref);
+}
+//---------------------------------------------------------------------------
+namespace OpcUA_NodeSet {
+
+static const struct {
+	UA_NodeClass    nodeClass;
+	const char*     element;
+} _nodeClasses[] = {
+	{ UA_NODECLASS_OBJECT,          "UAObject" },
+	{ UA_NODECLASS_VARIABLE,        "UAVariable" },
+	{ UA_NODECLASS_METHOD,          "UAMethod" },
+	{ UA_NODECLASS_OBJECTTYPE,      "UAObjectType" },
+	{ UA_NODECLASS_VARIABLETYPE,    "UAVariableType" },
+	{ UA_NODECLASS_REFERENCETYPE,   "UAReferenceType" },
+	{ UA_NODECLASS_DATATYPE,        "UADataType" },
+	{ UA_NODECLASS_VIEW,            "UAView" },
+};
+
+bool IsHierarchical(const UA_NodeId& referenceType)
+{
+	if (referenceType.namespaceIndex != 0 || referenceType.identifierType != UA_NODEIDTYPE_NUMERIC)
+		return false;
+	switch (referenceType.identifier.numeric) {
+	case UA_NS0ID_HIERARCHICALREFERENCES:
+	case UA_NS0ID_HASCHILD:
+	case UA_NS0ID_ORGANIZES:
+	case UA_NS0ID_HASEVENTSOURCE:
+	case UA_NS0ID_AGGREGATES:
+	case UA_NS0ID_HASSUBTYPE:
+	case UA_NS0ID_HASPROPERTY:
+	case UA_NS0ID_HASCOMPONENT:
+	case UA_NS0ID_HASNOTIFIER:
+	case UA_NS0ID_HASORDEREDCOMPONENT:
+		return true;
+	}
+	return false;
+}
+const char* NodeClassElement(UA_NodeClass nodeClass)
+{
+	for (size_t i = 0; i < sizeof(_nodeClasses) / sizeof(_nodeClasses[0]); i++) {
+		if (_nodeClasses[i].nodeClass == nodeClass)
+			return _nodeClasses[i].element;
+	}
+	return NULL;
+}
+static UA_NodeClass nodeClassFromElement(const std::string& element)
+{
+	for (size_t i = 0; i < sizeof(_nodeClasses) / sizeof(_nodeClasses[0]); i++) {
+		if (element == _nodeClasses[i].element)
+			return _nodeClasses[i].nodeClass;
+	}
+	return UA_NODECLASS_UNSPECIFIED;
+}
+// The builtin types (by their XML element name) of the values we import / export
+static const struct {
+	const char* name;
+	int         index;
+} _builtinTypes[] = {
+	{ "Boolean", UA_TYPES_BOOLEAN }, { "SByte", UA_TYPES_SBYTE }, { "Byte", UA_TYPES_BYTE },
+	{ "Int16", UA_TYPES_INT16 }, { "UInt16", UA_TYPES_UINT16 }, { "Int32", UA_TYPES_INT32 },
+	{ "UInt32", UA_TYPES_UINT32 }, { "Int64", UA_TYPES_INT64 }, { "UInt64", UA_TYPES_UINT64 },
+	{ "Float", UA_TYPES_FLOAT }, { "Double", UA_TYPES_DOUBLE }, { "String", UA_TYPES_STRING },
+	{ "DateTime", UA_TYPES_DATETIME }, { "LocalizedText", UA_TYPES_LOCALIZEDTEXT },
+};
+static const UA_DataType* builtinType(const std::string& name)
+{
+	for (size_t i = 0; i < sizeof(_builtinTypes) / sizeof(_builtinTypes[0]); i++) {
+		if (name == _builtinTypes[i].name)
+			return &UA_TYPES[_builtinTypes[i].index];
+	}
+	return NULL;
+}
+const char* BuiltinTypeName(const UA_DataType* type)
+{
+	for (size_t i = 0; i < sizeof(_builtinTypes) / sizeof(_builtinTypes[0]); i++) {
+		if (type == &UA_TYPES[_builtinTypes[i].index])
+			return _builtinTypes[i].name;
+	}
+	return NULL;
+}
+std::string ToString(const UA_String& s)
+{
+	return std::string((const char*)s.data, s.length);
+}
+std::string ToString(const UA_NodeId& id)
+{
+	UA_String s = UA_STRING_NULL;
+	UA_NodeId_print(&id, &s);
+	std::string str = ToString(s);
+	UA_String_clear(&s);
+	return str;
+}
+static bool parseBool(const char* s)
+{
+	return strcmp(s, "true") == 0 || strcmp(s, "1") == 0;
+}
+// xs:dateTime, e.g. "2020-06-30T12:00:00.000Z"
+static UA_DateTime parseDateTime(const char* s)
+{
+	UA_DateTimeStruct dts;
+	memset(&dts, 0, sizeof(dts));
+	unsigned int ms = 0;
+	int n = sscanf(s, "%hu-%hu-%huT%hu:%hu:%hu.%3u", &dts.year, &dts.month, &dts.day,
+		&dts.hour, &dts.min, &dts.sec, &ms);
+	if (n < 6)
+		return 0;
+	dts.milliSec = (UA_UInt16)ms;
+	return UA_DateTime_fromStruct(dts);
+}
+static void parseScalar(const UA_DataType* type, const std::string& text, void* dst)
+{
+	const char* s = text.c_str();
+	switch (type->typeIndex) {
+	case UA_TYPES_BOOLEAN:  *(UA_Boolean*)dst = parseBool(s); break;
+	case UA_TYPES_SBYTE:    *(UA_SByte*)dst = (UA_SByte)strtol(s, NULL, 10); break;
+	case UA_TYPES_BYTE:     *(UA_Byte*)dst = (UA_Byte)strtoul(s, NULL, 10); break;
+	case UA_TYPES_INT16:    *(UA_Int16*)dst = (UA_Int16)strtol(s, NULL, 10); break;
+	case UA_TYPES_UINT16:   *(UA_UInt16*)dst = (UA_UInt16)strtoul(s, NULL, 10); break;
+	case UA_TYPES_INT32:    *(UA_Int32*)dst = (UA_Int32)strtol(s, NULL, 10); break;
+	case UA_TYPES_UINT32:   *(UA_UInt32*)dst = (UA_UInt32)strtoul(s, NULL, 10); break;
+	case UA_TYPES_INT64:    *(UA_Int64*)dst = strtoll(s, NULL, 10); break;
+	case UA_TYPES_UINT64:   *(UA_UInt64*)dst = strtoull(s, NULL, 10); break;
+	case UA_TYPES_FLOAT:    *(UA_Float*)dst = (UA_Float)strtod(s, NULL); break;
+	case UA_TYPES_DOUBLE:   *(UA_Double*)dst = strtod(s, NULL); break;
+	case UA_TYPES_STRING:   *(UA_String*)dst = UA_String_fromChars(s); break;
+	case UA_TYPES_DATETIME: *(UA_DateTime*)dst = parseDateTime(s); break;
+	}
+}
+
+} // namespace OpcUA_NodeSet
+using namespace OpcUA_NodeSet;
+//---------------------------------------------------------------------------
+TOpcUA_NodeSetImporter::TOpcUA_NodeSetImporter(UA_Server* server, he::Symbols::TypeDB* db)
+	: _server(server), _db(db)
+{
+}
+TOpcUA_NodeSetImporter::~TOpcUA_NodeSetImporter()
+{
+	Clear();
+}
+void TOpcUA_NodeSetImporter::Clear()
+{
+	for (std::list<TOpcUA_NodeSetNode*>::iterator it = _pending.begin(); it != _pending.end(); ++it)
+		delete *it;
+	_pending.clear();
+	for (std::list<TOpcUA_NodeSetNode*>::iterator it = _dataTypes.begin(); it != _dataTypes.end(); ++it)
+		delete *it;
+	_dataTypes.clear();
+	for (size_t i = 0; i < _references.size(); i++) {
+		UA_NodeId_clear(&_references[i].Source);
+		UA_NodeId_clear(&_references[i].ReferenceType);
+		UA_NodeId_clear(&_references[i].Target);
+	}
+	_references.clear();
+	_forwardParents.clear();
+}
+//---------------------------------------------------------------------------
+// The node refers to one not added yet (NodeSet2 files are not sorted)
+static bool isMissingNode(UA_StatusCode sc)
+{
+	return sc == UA_STATUSCODE_BADPARENTNODEIDINVALID || sc == UA_STATUSCODE_BADTYPEDEFINITIONINVALID ||
+		sc == UA_STATUSCODE_BADREFERENCETYPEIDINVALID;
+}
+UA_StatusCode TOpcUA_NodeSetImporter::Import(const char* path)
+{
+	TOpcUA_XmlReader xml;
+	if (!xml.Open(path)) {
+		_error = std::string("cannot open ") + path;
+		return UA_STATUSCODE_BADNOTFOUND;
+	}
+	_nsMap.assign(1, 0);
+	TOpcUA_XmlReader::Token t;
+	while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile) {
+		if (t == TOpcUA_XmlReader::Error)
+			break;
+		if (t != TOpcUA_XmlReader::StartElement)
+			continue;
+		const std::string& name = xml.Name();
+		if (name == "UANodeSet")
+			continue;                               // descend
+		if (name == "NamespaceUris") {
+			ParseNamespaces(xml);
+			continue;
+		}
+		if (name == "Aliases") {
+			ParseAliases(xml);
+			continue;
+		}
+		UA_NodeClass nodeClass = nodeClassFromElement(name);
+		if (nodeClass == UA_NODECLASS_UNSPECIFIED) {
+			xml.Skip();                             // Models, Extensions, ...
+			continue;
+		}
+		TOpcUA_NodeSetNode* node = new TOpcUA_NodeSetNode();
+		node->NodeClass = nodeClass;
+		ParseNode(xml, *node);
+		UA_StatusCode sc = AddNode(*node);
+		if (isMissingNode(sc))
+			_pending.push_back(node);               // forward reference, retry at the end
+		else if (!node->Fields.empty() && sc == UA_STATUSCODE_GOOD)
+			_dataTypes.push_back(node);
+		else
+			delete node;
+	}
+	if (t == TOpcUA_XmlReader::Error) {
+		char buf[64];
+		sprintf(buf, "XML syntax error in line %d", xml.Line());
+		_error = buf;
+		Clear();
+		return UA_STATUSCODE_BADDECODINGERROR;
+	}
+
+	// nodes that came before their parent / type definition
+	bool progress = true;
+	while (progress && !_pending.empty()) {
+		progress = false;
+		for (std::list<TOpcUA_NodeSetNode*>::iterator it = _pending.begin(); it != _pending.end(); ) {
+			UA_StatusCode sc = AddNode(**it);
+			if (isMissingNode(sc)) {
+				++it;
+				continue;
+			}
+			progress = true;
+			if (!(*it)->Fields.empty() && sc == UA_STATUSCODE_GOOD)
+				_dataTypes.push_back(*it);
+			else
+				delete *it;
+			it = _pending.erase(it);
+		}
+	}
+	for (std::list<TOpcUA_NodeSetNode*>::iterator it = _pending.begin(); it != _pending.end(); ++it) {
+		XTRACE(XPERRORS, "NodeSet import: node %s has no parent or type definition", ToString((*it)->NodeId).c_str());
+		_stats.cntFailed++;
+	}
+
+	// the remaining references (both ends exist now)
+	for (size_t i = 0; i < _references.size(); i++) {
+		SourceReference& ref = _references[i];
+		UA_ExpandedNodeId target = UA_EXPANDEDNODEID_NUMERIC(0, 0);
+		target.nodeId = ref.Target;
+		UA_StatusCode sc = UA_Server_addReference(_server, ref.Source, ref.ReferenceType, target, ref.IsForward);
+		if (sc == UA_STATUSCODE_GOOD)
+			_stats.cntReferences++;
+		else if (sc != UA_STATUSCODE_BADDUPLICATEREFERENCENOTALLOWED)
+			XTRACE(XPDIAG1, "NodeSet import: reference %s -> %s: %s", ToString(ref.Source).c_str(),
+				ToString(ref.Target).c_str(), UA_StatusCode_name(sc));
+	}
+
+	// structures, nested types must come first
+	progress = true;
+	while (progress && !_dataTypes.empty()) {
+		progress = false;
+		for (std::list<TOpcUA_NodeSetNode*>::iterator it = _dataTypes.begin(); it != _dataTypes.end(); ) {
+			if (!AddType(**it)) {
+				++it;
+				continue;
+			}
+			progress = true;
+			delete *it;
+			it = _dataTypes.erase(it);
+		}
+	}
+	for (std::list<TOpcUA_NodeSetNode*>::iterator it = _dataTypes.begin(); it != _dataTypes.end(); ++it)
+		XTRACE(XPERRORS, "NodeSet import: unsupported structure %s", (*it)->DefinitionName.c_str());
+	Clear();
+	return UA_STATUSCODE_GOOD;
+}
+//---------------------------------------------------------------------------
+void TOpcUA_NodeSetImporter::ParseNamespaces(TOpcUA_XmlReader& xml)
+{
+	int depth = xml.Depth() - 1;
+	TOpcUA_XmlReader::Token t;
+	while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+		if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == depth)
+			return;
+		if (t == TOpcUA_XmlReader::StartElement && xml.Name() == "Uri")
+			_nsMap.push_back(UA_Server_addNamespace(_server, xml.ReadText().c_str()));
+	}
+}
+void TOpcUA_NodeSetImporter::ParseAliases(TOpcUA_XmlReader& xml)
+{
+	int depth = xml.Depth() - 1;
+	TOpcUA_XmlReader::Token t;
+	while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+		if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == depth)
+			return;
+		if (t == TOpcUA_XmlReader::StartElement && xml.Name() == "Alias") {
+			const char* alias = xml.Attr("Alias");
+			std::string alias_ = alias ? alias : "";
+			_aliases[alias_] = xml.ReadText();
+		}
+	}
+}
+// "i=85", "ns=1;s=Name", "ns=2;g=09087e75-8e5e-499b-954f-f2a9603db28a" or an alias.
+// The namespace index of the file is mapped to the one in the server.
+bool TOpcUA_NodeSetImporter::ParseNodeId(const char* str, UA_NodeId* out)
+{
+	UA_NodeId_init(out);
+	if (str == NULL)
+		return false;
+	std::map<std::string, std::string>::const_iterator alias = _aliases.find(str);
+	if (alias != _aliases.end())
+		str = alias->second.c_str();
+	UA_UInt16 ns = 0;
+	if (strncmp(str, "ns=", 3) == 0) {
+		char* end;
+		unsigned long idx = strtoul(str + 3, &end, 10);
+		if (*end != ';')
+			return false;
+		ns = idx < _nsMap.size() ? _nsMap[idx] : (UA_UInt16)idx;
+		str = end + 1;
+	}
+	if (str[0] == '\0' || str[1] != '=')
+		return false;
+	switch (str[0]) {
+	case 'i':
+		*out = UA_NODEID_NUMERIC(ns, (UA_UInt32)strtoul(str + 2, NULL, 10));
+		return true;
+	case 's':
+		*out = UA_NODEID_STRING_ALLOC(ns, str + 2);
+		return true;
+	case 'g': {
+		unsigned int d[11];
+		if (sscanf(str + 2, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x", &d[0], &d[1], &d[2],
+				&d[3], &d[4], &d[5], &d[6], &d[7], &d[8], &d[9], &d[10]) != 11)
+			return false;
+		UA_Guid guid;
+		guid.data1 = d[0];
+		guid.data2 = (UA_UInt16)d[1];
+		guid.data3 = (UA_UInt16)d[2];
+		for (int i = 0; i < 8; i++)
+			guid.data4[i] = (UA_Byte)d[3 + i];
+		*out = UA_NODEID_GUID(ns, guid);
+		return true;
+	}
+	}
+	return false;                   // opaque (b=) ids are not supported
+}
+// "1:Name", the namespace index is mapped like in ParseNodeId
+void TOpcUA_NodeSetImporter::ParseQualifiedName(const char* str, UA_QualifiedName* out)
+{
+	UA_QualifiedName_init(out);
+	if (str == NULL)
+		return;
+	const char* p = str;
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (p != str && *p == ':') {
+		unsigned long idx = strtoul(str, NULL, 10);
+		*out = UA_QUALIFIEDNAME_ALLOC(idx < _nsMap.size() ? _nsMap[idx] : (UA_UInt16)idx, p + 1);
+	}
+	else
+		*out = UA_QUALIFIEDNAME_ALLOC(0, str);
+}
+//---------------------------------------------------------------------------
+void TOpcUA_NodeSetImporter::ParseNode(TOpcUA_XmlReader& xml, TOpcUA_NodeSetNode& node)
+{
+	const char* a;
+	ParseNodeId(xml.Attr("NodeId"), &node.NodeId);
+	ParseQualifiedName(xml.Attr("BrowseName"), &node.BrowseName);
+	ParseNodeId(xml.Attr("ParentNodeId"), &node.ParentNodeId);
+	if ((a = xml.Attr("DataType")) != NULL)
+		ParseNodeId(a, &node.DataType);
+	else
+		node.DataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
+	if ((a = xml.Attr("ValueRank")) != NULL)
+		node.ValueRank = atoi(a);
+	if ((a = xml.Attr("AccessLevel")) != NULL)
+		node.AccessLevel = (UA_Byte)atoi(a);
+	if ((a = xml.Attr("EventNotifier")) != NULL)
+		node.EventNotifier = (UA_Byte)atoi(a);
+	if ((a = xml.Attr("IsAbstract")) != NULL)
+		node.IsAbstract = parseBool(a);
+	if ((a = xml.Attr("Symmetric")) != NULL)
+		node.Symmetric = parseBool(a);
+	if ((a = xml.Attr("Historizing")) != NULL)
+		node.Historizing = parseBool(a);
+	if ((a = xml.Attr("MinimumSamplingInterval")) != NULL)
+		node.MinimumSamplingInterval = strtod(a, NULL);
+
+	int depth = xml.Depth() - 1;
+	TOpcUA_XmlReader::Token t;
+	while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+		if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == depth)
+			return;
+		if (t != TOpcUA_XmlReader::StartElement)
+			continue;
+		const std::string name = xml.Name();
+		if (name == "DisplayName" || name == "Description" || name == "InverseName") {
+			UA_LocalizedText* lt = name == "DisplayName" ? &node.DisplayName :
+				name == "Description" ? &node.Description : &node.InverseName;
+			a = xml.Attr("Locale");
+			std::string locale = a ? a : "";
+			UA_LocalizedText_clear(lt);
+			*lt = UA_LOCALIZEDTEXT_ALLOC(locale.c_str(), xml.ReadText().c_str());
+		}
+		else if (name == "References") {
+			int refDepth = xml.Depth() - 1;
+			while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+				if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == refDepth)
+					break;
+				if (t != TOpcUA_XmlReader::StartElement || xml.Name() != "Reference")
+					continue;
+				TOpcUA_NodeSetNode::Reference ref;
+				a = xml.Attr("IsForward");
+				ref.IsForward = a == NULL || parseBool(a);
+				if (ParseNodeId(xml.Attr("ReferenceType"), &ref.ReferenceType) &&
+					ParseNodeId(xml.ReadText().c_str(), &ref.Target))
+					node.References.push_back(ref);
+				else {
+					UA_NodeId_clear(&ref.ReferenceType);
+					UA_NodeId_clear(&ref.Target);
+				}
+			}
+		}
+		else if (name == "Value") {
+			ParseValue(xml, node.Value);
+		}
+		else if (name == "Definition") {
+			a = xml.Attr("Name");
+			node.DefinitionName = a ? a : "";
+			int defDepth = xml.Depth() - 1;
+			while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+				if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == defDepth)
+					break;
+				if (t != TOpcUA_XmlReader::StartElement || xml.Name() != "Field")
+					continue;
+				TOpcUA_NodeSetNode::Field fld;
+				a = xml.Attr("Name");
+				fld.Name = a ? a : "";
+				if ((a = xml.Attr("DataType")) != NULL)
+					ParseNodeId(a, &fld.DataType);
+				else
+					fld.DataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
+				a = xml.Attr("ValueRank");
+				fld.ValueRank = a ? atoi(a) : UA_VALUERANK_SCALAR;
+				a = xml.Attr("IsOptional");
+				fld.IsOptional = a && parseBool(a);
+				node.Fields.push_back(fld);
+				xml.Skip();                 // <Description> of the field
+			}
+		}
+		else
+			xml.Skip();
+	}
+}
+// <Value><Double>1.5</Double></Value> or <Value><ListOfDouble><Double>1.5</Double>...</ListOfDouble></Value>,
+// values of other than the builtin types are skipped (the variable gets no value)
+void TOpcUA_NodeSetImporter::ParseValue(TOpcUA_XmlReader& xml, UA_Variant& value)
+{
+	int depth = xml.Depth() - 1;
+	TOpcUA_XmlReader::Token t;
+	while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+		if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == depth)
+			return;
+		if (t != TOpcUA_XmlReader::StartElement)
+			continue;
+		std::string name = xml.Name();
+		bool isArray = name.compare(0, 6, "ListOf") == 0;
+		const UA_DataType* type = builtinType(isArray ? name.substr(6) : name);
+		if (type == NULL) {
+			xml.Skip();
+			continue;
+		}
+		// collect the element texts, LocalizedText as "locale\ntext"
+		std::vector<std::string> texts;
+		int elemDepth = xml.Depth();
+		bool inElement = !isArray;
+		std::string current;
+		while ((t = xml.Next()) != TOpcUA_XmlReader::EndOfFile && t != TOpcUA_XmlReader::Error) {
+			if (t == TOpcUA_XmlReader::EndElement && xml.Depth() == elemDepth - 1) {
+				if (!isArray)
+					texts.push_back(current);
+				break;
+			}
+			if (t == TOpcUA_XmlReader::StartElement && isArray && xml.Depth() == elemDepth + 1) {
+				inElement = true;
+				current.clear();
+				continue;
+			}
+			if (t == TOpcUA_XmlReader::EndElement && isArray && xml.Depth() == elemDepth) {
+				inElement = false;
+				texts.push_back(current);
+				continue;
+			}
+			if (type == &UA_TYPES[UA_TYPES_LOCALIZEDTEXT] && t == TOpcUA_XmlReader::StartElement) {
+				if (xml.Name() == "Locale")
+					current = xml.ReadText() + "\n" + current;
+				else if (xml.Name() == "Text")
+					current += xml.ReadText();
+				continue;
+			}
+			if (t == TOpcUA_XmlReader::Characters && inElement)
+				current += xml.Text();
+		}
+		void* data = UA_Array_new(texts.size(), type);
+		if (data == NULL)
+			return;
+		for (size_t i = 0; i < texts.size(); i++) {
+			void* dst = (UA_Byte*)data + i * type->memSize;
+			if (type == &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]) {
+				size_t nl = texts[i].find('\n');
+				std::string locale = nl == std::string::npos ? "" : texts[i].substr(0, nl);
+				std::string text = nl == std::string::npos ? texts[i] : texts[i].substr(nl + 1);
+				*(UA_LocalizedText*)dst = UA_LOCALIZEDTEXT_ALLOC(locale.c_str(), text.c_str());
+			}
+			else
+				parseScalar(type, texts[i], dst);
+		}
+		UA_Variant_clear(&value);
+		if (isArray)
+			UA_Variant_setArray(&value, data, texts.size(), type);
+		else
+			UA_Variant_setScalar(&value, data, type);
+	}
+}
+//---------------------------------------------------------------------------
+// Adds the node and records its other references, the node is kept for a retry
+// if its parent, type definition or reference type is not there yet
+UA_StatusCode TOpcUA_NodeSetImporter::AddNode(TOpcUA_NodeSetNode& node)
+{
+	// parent (the inverse hierarchical reference) and type definition
+	UA_NodeId parent = node.ParentNodeId;
+	UA_NodeId refType = UA_NODEID_NUMERIC(0, node.NodeClass == UA_NODECLASS_OBJECTTYPE ||
+		node.NodeClass == UA_NODECLASS_VARIABLETYPE || node.NodeClass == UA_NODECLASS_DATATYPE ||
+		node.NodeClass == UA_NODECLASS_REFERENCETYPE ? UA_NS0ID_HASSUBTYPE : UA_NS0ID_HASCOMPONENT);
+	UA_NodeId typeDef = UA_NODEID_NULL;
+	int parentRef = -1, typeDefRef = -1;
+	for (size_t i = 0; i < node.References.size(); i++) {
+		const TOpcUA_NodeSetNode::Reference& ref = node.References[i];
+		if (parentRef < 0 && !ref.IsForward && IsHierarchical(ref.ReferenceType) &&
+			(UA_NodeId_isNull(&node.ParentNodeId) || UA_NodeId_equal(&ref.Target, &node.ParentNodeId))) {
+			parentRef = (int)i;
+			parent = ref.Target;
+			refType = ref.ReferenceType;
+		}
+		else if (typeDefRef < 0 && ref.IsForward && ref.ReferenceType.namespaceIndex == 0 &&
+			ref.ReferenceType.identifierType == UA_NODEIDTYPE_NUMERIC &&
+			ref.ReferenceType.identifier.numeric == UA_NS0ID_HASTYPEDEFINITION) {
+			typeDefRef = (int)i;
+			typeDef = ref.Target;
+		}
+	}
+	if (UA_NodeId_isNull(&parent)) {
+		// only linked by a forward reference of its parent (HasComponent, Organizes, ...)
+		// (not found: the parent may come later, the add fails with BadParentNodeIdInvalid)
+		std::map<std::string, size_t>::const_iterator it = _forwardParents.find(ToString(node.NodeId));
+		if (it != _forwardParents.end()) {
+			parent = _references[it->second].Source;
+			refType = _references[it->second].ReferenceType;
+		}
+	}
+
+	UA_StatusCode sc;
+	switch (node.NodeClass) {
+	case UA_NODECLASS_OBJECT: {
+		UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.eventNotifier = node.EventNotifier;
+		if (UA_NodeId_isNull(&typeDef))
+			typeDef = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE);
+		sc = UA_Server_addObjectNode(_server, node.NodeId, parent, refType, node.BrowseName, typeDef, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_VARIABLE: {
+		UA_VariableAttributes attr = UA_VariableAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.dataType = node.DataType;
+		attr.valueRank = node.ValueRank;
+		attr.accessLevel = node.AccessLevel;
+		attr.userAccessLevel = node.AccessLevel;
+		attr.minimumSamplingInterval = node.MinimumSamplingInterval;
+		attr.historizing = node.Historizing;
+		attr.value = node.Value;
+		if (UA_NodeId_isNull(&typeDef))
+			typeDef = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE);
+		sc = UA_Server_addVariableNode(_server, node.NodeId, parent, refType, node.BrowseName, typeDef, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_VARIABLETYPE: {
+		UA_VariableTypeAttributes attr = UA_VariableTypeAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.dataType = node.DataType;
+		attr.valueRank = node.ValueRank;
+		attr.isAbstract = node.IsAbstract;
+		attr.value = node.Value;
+		if (UA_NodeId_isNull(&typeDef))
+			typeDef = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE);
+		sc = UA_Server_addVariableTypeNode(_server, node.NodeId, parent, refType, node.BrowseName, typeDef, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_OBJECTTYPE: {
+		UA_ObjectTypeAttributes attr = UA_ObjectTypeAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.isAbstract = node.IsAbstract;
+		sc = UA_Server_addObjectTypeNode(_server, node.NodeId, parent, refType, node.BrowseName, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_DATATYPE: {
+		UA_DataTypeAttributes attr = UA_DataTypeAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.isAbstract = node.IsAbstract;
+		sc = UA_Server_addDataTypeNode(_server, node.NodeId, parent, refType, node.BrowseName, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_REFERENCETYPE: {
+		UA_ReferenceTypeAttributes attr = UA_ReferenceTypeAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.isAbstract = node.IsAbstract;
+		attr.symmetric = node.Symmetric;
+		attr.inverseName = node.InverseName;
+		sc = UA_Server_addReferenceTypeNode(_server, node.NodeId, parent, refType, node.BrowseName, attr, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_METHOD: {
+		UA_MethodAttributes attr = UA_MethodAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.executable = true;
+		attr.userExecutable = true;
+		sc = UA_Server_addMethodNode(_server, node.NodeId, parent, refType, node.BrowseName, attr,
+			NULL, 0, NULL, 0, NULL, NULL, NULL);
+		break;
+	}
+	case UA_NODECLASS_VIEW: {
+		UA_ViewAttributes attr = UA_ViewAttributes_default;
+		attr.displayName = node.DisplayName;
+		attr.description = node.Description;
+		attr.eventNotifier = node.EventNotifier;
+		sc = UA_Server_addViewNode(_server, node.NodeId, parent, refType, node.BrowseName, attr, NULL, NULL);
+		break;
+	}
+	default:
+		sc = UA_STATUSCODE_BADNODECLASSINVALID;
+	}
+
+	if (sc == UA_STATUSCODE_BADNODEIDEXISTS) {
+		_stats.cntExisting++;
+		return sc;
+	}
+	if (isMissingNode(sc))
+		return sc;
+	if (sc != UA_STATUSCODE_GOOD) {
+		XTRACE(XPERRORS, "NodeSet import: node %s: %s", ToString(node.NodeId).c_str(), UA_StatusCode_name(sc));
+		_stats.cntFailed++;
+		return sc;
+	}
+	_stats.cntNodes++;
+	// the other references are added when all nodes exist (the ids move to the list)
+	for (size_t i = 0; i < node.References.size(); i++) {
+		TOpcUA_NodeSetNode::Reference& ref = node.References[i];
+		if ((int)i == parentRef || (int)i == typeDefRef)
+			continue;
+		SourceReference sref;
+		UA_NodeId_copy(&node.NodeId, &sref.Source);
+		sref.ReferenceType = ref.ReferenceType;
+		sref.Target = ref.Target;
+		sref.IsForward = ref.IsForward;
+		UA_NodeId_init(&ref.ReferenceType);
+		UA_NodeId_init(&ref.Target);
+		if (sref.IsForward && IsHierarchical(sref.ReferenceType))
+			_forwardParents.insert(std::make_pair(ToString(sref.Target), _references.size()));
+		_references.push_back(sref);
+	}
+	return sc;
+}
+// Add the DataTypeDefinition of a structure to the TypeDB, like the client does when
+// it reads the definitions from a server. False if a nested structure is not added yet,
+// true when done (also if the structure is not supported).
+bool TOpcUA_NodeSetImporter::AddType(const TOpcUA_NodeSetNode& node)
+{
+	if (_db == NULL)
+		return true;
+	std::string name = node.DefinitionName.empty() ? ToString(node.BrowseName.name) : node.DefinitionName;
+	size_t colon = name.find(':');
+	if (colon != std::string::npos)
+		name.erase(0, colon + 1);
+	he::Symbols::TypeInfo ts;
+	ts.DataType.isArray = 0;
+	ts.DataType.isStruct = 1;
+	ts.DataType.type = he::Symbols::TypeInfo::Type::S_StructFixed;
+	for (size_t i = 0; i < node.Fields.size(); i++) {
+		if (node.Fields[i].IsOptional) {
+			// max. 32 optional fields, encoded as a DWORD bitfield in front of the fields
+			ts.DataType.type = he::Symbols::TypeInfo::Type::S_StructOptFld;
+			ts.Offset = 4;
+			ts.Flags.Bits.hasOffset = 1;
+			break;
+		}
+	}
+	// the TypeDB is keyed by the name, the data type id maps to it (AddTypeId)
+	ts.ItemName = name;
+	ts.ItemType = name;
+	// the encoding node ("Default Binary"), the references are in the server by now
+	UA_BrowseDescription bd;
+	UA_BrowseDescription_init(&bd);
+	bd.nodeId = node.NodeId;
+	bd.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HASENCODING);
+	bd.browseDirection = UA_BROWSEDIRECTION_FORWARD;
+	bd.resultMask = UA_BROWSERESULTMASK_BROWSENAME;
+	UA_BrowseResult br = UA_Server_browse(_server, 0, &bd);
+	for (size_t i = 0; i < br.referencesSize; i++) {
+		if (ToString(br.references[i].browseName.name) == "Default Binary")
+			ts.ItemEncoding = ToString(br.references[i].nodeId.nodeId);
+	}
+	UA_BrowseResult_clear(&br);
+
+	he::Symbols::TypeNode typeNode;
+	typeNode.Set(NULL, ts);
+	int offset = ts.Offset;
+	for (size_t i = 0; i < node.Fields.size(); i++) {
+		const TOpcUA_NodeSetNode::Field& fld = node.Fields[i];
+		he::Symbols::TypeInfo ti;
+		if (fld.ValueRank > 0) {
+			ti.DataType.isArray = 1;
+			ti.ValueRank = fld.ValueRank;
+		}
+		if (fld.DataType.namespaceIndex == 0 && fld.DataType.identifierType == UA_NODEIDTYPE_NUMERIC) {
+			switch (fld.DataType.identifier.numeric) {
+			case UA_NS0ID_BOOLEAN: 	  ti.Set(he::Symbols::TypeInfo::Type::T_Bool8, 		fld.Name, "Boolean"); break;
+			case UA_NS0ID_SBYTE: 	  ti.Set(he::Symbols::TypeInfo::Type::T_SInt8, 		fld.Name, "SByte"); break;
+			case UA_NS0ID_BYTE: 	  ti.Set(he::Symbols::TypeInfo::Type::T_UInt8, 		fld.Name, "Byte"); break;
+			case UA_NS0ID_INT16: 	  ti.Set(he::Symbols::TypeInfo::Type::T_SInt16, 		fld.Name, "Int16"); break;
+			case UA_NS0ID_UINT16: 	  ti.Set(he::Symbols::TypeInfo::Type::T_UInt16, 		fld.Name, "UInt16"); break;
+			case UA_NS0ID_INT32: 	  ti.Set(he::Symbols::TypeInfo::Type::T_SInt32, 		fld.Name, "Int32"); break;
+			case UA_NS0ID_UINT32: 	  ti.Set(he::Symbols::TypeInfo::Type::T_UInt32, 		fld.Name, "UInt32"); break;
+			case UA_NS0ID_INT64: 	  ti.Set(he::Symbols::TypeInfo::Type::T_SInt64, 		fld.Name, "Int64"); break;
+			case UA_NS0ID_UINT64: 	  ti.Set(he::Symbols::TypeInfo::Type::T_UInt64, 		fld.Name, "UInt64"); break;
+			case UA_NS0ID_FLOAT: 	  ti.Set(he::Symbols::TypeInfo::Type::T_Float, 		fld.Name, "Float"); break;
+			case UA_NS0ID_DOUBLE: 	  ti.Set(he::Symbols::TypeInfo::Type::T_Double, 		fld.Name, "Double"); break;
+			case UA_NS0ID_STRING: 	  ti.Set(he::Symbols::TypeInfo::Type::T_StringL4, 	fld.Name, "String"); break;
+			case UA_NS0ID_DATETIME:   ti.Set(he::Symbols::TypeInfo::Type::T_DateTime, 	fld.Name, "DateTime"); break;
+			case UA_NS0ID_GUID: 	  ti.Set(he::Symbols::TypeInfo::Type::T_Guid, 		fld.Name, "GUID"); break;
+			case UA_NS0ID_BYTESTRING: ti.Set(he::Symbols::TypeInfo::Type::T_ByteString, 	fld.Name, "BYTESTRING"); break;
+			default:
+				XTRACE(XPERRORS, "NodeSet import: %s.%s: unsupported datatype %d", name.c_str(),
+					fld.Name.c_str(), fld.DataType.identifier.numeric);
+				return true;            // give up on this type
+			}
+			ti.DataType.isStruct = 0;
+			typeNode.AddChild(NULL, ti, offset);
+			offset += ti.Offset;
+		}
+		else {
+			// nested structure, must already be in the TypeDB
+			std::string typeId = ToString(fld.DataType);
+			const std::string* typeName = _db->FindTypeNameById(typeId);
+			const he::Symbols::TypeDB::tNameMap& types = _db->GetTypeMap();
+			he::Symbols::TypeDB::tNameMap::const_iterator it = typeName ? types.find(*typeName) : types.end();
+			if (it == types.end()) {
+				// defined in this file, later?
+				for (std::list<TOpcUA_NodeSetNode*>::const_iterator dt = _dataTypes.begin(); dt != _dataTypes.end(); ++dt) {
+					if (UA_NodeId_equal(&(*dt)->NodeId, &fld.DataType))
+						return false;
+				}
+				XTRACE(XPERRORS, "NodeSet import: %s.%s: unknown datatype %s", name.c_str(),
+					fld.Name.c_str(), typeId.c_str());
+				return true;
+			}
+			he::Symbols::TypeNode& sub = typeNode.AddChild(NULL, ti, offset);
+			sub = it->second;
+			sub.item.ItemName = fld.Name;
+		}
+	}
+	_db->Add(name, typeNode);
+	_db->AddTypeId(ToString(node.NodeId), name);
+	_stats.cntTypes++;
+	return true;
+}
+//---------------------------------------------------------------------------
+TOpcUA_NodeSetWriter::TOpcUA_NodeSetWriter()
+	: _file(NULL)
+{
+}
+TOpcUA_NodeSetWriter::~TOpcUA_NodeSetWriter()
+{
+	if (_file)
+		fclose(_file);
+}
+std::string TOpcUA_NodeSetWriter::Escape(const std::string& s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (size_t i = 0; i < s.size(); i++) {
+		switch (s[i]) {
+		case '<':  out += "&lt;"; break;
+		case '>':  out += "&gt;"; break;
+		case '&':  out += "&amp;"; break;
+		case '"':  out += "&quot;"; break;
+		case '\'': out += "&apos;"; break;
+		default:   out += s[i];
+		}
+	}
+	return out;
+}
+std::string TOpcUA_NodeSetWriter::Str(const UA_String& s)
+{
+	return Escape(ToString(s));
+}
+std::string TOpcUA_NodeSetWriter::Str(const UA_NodeId& id)
+{
+	return Escape(ToString(id));
+}
+//---------------------------------------------------------------------------
+// namespaceUris: the namespaces 1.. of the source, the node ids are written with these indexes
+bool TOpcUA_NodeSetWriter::Open(const char* path, const std::vector<std::string>& namespaceUris)
+{
+	_file = fopen(path, "wb");
+	if (_file == NULL)
+		return false;
+	fprintf(_file, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+		"<UANodeSet xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\""
+		" xmlns:uax=\"http://opcfoundation.org/UA/2008/02/Types.xsd\""
+		" xmlns=\"http://opcfoundation.org/UA/2011/03/UANodeSet.xsd\">\n");
+	if (!namespaceUris.empty()) {
+		fprintf(_file, "  <NamespaceUris>\n");
+		for (size_t i = 0; i < namespaceUris.size(); i++)
+			fprintf(_file, "    <Uri>%s</Uri>\n", Escape(namespaceUris[i]).c_str());
+		fprintf(_file, "  </NamespaceUris>\n");
+	}
+	return true;
+}
+void TOpcUA_NodeSetWriter::Write(const TOpcUA_NodeSetNode& node)
+{
+	const char* element = NodeClassElement(node.NodeClass);
+	if (_file == NULL || element == NULL)
+		return;
+	fprintf(_file, "  <%s NodeId=\"%s\" BrowseName=\"", element, Str(node.NodeId).c_str());
+	if (node.BrowseName.namespaceIndex != 0)
+		fprintf(_file, "%u:", node.BrowseName.namespaceIndex);
+	fprintf(_file, "%s\"", Str(node.BrowseName.name).c_str());
+	if (!UA_NodeId_isNull(&node.ParentNodeId))
+		fprintf(_file, " ParentNodeId=\"%s\"", Str(node.ParentNodeId).c_str());
+	if (node.NodeClass == UA_NODECLASS_VARIABLE || node.NodeClass == UA_NODECLASS_VARIABLETYPE) {
+		fprintf(_file, " DataType=\"%s\"", Str(node.DataType).c_str());
+		if (node.ValueRank != UA_VALUERANK_SCALAR)
+			fprintf(_file, " ValueRank=\"%d\"", node.ValueRank);
+	}
+	if (node.NodeClass == UA_NODECLASS_VARIABLE && node.AccessLevel != UA_ACCESSLEVELMASK_READ)
+		fprintf(_file, " AccessLevel=\"%u\"", node.AccessLevel);
+	if ((node.NodeClass == UA_NODECLASS_OBJECT || node.NodeClass == UA_NODECLASS_VIEW) && node.EventNotifier)
+		fprintf(_file, " EventNotifier=\"%u\"", node.EventNotifier);
+	if (node.IsAbstract)
+		fprintf(_file, " IsAbstract=\"true\"");
+	fprintf(_file, ">\n");
+	fprintf(_file, "    <DisplayName>%s</DisplayName>\n", Str(node.DisplayName.text).c_str());
+	if (node.Description.text.length > 0)
+		fprintf(_file, "    <Description>%s</Description>\n", Str(node.Description.text).c_str());
+	if (!node.References.empty()) {
+		fprintf(_file, "    <References>\n");
+		for (size_t i = 0; i < node.References.size(); i++) {
+			const TOpcUA_NodeSetNode::Reference& ref = node.References[i];
+			fprintf(_file, "      <Reference ReferenceType=\"%s\"%s>%s</Reference>\n",
+				Str(ref.ReferenceType).c_str(), ref.IsForward ? "" : " IsForward=\"false\"",
+				Str(ref.Target).c_str());
+		}
+		fprintf(_file, "    </References>\n");
+	}
+	if (!UA_Variant_isEmpty(&node.Value) && BuiltinTypeName(node.Value.type) != NULL)
+		WriteValue(node.Value);
+	fprintf(_file, "  </%s>\n", element);
+}
+void TOpcUA_NodeSetWriter::WriteValue(const UA_Variant& value)
+{
+	const UA_DataType* type = value.type;
+	const char* typeName = BuiltinTypeName(type);
+	bool isArray = !UA_Variant_isScalar(&value);
+	size_t count = isArray ? value.arrayLength : 1;
+	fprintf(_file, "    <Value>\n");
+	if (isArray)
+		fprintf(_file, "      <uax:ListOf%s>\n", typeName);
+	for (size_t i = 0; i < count; i++) {
+		const void* p = (const UA_Byte*)value.data + i * type->memSize;
+		fprintf(_file, isArray ? "        <uax:%s>" : "      <uax:%s>", typeName);
+		switch (type->typeIndex) {
+		case UA_TYPES_BOOLEAN:  fprintf(_file, "%s", *(const UA_Boolean*)p ? "true" : "false"); break;
+		case UA_TYPES_SBYTE:    fprintf(_file, "%d", *(const UA_SByte*)p); break;
+		case UA_TYPES_BYTE:     fprintf(_file, "%u", *(const UA_Byte*)p); break;
+		case UA_TYPES_INT16:    fprintf(_file, "%d", *(const UA_Int16*)p); break;
+		case UA_TYPES_UINT16:   fprintf(_file, "%u", *(const UA_UInt16*)p); break;
+		case UA_TYPES_INT32:    fprintf(_file, "%d", *(const UA_Int32*)p); break;
+		case UA_TYPES_UINT32:   fprintf(_file, "%u", *(const UA_UInt32*)p); break;
+		case UA_TYPES_INT64:    fprintf(_file, "%lld", (long long)*(const UA_Int64*)p); break;
+		case UA_TYPES_UINT64:   fprintf(_file, "%llu", (unsigned long long)*(const UA_UInt64*)p); break;
+		case UA_TYPES_FLOAT:    fprintf(_file, "%.9g", *(const UA_Float*)p); break;
+		case UA_TYPES_DOUBLE:   fprintf(_file, "%.17g", *(const UA_Double*)p); break;
+		case UA_TYPES_STRING:   fprintf(_file, "%s", Str(*(const UA_String*)p).c_str()); break;
+		case UA_TYPES_DATETIME: {
+			UA_DateTimeStruct dts = UA_DateTime_toStruct(*(const UA_DateTime*)p);
+			fprintf(_file, "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ", dts.year, dts.month, dts.day,
+				dts.hour, dts.min, dts.sec, dts.milliSec);
+			break;
+		}
+		case UA_TYPES_LOCALIZEDTEXT: {
+			const UA_LocalizedText* lt = (const UA_LocalizedText*)p;
+			if (lt->locale.length > 0)
+				fprintf(_file, "<uax:Locale>%s</uax:Locale>", Str(lt->locale).c_str());
+			fprintf(_file, "<uax:Text>%s</uax:Text>", Str(lt->text).c_str());
+			break;
+		}
+		}
+		fprintf(_file, "</uax:%s>\n", typeName);
+	}
+	if (isArray)
+		fprintf(_file, "      </uax:ListOf%s>\n", typeName);
+	fprintf(_file, "    </Value>\n");
+}
+bool TOpcUA_NodeSetWriter::Close()
+{
+	if (_file == NULL)
+		return false;
+	fprintf(_file, "</UANodeSet>\n");
+	bool ok = ferror(_file) == 0;
+	if (fclose(_file) != 0)
+		ok = false;
+	_file = NULL;
+	return ok;
+}
+//---------------------------------------------------------------------------
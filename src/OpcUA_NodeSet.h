@@ -0,0 +1,173 @@
+//---------------------------------------------------------------------------
+
+#ifndef OpcUA_NodeSetH
+#define OpcUA_NodeSetH
+//---------------------------------------------------------------------------
+#include <System.Classes.hpp>
+//---------------------------------------------------------------------------
+#include <stdio.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <open62541.h>
+#include "Symbols.h"
+//---------------------------------------------------------------------------
+// Pull parser for the subset of XML used by NodeSet2 files. The file is read in
+// chunks, so only the current element (name, attributes, text) is held in memory.
+// Namespace prefixes are stripped from the element names.
+class TOpcUA_XmlReader
+{
+public:
+	enum Token { StartElement, EndElement, Characters, EndOfFile, Error };
+
+	TOpcUA_XmlReader();
+	~TOpcUA_XmlReader();
+	bool Open(const char* path);
+	Token Next();
+	void Skip();                                // skip the rest of the current element (after StartElement)
+	std::string ReadText();                     // text of the current element (after StartElement)
+	const std::string& Name() const { return _name; }
+	const std::string& Text() const { return _text; }
+	const char* Attr(const char* name) const;   // NULL if missing
+	int Depth() const { return _depth; }
+	int Line() const { return _line; }
+private:
+	FILE*       _file;
+	char        _buf[65536];
+	size_t      _pos, _len;
+	int         _depth;
+	int         _line;
+	bool        _pendingEnd;                    // <element/>
+	std::string _name;
+	std::string _text;
+	std::vector< std::pair<std::string, std::string> > _attrs;
+	int Peek();
+	int Get();
+	bool SkipPast(const char* end);
+	static void Decode(std::string& s);
+};
+//---------------------------------------------------------------------------
+// One node of a NodeSet2 file, the common record of the import and the export
+class TOpcUA_NodeSetNode
+{
+public:
+	class Reference {
+	public:
+		UA_NodeId   ReferenceType;
+		UA_NodeId   Target;
+		bool        IsForward;
+	};
+	class Field {                               // DataTypeDefinition of structures
+	public:
+		std::string Name;
+		UA_NodeId   DataType;
+		int         ValueRank;
+		bool        IsOptional;
+	};
+
+	TOpcUA_NodeSetNode();
+	~TOpcUA_NodeSetNode();
+	void AddReference(const UA_NodeId& referenceType, const UA_NodeId& target, bool isForward);
+
+	UA_NodeClass        NodeClass;
+	UA_NodeId           NodeId;
+	UA_QualifiedName    BrowseName;
+	UA_LocalizedText    DisplayName;
+	UA_LocalizedText    Description;
+	UA_LocalizedText    InverseName;
+	UA_NodeId           ParentNodeId;
+	UA_NodeId           DataType;
+	UA_Int32            ValueRank;
+	UA_Byte             AccessLevel;
+	UA_Byte             EventNotifier;
+	UA_Boolean          IsAbstract;
+	UA_Boolean          Symmetric;
+	UA_Boolean          Historizing;
+	UA_Double           MinimumSamplingInterval;
+	UA_Variant          Value;
+	std::vector<Reference> References;
+	std::string         DefinitionName;
+	std::vector<Field>  Fields;
+private:
+	TOpcUA_NodeSetNode(const TOpcUA_NodeSetNode&);
+	TOpcUA_NodeSetNode& operator=(const TOpcUA_NodeSetNode&);
+};
+//---------------------------------------------------------------------------
+namespace OpcUA_NodeSet {
+	bool IsHierarchical(const UA_NodeId& referenceType);
+	const char* NodeClassElement(UA_NodeClass nodeClass);     // "UAObject", ... or NULL
+	const char* BuiltinTypeName(const UA_DataType* type);     // "Double", ... or NULL if not supported in values
+	std::string ToString(const UA_String& s);
+	std::string ToString(const UA_NodeId& id);                // "ns=1;s=Name"
+}
+//---------------------------------------------------------------------------
+// Stream-parses a NodeSet2 file into the server. Every node is added as soon as it
+// is parsed; nodes whose parent or type definition is not there yet are kept until
+// the end of the file. The non hierarchical references are added at the end, the
+// DataTypeDefinitions of structures are added to the TypeDB (for the serializer).
+// Only the parser is bounded: the references and waiting nodes grow with the file.
+class TOpcUA_NodeSetImporter
+{
+public:
+	class Stats {
+	public:
+		Stats() : cntNodes(0), cntExisting(0), cntReferences(0), cntTypes(0), cntFailed(0) {}
+		uint32_t    cntNodes;
+		uint32_t    cntExisting;            // nodes already in the server (e.g. namespace 0)
+		uint32_t    cntReferences;
+		uint32_t    cntTypes;               // structures added to the TypeDB
+		uint32_t    cntFailed;
+	};
+
+	TOpcUA_NodeSetImporter(UA_Server* server, he::Symbols::TypeDB* db);
+	~TOpcUA_NodeSetImporter();
+	UA_StatusCode Import(const char* path);
+	const Stats& GetStats() const { return _stats; }
+	const std::string& GetError() const { return _error; }
+private:
+	class SourceReference : public TOpcUA_NodeSetNode::Reference {
+	public:
+		UA_NodeId   Source;
+	};
+
+	UA_Server*              _server;
+	he::Symbols::TypeDB*    _db;
+	Stats                   _stats;
+	std::string             _error;
+	std::vector<UA_UInt16>  _nsMap;         // namespace index of the file -> index in the server
+	std::map<std::string, std::string> _aliases;
+	std::list<TOpcUA_NodeSetNode*> _pending;       // parent / type definition not there yet
+	std::list<TOpcUA_NodeSetNode*> _dataTypes;     // structures, added to the TypeDB at the end
+	std::vector<SourceReference> _references;
+	std::map<std::string, size_t> _forwardParents;  // child -> its forward hierarchical reference in _references
+
+	void ParseNamespaces(TOpcUA_XmlReader& xml);
+	void ParseAliases(TOpcUA_XmlReader& xml);
+	void ParseNode(TOpcUA_XmlReader& xml, TOpcUA_NodeSetNode& node);
+	void ParseValue(TOpcUA_XmlReader& xml, UA_Variant& value);
+	bool ParseNodeId(const char* str, UA_NodeId* out);
+	void ParseQualifiedName(const char* str, UA_QualifiedName* out);
+	UA_StatusCode AddNode(TOpcUA_NodeSetNode& node);
+	bool AddType(const TOpcUA_NodeSetNode& node);
+	void Clear();
+};
+//---------------------------------------------------------------------------
+// Writes a NodeSet2 file node by node
+class TOpcUA_NodeSetWriter
+{
+public:
+	TOpcUA_NodeSetWriter();
+	~TOpcUA_NodeSetWriter();
+	bool Open(const char* path, const std::vector<std::string>& namespaceUris);
+	void Write(const TOpcUA_NodeSetNode& node);
+	bool Close();                               // false if a write failed
+private:
+	FILE*   _file;
+	void WriteValue(const UA_Variant& value);
+	static std::string Escape(const std::string& s);
+	static std::string Str(const UA_String& s);
+	static std::string Str(const UA_NodeId& id);
+};
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,131 @@
+//---------------------------------------------------------------------------
+
+#include <System.hpp>
+#pragma hdrstop
+
+#include "OpcUA_ProcessImage.h"
+#pragma package(smart_init)
+//---------------------------------------------------------------------------
+TOpcUA_ProcessImage::TOpcUA_ProcessImage(size_t size)
+	: _buffer(size, 0), _seq(0), _timestamp(UA_DateTime_now())
+{
+	InitializeCriticalSection(&_csWrite);
+}
+TOpcUA_ProcessImage::~TOpcUA_ProcessImage()
+{
+	DeleteCriticalSection(&_csWrite);
+}
+//---------------------------------------------------------------------------
+bool TOpcUA_ProcessImage::Write(size_t offset, const void* src, size_t len)
+{
+	if (offset > _buffer.size() || len > _buffer.size() - offset)
+		return false;
+	EnterCriticalSection(&_csWrite);
+	UA_UInt32 seq = _seq.load(std::memory_order_relaxed);
+	_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&_buffer[offset], src, len);
+	_timestamp.store(UA_DateTime_now(), std::memory_order_relaxed);
+	_seq.store(seq + 2, std::memory_order_release);
+	LeaveCriticalSection(&_csWrite);
+	return true;
+}
+bool TOpcUA_ProcessImage::Read(size_t offset, void* dst, size_t len, UA_DateTime* timestamp) const
+{
+	if (offset > _buffer.size() || len > _buffer.size() - offset)
+		return false;
+	for (;;) {
+		UA_UInt32 seq = _seq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			YieldProcessor();       // a write is in progress
+			continue;
+		}
+		memcpy(dst, &_buffer[offset], len);
+		if (timestamp)
+			*timestamp = _timestamp.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_seq.load(std::memory_order_relaxed) == seq)
+			return true;
+	}
+}
+TOpcUA_ProcessImage::Var* TOpcUA_ProcessImage::AddVar(size_t offset, const UA_DataType* type, size_t count)
+{
+	Var var;
+	var.Image = this;
+	var.Offset = offset;
+	var.Type = type;
+	var.Count = count;
+	if (type == NULL || !type->pointerFree || offset > _buffer.size() || var.Size() > _buffer.size() - offset)
+		return NULL;
+	_vars.push_back(var);
+	return &_vars.back();
+}
+void TOpcUA_ProcessImage::RemoveVar(Var* var)
+{
+	for (std::list<Var>::iterator it = _vars.begin(); it != _vars.end(); ++it) {
+		if (&*it == var) {
+			_vars.erase(it);
+			return;
+		}
+	}
+}
+//---------------------------------------------------------------------------
+UA_DataSource TOpcUA_ProcessImage::GetDataSource()
+{
+	UA_DataSource ds;
+	ds.read = &TOpcUA_ProcessImage::ReadCallback;
+	ds.write = &TOpcUA_ProcessImage::WriteCallback;
+	return ds;
+}
+// Called by the server (in the thread running it), never calls into lua
+UA_StatusCode TOpcUA_ProcessImage::ReadCallback(UA_Server *server, const UA_NodeId *sessionId,
+	void *sessionContext, const UA_NodeId *nodeId, void *nodeContext,
+	UA_Boolean includeSourceTimeStamp, const UA_NumericRange *range, UA_DataValue *value)
+{
+	Var* var = (Var*)nodeContext;
+	if (var == NULL)
+		return UA_STATUSCODE_BADINTERNALERROR;
+	void* data = UA_Array_new(var->Count > 0 ? var->Count : 1, var->Type);
+	if (data == NULL)
+		return UA_STATUSCODE_BADOUTOFMEMORY;
+	UA_DateTime timestamp = 0;
+	var->Image->Read(var->Offset, data, var->Size(), &timestamp);
+	if (var->Count > 0)
+		UA_Variant_setArray(&value->value, data, var->Count, var->Type);
+	else
+		UA_Variant_setScalar(&value->value, data, var->Type);
+	if (range) {
+		UA_Variant part;
+		UA_Variant_init(&part);
+		UA_StatusCode sc = UA_Variant_copyRange(&value->value, &part, *range);
+		UA_Variant_clear(&value->value);
+		if (sc != UA_STATUSCODE_GOOD)
+			return sc;
+		value->value = part;
+	}
+	value->hasValue = true;
+	if (includeSourceTimeStamp) {
+		value->sourceTimestamp = timestamp;
+		value->hasSourceTimestamp = true;
+	}
+	return UA_STATUSCODE_GOOD;
+}
+// Writes of the server's clients go into the image (the access level is checked by the server)
+UA_StatusCode TOpcUA_ProcessImage::WriteCallback(UA_Server *server, const UA_NodeId *sessionId,
+	void *sessionContext, const UA_NodeId *nodeId, void *nodeContext,
+	const UA_NumericRange *range, const UA_DataValue *value)
+{
+	Var* var = (Var*)nodeContext;
+	if (var == NULL)
+		return UA_STATUSCODE_BADINTERNALERROR;
+	if (range)
+		return UA_STATUSCODE_BADWRITENOTSUPPORTED;
+	if (!value->hasValue || value->value.type != var->Type)
+		return UA_STATUSCODE_BADTYPEMISMATCH;
+	if (var->Count > 0 ? value->value.arrayLength != var->Count : !UA_Variant_isScalar(&value->value))
+		return UA_STATUSCODE_BADTYPEMISMATCH;
+	if (!var->Image->Write(var->Offset, value->value.data, var->Size()))
+		return UA_STATUSCODE_BADINTERNALERROR;
+	return UA_STATUSCODE_GOOD;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,56 @@
+//---------------------------------------------------------------------------
+
+#ifndef OpcUA_ProcessImageH
+#define OpcUA_ProcessImageH
+//---------------------------------------------------------------------------
+#include <System.Classes.hpp>
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <list>
+#include <vector>
+#include <open62541.h>
+//---------------------------------------------------------------------------
+// A contiguous buffer, each variable mapped onto it is an offset and a (pointer free)
+// type. The buffer is updated in bulk (from lua or native code), the server reads its
+// variables straight from the buffer through a DataSource, without calling into lua.
+// Writers are serialized by a critical section, readers never block (seqlock): they
+// copy the data and retry if a write was in progress.
+class TOpcUA_ProcessImage
+{
+public:
+	// One variable in the image, the node context of its DataSource
+	class Var {
+	public:
+		TOpcUA_ProcessImage*  Image;
+		size_t                Offset;
+		const UA_DataType*    Type;
+		size_t                Count;      // array length, 0 for a scalar
+		size_t Size() const { return Type->memSize * (Count > 0 ? Count : 1); }
+	};
+
+	TOpcUA_ProcessImage(size_t size);
+	~TOpcUA_ProcessImage();
+	size_t GetSize() const { return _buffer.size(); }
+	UA_DateTime GetTimestamp() const { return _timestamp.load(); }
+	bool Write(size_t offset, const void* src, size_t len);     // any thread
+	bool Read(size_t offset, void* dst, size_t len, UA_DateTime* timestamp = NULL) const;  // any thread, never blocks
+	Var* AddVar(size_t offset, const UA_DataType* type, size_t count);  // NULL if it doesn't fit
+	void RemoveVar(Var* var);           // its node was not added
+
+	// UA_DataSource callbacks, the node context is the Var
+	static UA_DataSource GetDataSource();
+	static UA_StatusCode ReadCallback(UA_Server *server, const UA_NodeId *sessionId,
+		void *sessionContext, const UA_NodeId *nodeId, void *nodeContext,
+		UA_Boolean includeSourceTimeStamp, const UA_NumericRange *range, UA_DataValue *value);
+	static UA_StatusCode WriteCallback(UA_Server *server, const UA_NodeId *sessionId,
+		void *sessionContext, const UA_NodeId *nodeId, void *nodeContext,
+		const UA_NumericRange *range, const UA_DataValue *value);
+private:
+	std::vector<UA_Byte>     _buffer;
+	std::atomic<UA_UInt32>   _seq;          // odd while a write is in progress
+	std::atomic<UA_DateTime> _timestamp;    // of the last write
+	CRITICAL_SECTION         _csWrite;
+	std::list<Var>           _vars;         // stable addresses (node contexts)
+};
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,215 @@
+//---------------------------------------------------------------------------
+
+#include <System.hpp>
+#pragma hdrstop
+
+#include "OpcUA_ServerThread.h"
+#include "logger.h"
+#pragma package(smart_init)
+//---------------------------------------------------------------------------
+extern bool gDllUnloadInProgress;
+
+static thread_local TOpcUA_ServerThread* s_current = NULL;
+
+//---------------------------------------------------------------------------
+__fastcall TOpcUA_ServerThread::TOpcUA_ServerThread(UA_Server* server, TOpcUA_ServerLock* lock, DWORD intervalMs, DWORD callTimeoutMs)
+	: TThread(true), _server(server), _lock(lock), _intervalMs(intervalMs), _callTimeoutMs(callTimeoutMs),
+	  _signaled(false), _polling(0) // always create suspended
+{
+	XTRACE(XPDIAG2, "OPC-UA server thread instantiated");
+	InitializeCriticalSection(&_csQueue);
+	_wakeup = OpcUA_OpenWakeupSocket("server thread");
+	_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+__fastcall TOpcUA_ServerThread::~TOpcUA_ServerThread()
+{
+	// only posted calls are left when the thread has ended
+	TOpcUA_ServerCall* call;
+	while ((call = Pop()) != NULL) {
+		delete call;
+	}
+	if (_wakeup != UA_INVALID_SOCKET) {
+		UA_close(_wakeup);
+	}
+	CloseHandle(_stop);
+	CloseHandle(_done);
+	DeleteCriticalSection(&_csQueue);
+}
+TOpcUA_ServerThread* TOpcUA_ServerThread::Current()
+{
+	return s_current;
+}
+//---------------------------------------------------------------------------
+void __fastcall TOpcUA_ServerThread::Execute()
+{
+	NameThreadForDebugging(System::String(L"OpcUA_ServerThread"));
+	s_current = this;
+	while (!Terminated && !gDllUnloadInProgress) {
+		_lock->Enter();
+		UA_UInt16 next = UA_Server_run_iterate(_server, false);
+#if UA_MULTITHREADING >= 100
+		PostAsyncOperations();
+#endif
+		_lock->Leave();
+		// Don't hold the lock while waiting, lua needs it for its calls into the server. The
+		// server's sockets are only served by run_iterate (waiting in it would hold the lock),
+		// so it runs again after the interval or when the next timer of the server is due.
+		WaitForSingleObject(_stop, next < _intervalMs ? next : _intervalMs);
+	}
+	s_current = NULL;
+}
+//---------------------------------------------------------------------------
+void TOpcUA_ServerThread::Push(TOpcUA_ServerCall* call)
+{
+	EnterCriticalSection(&_csQueue);
+	_queue.push_back(call);
+	LeaveCriticalSection(&_csQueue);
+	if (!_signaled.exchange(true) && _wakeup != UA_INVALID_SOCKET) {
+		char c = 0;
+		UA_send(_wakeup, &c, 1, 0);
+	}
+}
+TOpcUA_ServerCall* TOpcUA_ServerThread::Pop()
+{
+	TOpcUA_ServerCall* call = NULL;
+	EnterCriticalSection(&_csQueue);
+	if (!_queue.empty()) {
+		call = _queue.front();
+		_queue.pop_front();
+	}
+	LeaveCriticalSection(&_csQueue);
+	return call;
+}
+TOpcUA_ServerCall* TOpcUA_ServerThread::Fetch()
+{
+	TOpcUA_ServerCall* call = Pop();
+	if (call != NULL)
+		return call;
+	// as TOpcUA_NetworkThread::Fetch: drain unconditionally, then look again
+	OpcUA_DrainWakeupSocket(_wakeup);
+	_signaled.store(false);
+	return Pop();
+}
+// Called inside UA_Server_run_iterate, i.e. with the lock held once by Execute.
+// The lock is released while waiting, so the lua function can call into the server.
+bool TOpcUA_ServerThread::Invoke(const std::function<void()>& func)
+{
+	TOpcUA_ServerCall* call = new TOpcUA_ServerCall(func, _done);
+	Push(call);
+	_lock->Leave();
+	if (WaitForSingleObject(_done, _callTimeoutMs) != WAIT_OBJECT_0) {
+		int state = TOpcUA_ServerCall::Queued;
+		if (call->State.compare_exchange_strong(state, TOpcUA_ServerCall::Cancelled)) {
+			// lua did not take it yet and drops it now
+			_lock->Enter();
+			XTRACE(XPDIAG1, "OPC-UA server thread: lua call timed out after %u ms", (unsigned)_callTimeoutMs);
+			return false;
+		}
+		// already running, the arguments of the call must stay valid until it is finished
+		WaitForSingleObject(_done, INFINITE);
+	}
+	_lock->Enter();
+	bool finished = call->State.load() == TOpcUA_ServerCall::Finished;
+	delete call;
+	return finished;
+}
+void TOpcUA_ServerThread::Post(const std::function<void()>& func)
+{
+	Push(new TOpcUA_ServerCall(func, NULL));
+}
+#if UA_MULTITHREADING >= 100
+// The method calls queued by the server (async method nodes) are run by the lua thread.
+// UA_Server_call locks the server itself in this build, so the sessions are served while
+// lua runs the method; the result is handed back under the lock. A call dropped by Stop
+// times out in the server (asyncOperationTimeout).
+void TOpcUA_ServerThread::PostAsyncOperations()
+{
+	UA_AsyncOperationType type;
+	const UA_AsyncOperationRequest* request;
+	void* context;
+	while (UA_Server_getAsyncOperation(_server, &type, &request, &context)) {
+		std::shared_ptr<UA_CallMethodRequest> call(UA_CallMethodRequest_new(), UA_CallMethodRequest_delete);
+		if (type == UA_ASYNCOPERATIONTYPE_CALL)
+			UA_CallMethodRequest_copy(&request->callMethodRequest, call.get());
+		UA_Server* server = _server;
+		TOpcUA_ServerLock* lock = _lock;
+		Post([server, lock, call, type, context]() {
+			UA_AsyncOperationResponse response;
+			UA_CallMethodResult_init(&response.callMethodResult);
+			if (type == UA_ASYNCOPERATIONTYPE_CALL)
+				response.callMethodResult = UA_Server_call(server, call.get());
+			else
+				response.callMethodResult.statusCode = UA_STATUSCODE_BADNOTSUPPORTED;
+			TOpcUA_ServerLock::Guard guard(lock);
+			UA_Server_setAsyncOperationResult(server, &response, context);
+			UA_CallMethodResult_clear(&response.callMethodResult);
+		});
+	}
+}
+#endif
+//---------------------------------------------------------------------------
+size_t TOpcUA_ServerThread::Poll()
+{
+	size_t count = 0;
+	TOpcUA_ServerCall* call;
+	_polling++;
+	while ((call = Fetch()) != NULL) {
+		int state = TOpcUA_ServerCall::Queued;
+		if (!call->State.compare_exchange_strong(state, TOpcUA_ServerCall::Running)) {
+			delete call;                    // timed out, the server thread went on
+			continue;
+		}
+		try {
+			call->Func();
+		}
+		catch (std::exception& e) {
+			XTRACE(XPERRORS, "OPC-UA server thread: lua call failed: %s", e.what());
+		}
+		catch (...) {
+			XTRACE(XPERRORS, "OPC-UA server thread: lua call failed");
+		}
+		count++;
+		if (call->Done) {
+			call->State.store(TOpcUA_ServerCall::Finished);
+			SetEvent(call->Done);           // the server thread deletes it
+		} else {
+			delete call;
+		}
+	}
+	_polling--;
+	return count;
+}
+bool TOpcUA_ServerThread::WaitForCalls(DWORD ms)
+{
+	if (_signaled.load())
+		return true;
+	OpcUA_WaitWakeupSocket(_wakeup, ms);
+	return _signaled.load();
+}
+int TOpcUA_ServerThread::GetPollFd()
+{
+	return (int)_wakeup;
+}
+// Release the server thread from a waiting call without running it
+void TOpcUA_ServerThread::Cancel()
+{
+	TOpcUA_ServerCall* call;
+	while ((call = Pop()) != NULL) {
+		int state = TOpcUA_ServerCall::Queued;
+		if (call->Done && call->State.compare_exchange_strong(state, TOpcUA_ServerCall::Cancelled))
+			SetEvent(call->Done);           // the server thread deletes it
+		else
+			delete call;
+	}
+}
+void TOpcUA_ServerThread::Stop()
+{
+	Terminate();
+	SetEvent(_stop);
+	while (WaitForSingleObject((HANDLE)Handle, 10) == WAIT_TIMEOUT) {
+		Cancel();
+	}
+	Cancel();
+}
+//---------------------------------------------------------------------------
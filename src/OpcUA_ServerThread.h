@@ -0,0 +1,79 @@
+//---------------------------------------------------------------------------
+
+#ifndef OpcUA_ServerThreadH
+#define OpcUA_ServerThreadH
+//---------------------------------------------------------------------------
+#include <System.Classes.hpp>
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <open62541.h>
+#include "OpcUA_NetworkThread.h"
+//---------------------------------------------------------------------------
+// Serializes the access to an UA_Server, same as for the client: every call into
+// the server must hold it while the server thread runs (recursive).
+typedef TOpcUA_ClientLock TOpcUA_ServerLock;
+//---------------------------------------------------------------------------
+// A call into lua made by the server thread, run by the lua thread (Poll)
+class TOpcUA_ServerCall
+{
+public:
+	enum { Queued, Running, Finished, Cancelled };
+
+	TOpcUA_ServerCall(const std::function<void()>& func, HANDLE done)
+		: Func(func), Done(done), State(Queued) {}
+
+	std::function<void()> Func;
+	HANDLE              Done;               // signaled when finished, NULL: nobody waits (Post)
+	std::atomic<int>    State;
+};
+//---------------------------------------------------------------------------
+// Runs the server's network processing (UA_Server_run_iterate) in the background,
+// so the sessions are served independent of lua. The callbacks which need lua are
+// handed over to the lua thread without waiting: reads are answered from the value
+// lua gave last and refreshed (Post), writes are queued. Method calls are async
+// operations of the server if the build has them (UA_MULTITHREADING >= 100), the
+// server answers them when lua has run them; else they wait for lua (Invoke, up to
+// the call timeout, the server lock is released meanwhile). Callbacks which don't
+// need lua (process images) are answered in this thread. The queued calls are
+// signaled by a wakeup socket, like the client's events.
+class TOpcUA_ServerThread : public TThread
+{
+protected:
+	void __fastcall Execute();
+public:
+	__fastcall TOpcUA_ServerThread(UA_Server* server, TOpcUA_ServerLock* lock, DWORD intervalMs, DWORD callTimeoutMs);
+	__fastcall ~TOpcUA_ServerThread();
+	static TOpcUA_ServerThread* Current();  // the server thread if called by it, NULL in any other thread
+	bool Invoke(const std::function<void()>& func);     // server thread: run in lua and wait, false if it did not run
+	void Post(const std::function<void()>& func);       // server thread: run in lua later
+	size_t Poll();                          // lua thread: run the queued calls, returns their number
+	bool IsPolling() { return _polling > 0; }   // lua thread: inside Poll (a queued call runs)
+	bool WaitForCalls(DWORD ms);            // lua thread: true if calls are pending
+	int GetPollFd();                        // readable as long as calls are pending
+	TOpcUA_ServerLock* GetLock() { return _lock; }
+	void Stop();                            // lua thread: terminate, the calls not run yet are dropped
+private:
+	UA_Server*          _server;
+	TOpcUA_ServerLock*  _lock;
+	DWORD               _intervalMs;
+	DWORD               _callTimeoutMs;
+	CRITICAL_SECTION    _csQueue;
+	std::deque<TOpcUA_ServerCall*> _queue;
+	std::atomic<bool>   _signaled;          // a wakeup datagram is pending
+	UA_SOCKET           _wakeup;            // loopback UDP socket connected to itself
+	HANDLE              _stop;              // ends the wait between two iterations
+	HANDLE              _done;              // set when the call the thread waits for is finished
+	int                 _polling;           // Poll depth (a call may poll again)
+	void Push(TOpcUA_ServerCall* call);
+	TOpcUA_ServerCall* Pop();               // NULL if empty
+	TOpcUA_ServerCall* Fetch();             // Pop for Poll, clears the wakeup when empty
+#if UA_MULTITHREADING >= 100
+	void PostAsyncOperations();
+#endif
+	void Cancel();
+};
+//---------------------------------------------------------------------------
+#endif
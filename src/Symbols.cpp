@@ -72,9 +72,21 @@ void TypeDB::Add(const std::string& varName, const TypeNode& node)
 	_types[node.item.ItemType] = node;
 }
 
+void TypeDB::AddTypeId(const std::string& typeId, const std::string& ItemType)
+{
+	_typeIds[typeId] = ItemType;
+}
+
+const std::string* TypeDB::FindTypeNameById(const std::string& typeId) const
+{
+	tTypeIdMap::const_iterator it = _typeIds.find(typeId);
+	return it == _typeIds.end() ? NULL : &it->second;
+}
+
 void TypeDB::Clear()
 {
     _types.clear();
+    _typeIds.clear();
 }
 
 
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 //---------------------------------------------------------------------------
 
 namespace he {
@@ -146,16 +147,20 @@ public:
 	bool HasTypeByName(const std::string& ItemType);
 	const TypeNode& FindTypeByName(const std::string& ItemType);
 	void Add(const std::string& varName, const TypeNode& node);
+	void AddTypeId(const std::string& typeId, const std::string& ItemType);
+	const std::string* FindTypeNameById(const std::string& typeId) const;     // NULL if unknown
 	void Clear();
 
 	typedef std::map<std::string, std::string> tVariableMap;    // map variable name to type name
 	typedef std::map<std::string, TypeNode> tNameMap;           // map type name to type definition
+	typedef std::unordered_map<std::string, std::string> tTypeIdMap;  // map data type node id (string) to type name
 	const tNameMap& GetTypeMap() { return _types; };
 private:
 	//PBYTE							m_pDatatypes;
 	//std::vector<PAdsDatatypeEntry>  m_vDatatypeArray;
 	tNameMap _types;
     tVariableMap _vars;
+	tTypeIdMap _typeIds;
 };
 
 }; // namespace Symbols
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 #include "open62541.h"
 #include "read_file.h"
@@ -12,6 +15,9 @@
 #include "module_node.hpp"
 //#include "certificates.h"
 #include "OpcUA_IOThread.h"
+#include "OpcUA_NetworkThread.h"
+#include "OpcUA_ClientPool.h"
+#include "OpcUA_NodeSet.h"
 #include <OpcUA_Serializer_Lua.h>
 #include <logger.h>
 #include "Symbols.h"
@@ -52,13 +58,15 @@ namespace lua_opcua {
 
 #define CLINET_SERVICES_REQUEST(XT, XN) \
 UA_##XT##Response XN(const UA_##XT##Request request) { \
+	TOpcUA_ClientLock::Guard guard(_lock); \
 	return UA_Client_Service_##XN(_client, request); \
 } \
 
 class ClientService {
 		UA_Client* _client;
+		TOpcUA_ClientLock* _lock;
 	public:
-		ClientService(UA_Client* client) : _client(client) {}
+		ClientService(UA_Client* client, TOpcUA_ClientLock* lock) : _client(client), _lock(lock) {}
 		CLINET_SERVICES_REQUEST(Read, read)
 		CLINET_SERVICES_REQUEST(Write, write)
 		CLINET_SERVICES_REQUEST(Call, call)
@@ -71,51 +79,69 @@ class ClientService {
 		CLINET_SERVICES_REQUEST(TranslateBrowsePathsToNodeIds, translateBrowsePathsToNodeIds)
 		CLINET_SERVICES_REQUEST(RegisterNodes, registerNodes)
 		CLINET_SERVICES_REQUEST(UnregisterNodes, unregisterNodes)
+#ifdef UA_ENABLE_HISTORIZING
+		CLINET_SERVICES_REQUEST(HistoryRead, historyRead)
+#endif
 		//CLINET_SERVICES_REQUEST(QueryFirst, queryFirst)
 		//CLINET_SERVICES_REQUEST(QueryNext, queryNext)
 };
 
 class ClientAttributeReader : public AttributeReader {
 	UA_Client* _client;
+	TOpcUA_ClientLock* _lock;
+	ClientService _service;
 public:
-	ClientAttributeReader(UA_Client* client) : _client(client) {}
+	ClientAttributeReader(UA_Client* client, TOpcUA_ClientLock* lock) : _client(client), _lock(lock), _service(client, lock) {}
 	UA_StatusCode readNodeId(const UA_NodeId nodeId, UA_NodeId *outNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readNodeIdAttribute(_client, nodeId, outNodeId);
 	}
 	UA_StatusCode readNodeClass(const UA_NodeId nodeId, UA_NodeClass *outNodeClass) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readNodeClassAttribute(_client, nodeId, outNodeClass);
 	}
 	UA_StatusCode readBrowseName(const UA_NodeId nodeId, UA_QualifiedName *outBrowseName) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readBrowseNameAttribute(_client, nodeId, outBrowseName);
 	}
 	UA_StatusCode readDisplayName(const UA_NodeId nodeId, UA_LocalizedText *outDisplayName) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readDisplayNameAttribute(_client, nodeId, outDisplayName);
 	}
 	UA_StatusCode readDescription(const UA_NodeId nodeId, UA_LocalizedText *outDescription) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readDescriptionAttribute(_client, nodeId, outDescription);
 	}
 	UA_StatusCode readWriteMask(const UA_NodeId nodeId, UA_UInt32 *outWriteMask) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readWriteMaskAttribute(_client, nodeId, outWriteMask);
 	}
 	UA_StatusCode readUserWriteMask(const UA_NodeId nodeId, UA_UInt32 *outUserWriteMask) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readUserWriteMaskAttribute(_client, nodeId, outUserWriteMask);
 	}
 	UA_StatusCode readIsAbstract(const UA_NodeId nodeId, UA_Boolean *outIsAbstract) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readIsAbstractAttribute(_client, nodeId, outIsAbstract);
 	}
 	UA_StatusCode readSymmetric(const UA_NodeId nodeId, UA_Boolean *outSymmetric) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readSymmetricAttribute(_client, nodeId, outSymmetric);
 	}
 	UA_StatusCode readInverseName(const UA_NodeId nodeId, UA_LocalizedText *outInverseName) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readInverseNameAttribute(_client, nodeId, outInverseName);
 	}
 	UA_StatusCode readContainsNoLoops(const UA_NodeId nodeId, UA_Boolean *outContainsNoLoops) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readContainsNoLoopsAttribute(_client, nodeId, outContainsNoLoops);
 	}
 	UA_StatusCode readEventNotifier(const UA_NodeId nodeId, UA_Byte *outEventNotifier) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readEventNotifierAttribute(_client, nodeId, outEventNotifier);
 	}
 	UA_StatusCode readValue(const UA_NodeId nodeId, UA_Variant *outValue) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readValueAttribute(_client, nodeId, outValue);
 	}
 	UA_StatusCode readDataValue(const UA_NodeId nodeId, UA_DataValue *outDataValue) {
@@ -128,9 +154,11 @@ public:
 //		return __UA_Client_readAttribute(_client, &nodeId, UA_ATTRIBUTEID_VALUE,
 //									 outDataValue, &UA_TYPES[UA_TYPES_VARIANT]);
 #if defined(UA_OPEN62541_VER) && UA_OPEN62541_VER > 1400
+		TOpcUA_ClientLock::Guard guard(_lock);
 		*outDataValue = UA_Client_read(_client, &id);
 		return outDataValue->status;
 #else
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return __UA_Client_readAttribute(_client, &nodeId, UA_ATTRIBUTEID_VALUE,
 									 outDataValue, &UA_TYPES[UA_TYPES_VARIANT]);
 #endif
@@ -152,6 +180,7 @@ public:
 		UA_ReadRequest_init(&request);
 		request.nodesToRead = &item;
 		request.nodesToReadSize = 1;
+		TOpcUA_ClientLock::Guard guard(_lock);
 		UA_ReadResponse response = UA_Client_Service_read(_client, request);
 		UA_StatusCode retval = response.responseHeader.serviceResult;
 		if(retval == UA_STATUSCODE_GOOD) {
@@ -222,6 +251,7 @@ public:
 	}
 	UA_StatusCode readStructureDefinition(const UA_NodeId nodeId, UA_StructureDefinition *outValue)
 	{
+		TOpcUA_ClientLock::Guard guard(_lock);
 		UA_StatusCode retval = __UA_Client_readAttribute(_client, &nodeId,
 			UA_ATTRIBUTEID_DATATYPEDEFINITION, outValue, &UA_TYPES[UA_TYPES_STRUCTUREDEFINITION]);
 
@@ -229,75 +259,142 @@ public:
 	}
 
 	UA_StatusCode readDataType(const UA_NodeId nodeId, UA_NodeId *outDataType) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readDataTypeAttribute(_client, nodeId, outDataType);
 	}
 	UA_StatusCode readValueRank(const UA_NodeId nodeId, UA_Int32 *outValueRank) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readValueRankAttribute(_client, nodeId, outValueRank);
 	}
 	UA_StatusCode readArrayDimensions(const UA_NodeId nodeId, size_t *outArrayDimensionsSize, UA_UInt32 **outArrayDimensions) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readArrayDimensionsAttribute(_client, nodeId, outArrayDimensionsSize, outArrayDimensions);
 	}
 	UA_StatusCode readAccessLevel(const UA_NodeId nodeId, UA_Byte *outAccessLevel) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readAccessLevelAttribute(_client, nodeId, outAccessLevel);
 	}
 	UA_StatusCode readUserAccessLevel(const UA_NodeId nodeId, UA_Byte *outUserAccessLevel) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readUserAccessLevelAttribute(_client, nodeId, outUserAccessLevel);
 	}
 	UA_StatusCode readMinimumSamplingInterval(const UA_NodeId nodeId, UA_Double *outMinSamplingInterval) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readMinimumSamplingIntervalAttribute(_client, nodeId, outMinSamplingInterval);
 	}
 	UA_StatusCode readHistorizing(const UA_NodeId nodeId, UA_Boolean *outHistorizing) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readHistorizingAttribute(_client, nodeId, outHistorizing);
 	}
 	UA_StatusCode readExecutable(const UA_NodeId nodeId, UA_Boolean *outExecutable) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readExecutableAttribute(_client, nodeId, outExecutable);
 	}
 	UA_StatusCode readUserExecutable(const UA_NodeId nodeId, UA_Boolean *outUserExecutable) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_readUserExecutableAttribute(_client, nodeId, outUserExecutable);
 	}
+	UA_StatusCode readAttributes(size_t itemsSize, const UA_ReadValueId *items, std::vector<UA_DataValue>& outDataValues) {
+		// All items go out in a single ReadRequest (one round trip)
+		UA_ReadRequest request;
+		UA_ReadRequest_init(&request);
+		request.nodesToRead = (UA_ReadValueId*)items;
+		request.nodesToReadSize = itemsSize;
+		request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+		UA_ReadResponse response = _service.read(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.resultsSize != itemsSize)
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (retval == UA_STATUSCODE_GOOD) {
+			// Hand the values over to the caller instead of copying them
+			outDataValues.insert(outDataValues.end(), response.results, response.results + response.resultsSize);
+			UA_Array_delete(response.results, 0, &UA_TYPES[UA_TYPES_DATAVALUE]); // may be the empty array sentinel
+			response.results = NULL;
+			response.resultsSize = 0;
+		}
+		UA_ReadResponse_clear(&response);
+		return retval;
+	}
 };
 
 class ClientAttributeWriter : public AttributeWriter {
 	UA_Client* _client;
+	TOpcUA_ClientLock* _lock;
+	ClientService _service;
+	UA_UInt32 _maxNodesPerWrite;    // server operation limit, 0 = no limit
+	bool _maxNodesPerWriteValid;
+
+	UA_UInt32 getMaxNodesPerWrite() {
+		TOpcUA_ClientLock::Guard guard(_lock);
+		if (!_maxNodesPerWriteValid) {
+			// Read once per session, a server without operation limits does not restrict the request size
+			_maxNodesPerWrite = 0;
+			UA_Variant val; UA_Variant_init(&val);
+			UA_StatusCode re = UA_Client_readValueAttribute(_client,
+				UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERWRITE), &val);
+			if (re == UA_STATUSCODE_GOOD && UA_Variant_hasScalarType(&val, &UA_TYPES[UA_TYPES_UINT32]))
+				_maxNodesPerWrite = *(UA_UInt32*)val.data;
+			UA_Variant_clear(&val);
+			_maxNodesPerWriteValid = true;
+		}
+		return _maxNodesPerWrite;
+	}
 public:
-	ClientAttributeWriter(UA_Client* client) : _client(client) {}
+	ClientAttributeWriter(UA_Client* client, TOpcUA_ClientLock* lock) : _client(client), _lock(lock), _service(client, lock), _maxNodesPerWrite(0), _maxNodesPerWriteValid(false) {}
+	void resetOperationLimits() {
+		TOpcUA_ClientLock::Guard guard(_lock);
+		_maxNodesPerWriteValid = false;
+	}
 	UA_StatusCode writeNodeId(const UA_NodeId nodeId, const UA_NodeId *newNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeNodeIdAttribute(_client, nodeId, newNodeId);
 	}
 	UA_StatusCode writeNodeClass(const UA_NodeId nodeId, const UA_NodeClass *newNodeClass) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeNodeClassAttribute(_client, nodeId, newNodeClass);
 	}
 	UA_StatusCode writeBrowseName(const UA_NodeId nodeId, const UA_QualifiedName *newBrowseName) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeBrowseNameAttribute(_client, nodeId, newBrowseName);
 	}
 	UA_StatusCode writeDisplayName(const UA_NodeId nodeId, const UA_LocalizedText *newDisplayName) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeDisplayNameAttribute(_client, nodeId, newDisplayName);
 	}
 	UA_StatusCode writeDescription(const UA_NodeId nodeId, const UA_LocalizedText *newDescription) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeDescriptionAttribute(_client, nodeId, newDescription);
 	}
 	UA_StatusCode writeWriteMask(const UA_NodeId nodeId, const UA_UInt32 *newWriteMask) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeWriteMaskAttribute(_client, nodeId, newWriteMask);
 	}
 	UA_StatusCode writeUserWriteMask(const UA_NodeId nodeId, const UA_UInt32 *newUserWriteMask) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeUserWriteMaskAttribute(_client, nodeId, newUserWriteMask);
 	}
 	UA_StatusCode writeIsAbstract(const UA_NodeId nodeId, const UA_Boolean *newIsAbstract) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeIsAbstractAttribute(_client, nodeId, newIsAbstract);
 	}
 	UA_StatusCode writeSymmetric(const UA_NodeId nodeId, const UA_Boolean *newSymmetric) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeSymmetricAttribute(_client, nodeId, newSymmetric);
 	}
 	UA_StatusCode writeInverseName(const UA_NodeId nodeId, const UA_LocalizedText *newInverseName)  {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeInverseNameAttribute(_client, nodeId, newInverseName);
 	}
 	UA_StatusCode writeContainsNoLoops(const UA_NodeId nodeId, const UA_Boolean *newContainsNoLoops) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeContainsNoLoopsAttribute(_client, nodeId, newContainsNoLoops);
 	}
 	UA_StatusCode writeEventNotifier(const UA_NodeId nodeId, const UA_Byte *newEventNotifier) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeEventNotifierAttribute(_client, nodeId, newEventNotifier);
 	}
 	UA_StatusCode writeValue(const UA_NodeId nodeId, const UA_Variant *newValue) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeValueAttribute(_client, nodeId, newValue);
 	}
 	UA_StatusCode writeDataValue(const UA_NodeId nodeId, const UA_DataValue *newDataValue) {
@@ -309,8 +406,10 @@ public:
 		//return __UA_Client_writeAttribute(_client, &nodeId, UA_ATTRIBUTEID_VALUE,
 		//							  newDataValue, &UA_TYPES[UA_TYPES_VARIANT]);
 #if defined(UA_OPEN62541_VER) && UA_OPEN62541_VER > 1400
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_write(_client, &val);
 #else
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return __UA_Client_writeAttribute(_client, &nodeId, UA_ATTRIBUTEID_VALUE,
 									  newDataValue, &UA_TYPES[UA_TYPES_VARIANT]);
 #endif
@@ -348,37 +447,73 @@ public:
 			// enforce bytestring (if not yet)
 			myVariant.type = &UA_TYPES[UA_TYPES_BYTESTRING];
 		}
+		TOpcUA_ClientLock::Guard guard(_lock);
 		UA_StatusCode retval = UA_Client_writeValueAttribute(_client, nodeId, &myVariant);
 		UA_Variant_clear(&myVariant);
 		return retval;
 	}
 	UA_StatusCode writeDataType(const UA_NodeId nodeId, const UA_NodeId *newDataType) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeDataTypeAttribute(_client, nodeId, newDataType);
 	}
 	UA_StatusCode writeValueRank(const UA_NodeId nodeId, const UA_Int32 *newValueRank) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeValueRankAttribute(_client, nodeId, newValueRank);
 	}
 	UA_StatusCode writeArrayDimensions(const UA_NodeId nodeId, size_t newArrayDimensionsSize, const UA_UInt32 *newArrayDimensions) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeArrayDimensionsAttribute(_client, nodeId, newArrayDimensionsSize, newArrayDimensions);
 	}
 	UA_StatusCode writeAccessLevel(const UA_NodeId nodeId, const UA_Byte *newAccessLevel) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeAccessLevelAttribute(_client, nodeId, newAccessLevel);
 	}
 	UA_StatusCode writeUserAccessLevel(const UA_NodeId nodeId, const UA_Byte *newUserAccessLevel) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeUserAccessLevelAttribute(_client, nodeId, newUserAccessLevel);
 	}
 	UA_StatusCode writeMinimumSamplingInterval(const UA_NodeId nodeId, const UA_Double *newMinInterval) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeMinimumSamplingIntervalAttribute(_client, nodeId, newMinInterval);
 	}
 	UA_StatusCode writeHistorizing(const UA_NodeId nodeId, const UA_Boolean *newHistorizing) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeHistorizingAttribute(_client, nodeId, newHistorizing);
 	}
 	UA_StatusCode writeExecutable(const UA_NodeId nodeId, const UA_Boolean *newExecutable) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeExecutableAttribute(_client, nodeId, newExecutable);
 	}
 	UA_StatusCode writeUserExecutable(const UA_NodeId nodeId, const UA_Boolean *newUserExecutable) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_writeUserExecutableAttribute(_client, nodeId, newUserExecutable);
 	}
+	UA_StatusCode writeAttributes(size_t itemsSize, const UA_WriteValue *items, std::vector<UA_StatusCode>& outResults) {
+		// As few WriteRequests as the server's MaxNodesPerWrite allows. If a request fails, the
+		// items of the chunks before keep their results, the rest get the error of the request
+		size_t chunkSize = getMaxNodesPerWrite();
+		if (chunkSize == 0)
+			chunkSize = itemsSize;
+		for (size_t offset = 0; offset < itemsSize; offset += chunkSize) {
+			size_t count = itemsSize - offset < chunkSize ? itemsSize - offset : chunkSize;
+			UA_WriteRequest request;
+			UA_WriteRequest_init(&request);
+			request.nodesToWrite = (UA_WriteValue*)&items[offset];
+			request.nodesToWriteSize = count;
+			UA_WriteResponse response = _service.write(request);
+			UA_StatusCode retval = response.responseHeader.serviceResult;
+			if (retval == UA_STATUSCODE_GOOD && response.resultsSize != count)
+				retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+			if (retval == UA_STATUSCODE_GOOD)
+				outResults.insert(outResults.end(), response.results, response.results + count);
+			UA_WriteResponse_clear(&response);
+			if (retval != UA_STATUSCODE_GOOD) {
+				outResults.insert(outResults.end(), itemsSize - offset, retval);
+				return retval;
+			}
+		}
+		return UA_STATUSCODE_GOOD;
+	}
 };
 
 static std::string str(const UA_String& name)
@@ -387,14 +522,112 @@ static std::string str(const UA_String& name)
 	return tmp;
 }
 
+// LRU cache of resolved browse paths (path key => target nodes)
+class BrowsePathCache {
+	typedef std::list< std::pair<std::string, std::vector<BrowsePathTarget> > > Entries;
+	Entries _entries;       // most recently used first
+	std::unordered_map<std::string, Entries::iterator> _index;
+	size_t _capacity;
+public:
+	BrowsePathCache(size_t capacity) : _capacity(capacity) {}
+	bool get(const std::string& key, std::vector<BrowsePathTarget>& outTargets) {
+		auto ptr = _index.find(key);
+		if (ptr == _index.end())
+			return false;
+		_entries.splice(_entries.begin(), _entries, ptr->second);
+		outTargets = ptr->second->second;
+		return true;
+	}
+	void put(const std::string& key, const std::vector<BrowsePathTarget>& targets) {
+		auto ptr = _index.find(key);
+		if (ptr != _index.end()) {
+			ptr->second->second = targets;
+			_entries.splice(_entries.begin(), _entries, ptr->second);
+			return;
+		}
+		_entries.emplace_front(key, targets);
+		_index[key] = _entries.begin();
+		if (_entries.size() > _capacity) {
+			_index.erase(_entries.back().first);
+			_entries.pop_back();
+		}
+	}
+	void clear() {
+		_index.clear();
+		_entries.clear();
+	}
+};
+
+static std::string browsePathKey(const UA_BrowsePath& path)
+{
+	std::stringstream ss;
+	ss << toString(path.startingNode);
+	for (size_t i = 0; i < path.relativePath.elementsSize; ++i) {
+		const UA_QualifiedName& name = path.relativePath.elements[i].targetName;
+		ss << "/" << name.namespaceIndex << ":" << std::string((const char*)name.name.data, name.name.length);
+	}
+	return ss.str();
+}
+
 class ClientNodeMgr : public NodeMgr {
 	UA_Client* _client;
+	TOpcUA_ClientLock* _lock;
+	ClientService _service;
 	ClientAttributeReader _reader;
 	ClientAttributeWriter _writer;
+	BrowsePathCache _pathCache;         // namespace indexes of the session, see resetSessionCache
+	size_t _sessionGeneration;          // counts the resets, a path resolved across one is not cached
+	// Input argument types of the methods called (read from their InputArguments property),
+	// method node id => data type per argument (NULL for unknown types)
+	std::unordered_map<std::string, std::vector<const UA_DataType*> > _inputArgsCache;
 public:
 	he::Symbols::TypeDB _db;                // type cache for serialization
 
-	ClientNodeMgr(UA_Client* client) : _client(client), _reader(client), _writer(client) {}
+	ClientNodeMgr(UA_Client* client, TOpcUA_ClientLock* lock) : _client(client), _lock(lock), _service(client, lock),
+		_reader(client, lock), _writer(client, lock), _pathCache(1024), _sessionGeneration(0) {}
+	// Drop everything cached for the current session (called on session state changes): a
+	// restarted server may have renumbered its namespaces, the cached paths and ids use them
+	void resetSessionCache() {
+		TOpcUA_ClientLock::Guard guard(_lock);
+		_writer.resetOperationLimits();
+		_sessionGeneration++;
+		_pathCache.clear();
+		_inputArgsCache.clear();
+	}
+	void clearPathCache() {
+		TOpcUA_ClientLock::Guard guard(_lock);
+		_pathCache.clear();
+	}
+	// Register nodes for repeated access. The registered ids (aliases) are valid until
+	// unregistered or the session ends.
+	UA_StatusCode registerNodes(size_t nodesSize, const UA_NodeId* nodes, std::vector<UA_NodeId>& outRegistered) {
+		UA_RegisterNodesRequest request;
+		UA_RegisterNodesRequest_init(&request);
+		request.nodesToRegister = (UA_NodeId*)nodes;
+		request.nodesToRegisterSize = nodesSize;
+		UA_RegisterNodesResponse response = _service.registerNodes(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.registeredNodeIdsSize != nodesSize)
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (retval == UA_STATUSCODE_GOOD) {
+			outRegistered.insert(outRegistered.end(), response.registeredNodeIds, response.registeredNodeIds + nodesSize);
+			UA_Array_delete(response.registeredNodeIds, 0, &UA_TYPES[UA_TYPES_NODEID]); // may be the empty array sentinel
+			response.registeredNodeIds = NULL;
+			response.registeredNodeIdsSize = 0;
+		}
+		UA_RegisterNodesResponse_clear(&response);
+		return retval;
+	}
+	UA_StatusCode unregisterNodes(size_t nodesSize, const UA_NodeId* nodes) {
+		UA_UnregisterNodesRequest request;
+		UA_UnregisterNodesRequest_init(&request);
+		request.nodesToUnregister = (UA_NodeId*)nodes;
+		request.nodesToUnregisterSize = nodesSize;
+		UA_UnregisterNodesResponse response = _service.unregisterNodes(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		UA_UnregisterNodesResponse_clear(&response);
+		return retval;
+	}
 	AttributeReader* getAttributeReader() {
 		return &_reader;
 	}
@@ -407,6 +640,7 @@ public:
 			UA_Boolean isForward,
 			const UA_String targetServerUri,
 			UA_NodeClass targetNodeClass) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addReference(_client, sourceNodeId, referenceTypeId, isForward, targetServerUri, targetNodeId, targetNodeClass);
 	}
 	UA_StatusCode deleteReference(const UA_NodeId sourceNodeId,
@@ -414,9 +648,11 @@ public:
 			const UA_ExpandedNodeId targetNodeId,
 			UA_Boolean isForward,
 			UA_NodeClass targetNodeClass) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_deleteReference(_client, sourceNodeId, referenceTypeId, isForward, targetNodeId, targetNodeClass);
 	}
 	UA_StatusCode deleteNode(const UA_NodeId nodeId, bool deleteTargetReferences) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_deleteNode(_client, nodeId, deleteTargetReferences);
 	}
 	UA_StatusCode addVariable(const UA_NodeId requestedNewNodeId,
@@ -426,6 +662,7 @@ public:
 			const UA_NodeId typeDefinition,
 			const UA_VariableAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addVariableNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, outNewNodeId);
 	}
 	UA_StatusCode addVariableType(const UA_NodeId requestedNewNodeId,
@@ -434,6 +671,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_VariableTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addVariableTypeNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 	UA_StatusCode addObject(const UA_NodeId requestedNewNodeId,
@@ -443,6 +681,7 @@ public:
 			const UA_NodeId typeDefinition,
 			const UA_ObjectAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addObjectNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, outNewNodeId);
 	}
 	UA_StatusCode addObjectType(const UA_NodeId requestedNewNodeId,
@@ -451,6 +690,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ObjectTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addObjectTypeNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 	UA_StatusCode addView(const UA_NodeId requestedNewNodeId,
@@ -459,6 +699,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ViewAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addViewNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 	UA_StatusCode addReferenceType(const UA_NodeId requestedNewNodeId,
@@ -467,6 +708,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ReferenceTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addReferenceTypeNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 	UA_StatusCode addDataType(const UA_NodeId requestedNewNodeId,
@@ -475,10 +717,12 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_DataTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addDataTypeNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 #if defined(UA_OPEN62541_VER) && UA_OPEN62541_VER > 1400
 	const UA_DataType* findDataType(const UA_NodeId *typeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_findDataType(_client, typeId);
 	}
 #endif
@@ -492,6 +736,7 @@ public:
 			size_t outputArgumentsSize, const UA_Argument* outputArguments,
 			void *nodeContext,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_addMethodNode(_client, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, outNewNodeId);
 	}
 	UA_StatusCode callMethod(const UA_NodeId objectId,
@@ -500,14 +745,264 @@ public:
 			const UA_Variant *input,
 			size_t *outputSize,
 			UA_Variant **output) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_call(_client, objectId, methodId, inputSize, input, outputSize, output);
 	}
 
 	UA_StatusCode forEachChildNodeCall(UA_NodeId parentNodeId,
 			UA_NodeIteratorCallback callback,
 			void *handle) {
+		TOpcUA_ClientLock::Guard guard(_lock);
 		return UA_Client_forEachChildNodeCall(_client, parentNodeId, callback, handle);
 	}
+	UA_StatusCode browseChildren(const UA_NodeId parentNodeId,
+			std::vector<UA_ReferenceDescription>& outReferences) {
+		UA_BrowseDescription desc;
+		initChildrenBrowseDescription(&desc, parentNodeId);
+		std::vector< std::vector<UA_ReferenceDescription> > references;
+		std::vector<UA_StatusCode> statuses;
+		UA_StatusCode retval = browseNodes(1, &desc, references, statuses);
+		if (retval == UA_STATUSCODE_GOOD)
+			retval = statuses[0];
+		outReferences.insert(outReferences.end(), references[0].begin(), references[0].end());
+		return retval;
+	}
+	// Browse many nodes with a single BrowseRequest, the references of each node are moved to
+	// outReferences, its status to outStatuses (same order as descs). The continuation points
+	// of all nodes go out together in the BrowseNext requests.
+	UA_StatusCode browseNodes(size_t descsSize, const UA_BrowseDescription* descs,
+			std::vector< std::vector<UA_ReferenceDescription> >& outReferences,
+			std::vector<UA_StatusCode>& outStatuses) {
+		outReferences.assign(descsSize, std::vector<UA_ReferenceDescription>());
+		outStatuses.assign(descsSize, UA_STATUSCODE_GOOD);
+		std::vector<UA_ByteString> cps;     // pending continuation points
+		std::vector<size_t> owners;         // index of the node of each continuation point
+		UA_BrowseRequest request;
+		UA_BrowseRequest_init(&request);
+		request.nodesToBrowse = (UA_BrowseDescription*)descs;
+		request.nodesToBrowseSize = descsSize;
+		UA_BrowseResponse response = _service.browse(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.resultsSize != descsSize)
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		for (size_t i = 0; retval == UA_STATUSCODE_GOOD && i < descsSize; ++i) {
+			UA_ByteString cp; UA_ByteString_init(&cp);
+			outStatuses[i] = takeBrowseResult(response.results[i], outReferences[i], &cp);
+			if (cp.length > 0) {
+				cps.push_back(cp);
+				owners.push_back(i);
+			}
+		}
+		UA_BrowseResponse_clear(&response);
+
+		// Server did not return all references at once, fetch the rest
+		UA_BrowseNextRequest nextRequest;
+		UA_BrowseNextRequest_init(&nextRequest);
+		while (retval == UA_STATUSCODE_GOOD && !cps.empty()) {
+			nextRequest.continuationPoints = &cps[0];
+			nextRequest.continuationPointsSize = cps.size();
+			UA_BrowseNextResponse nextResponse = _service.browseNext(nextRequest);
+			retval = nextResponse.responseHeader.serviceResult;
+			if (retval == UA_STATUSCODE_GOOD && nextResponse.resultsSize != cps.size())
+				retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+			if (retval == UA_STATUSCODE_GOOD) {
+				std::vector<UA_ByteString> nextCps;
+				std::vector<size_t> nextOwners;
+				for (size_t i = 0; i < cps.size(); ++i) {
+					UA_ByteString cp; UA_ByteString_init(&cp);
+					outStatuses[owners[i]] = takeBrowseResult(nextResponse.results[i], outReferences[owners[i]], &cp);
+					if (cp.length > 0) {
+						nextCps.push_back(cp);
+						nextOwners.push_back(owners[i]);
+					}
+					UA_ByteString_clear(&cps[i]);
+				}
+				cps.swap(nextCps);
+				owners.swap(nextOwners);
+			}
+			UA_BrowseNextResponse_clear(&nextResponse);
+		}
+		if (!cps.empty()) {
+			// A BrowseNext request failed (the loop only ends with pending points then),
+			// free the continuation points on the server
+			nextRequest.continuationPoints = &cps[0];
+			nextRequest.continuationPointsSize = cps.size();
+			nextRequest.releaseContinuationPoints = true;
+			UA_BrowseNextResponse nextResponse = _service.browseNext(nextRequest);
+			UA_BrowseNextResponse_clear(&nextResponse);
+			for (size_t i = 0; i < cps.size(); ++i)
+				UA_ByteString_clear(&cps[i]);
+		}
+		return retval;
+	}
+	UA_StatusCode resolveBrowsePaths(size_t pathsSize, const UA_BrowsePath* paths,
+			std::vector< std::vector<BrowsePathTarget> >& outTargets) {
+		// the path cache is shared with the network thread (reset on session changes)
+		TOpcUA_ClientLock::Guard guard(_lock);
+		size_t first = outTargets.size();
+		outTargets.resize(first + pathsSize);
+		size_t generation = _sessionGeneration;
+
+		// Only the paths not in the cache go to the server
+		std::vector<std::string> keys(pathsSize);
+		std::vector<UA_BrowsePath> missed;
+		std::vector<size_t> missedIndex;
+		for (size_t i = 0; i < pathsSize; ++i) {
+			keys[i] = browsePathKey(paths[i]);
+			if (!_pathCache.get(keys[i], outTargets[first + i])) {
+				missed.push_back(paths[i]);
+				missedIndex.push_back(i);
+			}
+		}
+		if (missed.empty())
+			return UA_STATUSCODE_GOOD;
+
+		UA_TranslateBrowsePathsToNodeIdsRequest request;
+		UA_TranslateBrowsePathsToNodeIdsRequest_init(&request);
+		request.browsePaths = &missed[0];
+		request.browsePathsSize = missed.size();
+		UA_TranslateBrowsePathsToNodeIdsResponse response = _service.translateBrowsePathsToNodeIds(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.resultsSize != missed.size())
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (retval != UA_STATUSCODE_GOOD) {
+			UA_TranslateBrowsePathsToNodeIdsResponse_clear(&response);
+			return retval;
+		}
+		for (size_t m = 0; m < missed.size(); ++m) {
+			const UA_BrowsePathResult& result = response.results[m];
+			for (size_t t = 0; result.statusCode == UA_STATUSCODE_GOOD && t < result.targetsSize; ++t) {
+				const UA_BrowsePathTarget& target = result.targets[t];
+				if (target.remainingPathIndex != UA_UINT32_MAX || target.targetId.serverIndex != 0)
+					continue;
+				outTargets[first + missedIndex[m]].push_back(BrowsePathTarget(target.targetId.nodeId, UA_NODECLASS_UNSPECIFIED));
+			}
+		}
+		UA_TranslateBrowsePathsToNodeIdsResponse_clear(&response);
+
+		// The node classes of all new targets with a single read
+		std::vector<UA_ReadValueId> items;
+		std::vector<BrowsePathTarget*> targets;
+		for (size_t m = 0; m < missed.size(); ++m) {
+			for (auto & target : outTargets[first + missedIndex[m]]) {
+				UA_ReadValueId item; UA_ReadValueId_init(&item);
+				item.nodeId = target.nodeId;
+				item.attributeId = UA_ATTRIBUTEID_NODECLASS;
+				items.push_back(item);
+				targets.push_back(&target);
+			}
+		}
+		if (!items.empty()) {
+			std::vector<UA_DataValue> values;
+			if (_reader.readAttributes(items.size(), &items[0], values) == UA_STATUSCODE_GOOD) {
+				for (size_t k = 0; k < values.size(); ++k) {
+					// NodeClass is an enum, it is transferred as Int32
+					const UA_Variant& val = values[k].value;
+					if (UA_Variant_isScalar(&val) && (val.type == &UA_TYPES[UA_TYPES_NODECLASS] || val.type == &UA_TYPES[UA_TYPES_INT32]))
+						targets[k]->nodeClass = *(UA_NodeClass*)val.data;
+					UA_DataValue_clear(&values[k]);
+				}
+			}
+		}
+
+		// Remember the paths found (not found paths may show up later), unless the session
+		// changed meanwhile (the requests run the client, its state callback resets the cache)
+		for (size_t m = 0; m < missed.size() && generation == _sessionGeneration; ++m) {
+			auto & found = outTargets[first + missedIndex[m]];
+			if (!found.empty())
+				_pathCache.put(keys[missedIndex[m]], found);
+		}
+		return UA_STATUSCODE_GOOD;
+	}
+
+	// Get the input argument types of the given methods. The InputArguments properties
+	// not cached yet are resolved and read with one request each for all methods.
+	UA_StatusCode getInputArgumentTypes(size_t methodsSize, const UA_NodeId* methods,
+			std::vector< std::vector<const UA_DataType*> >& outTypes) {
+		TOpcUA_ClientLock::Guard guard(_lock);
+		outTypes.resize(methodsSize);
+		std::vector<std::string> keys(methodsSize);
+		std::vector<std::string> missed;
+		std::vector<UA_BrowsePath> paths;
+		UA_RelativePathElement element;
+		UA_RelativePathElement_init(&element);
+		element.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY);
+		element.targetName = UA_QUALIFIEDNAME(0, (char*)"InputArguments");
+		for (size_t i = 0; i < methodsSize; ++i) {
+			keys[i] = toString(methods[i]);
+			if (_inputArgsCache.count(keys[i]) || std::find(missed.begin(), missed.end(), keys[i]) != missed.end())
+				continue;
+			UA_BrowsePath path;
+			UA_BrowsePath_init(&path);
+			path.startingNode = methods[i];
+			path.relativePath.elements = &element;
+			path.relativePath.elementsSize = 1;
+			paths.push_back(path);
+			missed.push_back(keys[i]);
+		}
+
+		UA_StatusCode retval = UA_STATUSCODE_GOOD;
+		if (!paths.empty()) {
+			std::vector< std::vector<BrowsePathTarget> > targets;
+			retval = resolveBrowsePaths(paths.size(), &paths[0], targets);
+			std::vector<UA_ReadValueId> items;
+			std::vector<size_t> itemIndex;
+			for (size_t m = 0; retval == UA_STATUSCODE_GOOD && m < missed.size(); ++m) {
+				if (targets[m].empty()) {
+					_inputArgsCache[missed[m]];     // no input arguments
+					continue;
+				}
+				UA_ReadValueId item; UA_ReadValueId_init(&item);
+				item.nodeId = targets[m][0].nodeId;
+				item.attributeId = UA_ATTRIBUTEID_VALUE;
+				items.push_back(item);
+				itemIndex.push_back(m);
+			}
+			std::vector<UA_DataValue> values;
+			if (!items.empty())
+				retval = _reader.readAttributes(items.size(), &items[0], values);
+			for (size_t k = 0; k < values.size(); ++k) {
+				const UA_Variant& val = values[k].value;
+				if (values[k].status == UA_STATUSCODE_GOOD && val.type == &UA_TYPES[UA_TYPES_ARGUMENT]) {
+					std::vector<const UA_DataType*>& types = _inputArgsCache[missed[itemIndex[k]]];
+					const UA_Argument* args = (const UA_Argument*)val.data;
+					size_t count = UA_Variant_isScalar(&val) ? 1 : val.arrayLength;
+					for (size_t a = 0; a < count; ++a) {
+						types.push_back(UA_findDataType(&args[a].dataType));
+					}
+				}
+				UA_DataValue_clear(&values[k]);
+			}
+		}
+		for (size_t i = 0; i < methodsSize; ++i) {
+			auto ptr = _inputArgsCache.find(keys[i]);
+			if (ptr != _inputArgsCache.end())
+				outTypes[i] = ptr->second;
+		}
+		return retval;
+	}
+
+	// Call many methods with a single CallRequest, the results are moved to outResults
+	UA_StatusCode callMethods(size_t methodsSize, const UA_CallMethodRequest* methods,
+			std::vector<UA_CallMethodResult>& outResults) {
+		UA_CallRequest request;
+		UA_CallRequest_init(&request);
+		request.methodsToCall = (UA_CallMethodRequest*)methods;
+		request.methodsToCallSize = methodsSize;
+		UA_CallResponse response = _service.call(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.resultsSize != methodsSize)
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (retval == UA_STATUSCODE_GOOD) {
+			outResults.insert(outResults.end(), response.results, response.results + methodsSize);
+			// only the array, the content belongs to outResults now (may be the empty array sentinel)
+			UA_Array_delete(response.results, 0, &UA_TYPES[UA_TYPES_CALLMETHODRESULT]);
+			response.results = NULL;
+			response.resultsSize = 0;
+		}
+		UA_CallResponse_clear(&response);
+		return retval;
+	}
 
 	// Read the structure definition of the given data type
 	// Create a generic data type definition from the OPC-UA specific structure definition,
@@ -523,6 +1018,7 @@ public:
 		// not found, resolve and add it to the cache
 		//he::Symbols::TypeNode typeNode;
 		uint8_t buf[8192];
+		TOpcUA_ClientLock::Guard guard(_lock);
 		UA_StatusCode retval = __UA_Client_readAttribute(_client, &nidNodeId,
 			UA_ATTRIBUTEID_DATATYPEDEFINITION, buf, &UA_TYPES[UA_TYPES_STRUCTUREDEFINITION]);
 		if (0 == retval) {
@@ -692,6 +1188,7 @@ public:
 
             // Todo: fix the datasize!!
 			_db.Add(Name, typeNode);
+			_db.AddTypeId(toString(nidNodeId), Name);
 
 		} // if read datatype success
 		//UA_NodeId_clear(&nidTmp);
@@ -699,6 +1196,63 @@ public:
 		return retval;
 	}
 
+	UA_StatusCode historyReadRaw(const UA_NodeId nodeId, UA_DateTime startTime, UA_DateTime endTime,
+			UA_UInt32 numValuesPerNode, UA_Boolean returnBounds, UA_TimestampsToReturn timestamps,
+			UA_ByteString* continuationPoint, bool release, std::vector<UA_DataValue>& outValues) {
+#ifdef UA_ENABLE_HISTORIZING
+		UA_ReadRawModifiedDetails details;
+		UA_ReadRawModifiedDetails_init(&details);
+		details.isReadModified = false;
+		details.startTime = startTime;
+		details.endTime = endTime;
+		details.numValuesPerNode = numValuesPerNode;
+		details.returnBounds = returnBounds;
+
+		UA_HistoryReadValueId item;
+		UA_HistoryReadValueId_init(&item);
+		item.nodeId = nodeId;
+		item.continuationPoint = *continuationPoint;    // shallow, still owned by the caller
+
+		UA_HistoryReadRequest request;
+		UA_HistoryReadRequest_init(&request);
+		request.historyReadDetails.encoding = UA_EXTENSIONOBJECT_DECODED_NODELETE;
+		request.historyReadDetails.content.decoded.type = &UA_TYPES[UA_TYPES_READRAWMODIFIEDDETAILS];
+		request.historyReadDetails.content.decoded.data = &details;
+		request.timestampsToReturn = timestamps;
+		request.releaseContinuationPoints = release;
+		request.nodesToRead = &item;
+		request.nodesToReadSize = 1;
+		UA_HistoryReadResponse response = _service.historyRead(request);
+		UA_StatusCode retval = response.responseHeader.serviceResult;
+		if (retval == UA_STATUSCODE_GOOD && response.resultsSize != 1)
+			retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (retval == UA_STATUSCODE_GOOD)
+			retval = response.results[0].statusCode;
+		// the old continuation point is used up
+		UA_ByteString_clear(continuationPoint);
+		// GoodNoData (empty range) and GoodMoreData are pages as well
+		if (!UA_StatusCode_isBad(retval)) {
+			UA_HistoryReadResult& result = response.results[0];
+			*continuationPoint = result.continuationPoint;
+			UA_ByteString_init(&result.continuationPoint);
+			if (result.historyData.content.decoded.type == &UA_TYPES[UA_TYPES_HISTORYDATA]) {
+				// move the values, only the array is freed
+				UA_HistoryData* data = (UA_HistoryData*)result.historyData.content.decoded.data;
+				outValues.insert(outValues.end(), data->dataValues, data->dataValues + data->dataValuesSize);
+				// an empty page is the sentinel, UA_free would crash on it
+				UA_Array_delete(data->dataValues, 0, &UA_TYPES[UA_TYPES_DATAVALUE]);
+				data->dataValues = NULL;
+				data->dataValuesSize = 0;
+			}
+			retval = UA_STATUSCODE_GOOD;
+		}
+		UA_HistoryReadResponse_clear(&response);
+		return retval;
+#else
+		return UA_STATUSCODE_BADNOTSUPPORTED;
+#endif
+	}
+
 	UA_StatusCode resolveExtensionObjectType(const UA_NodeId& nodeId, const std::string& Name)
 	{
 		int offset = 0;
@@ -752,15 +1306,143 @@ public:
 	}
 };
 
+// Read items of client:read / readAsync and the pool: { {node|nodeId, attribute}, node|nodeId, ... }
+static bool toReadValueIds(sol::table items, std::vector<UA_ReadValueId>& ids) {
+	ids.reserve(items.size());
+	for (size_t i = 1; i <= items.size(); ++i) {
+		sol::object entry = items.get<sol::object>(i);
+		UA_ReadValueId id; UA_ReadValueId_init(&id);
+		bool ok;
+		if (entry.get_type() == sol::type::table) {
+			sol::table item = entry.as<sol::table>();
+			ok = toNodeId(item.get<sol::object>(1), &id.nodeId) && toAttributeId(item.get<sol::object>(2), &id.attributeId);
+		} else {
+			ok = toNodeId(entry, &id.nodeId);
+			id.attributeId = UA_ATTRIBUTEID_VALUE;
+		}
+		if (!ok)
+			return false;
+		ids.push_back(id);
+	}
+	return true;
+}
+// Write items of client:write / writeAsync and the pool: { {node|nodeId, Variant|DataValue [, attribute]}, ... }
+// Shallow copies, the data stays owned by the lua objects
+static bool toWriteValues(sol::table items, std::vector<UA_WriteValue>& values) {
+	values.reserve(items.size());
+	for (size_t i = 1; i <= items.size(); ++i) {
+		sol::object entry = items.get<sol::object>(i);
+		if (entry.get_type() != sol::type::table)
+			return false;
+		sol::table item = entry.as<sol::table>();
+		UA_WriteValue val; UA_WriteValue_init(&val);
+		if (!toNodeId(item.get<sol::object>(1), &val.nodeId) || !toAttributeId(item.get<sol::object>(3), &val.attributeId))
+			return false;
+		sol::object value = item.get<sol::object>(2);
+		if (value.is<UA_Variant>()) {
+			val.value.value = value.as<UA_Variant&>();
+			val.value.hasValue = true;
+		} else if (value.is<UA_DataValue>()) {
+			val.value = value.as<UA_DataValue&>();
+		} else {
+			return false;
+		}
+		values.push_back(val);
+	}
+	return true;
+}
+
 class UA_Client_Proxy {
 protected:
 	UA_Client_Proxy(UA_Client_Proxy& prox);
 	UA_Client* _client;
+	TOpcUA_ClientLock _lock;        // serializes the client access as soon as the network thread runs
+	TOpcUA_NetworkThread* _netThread;
 	ClientNodeMgr* _mgr;
 
 	typedef std::function<void(UA_UInt32 monId, UA_DataValue value, UA_UInt32 subId, void *monContext)> SubscribeCallback;
 	std::map<UA_UInt32, SubscribeCallback> _subCallbackMap;
 
+	// Batch mode subscription: the notifications are collected in a preallocated buffer
+	// and handed to lua as one array per run_iterate (or when the buffer is full)
+	struct NotificationBuffer {
+		std::vector<UA_UInt32> monIds;
+		std::vector<UA_DataValue> values;
+		std::vector<void*> contexts;    // type to decode the value with (see subscribeNode) or NULL
+		size_t count;
+		sol::function callback;     // callback(sub_id, mon_ids, data_values, decoded)
+	};
+
+	// Monitored items subscribed with a type name carry the TypeDB entry as context. Their
+	// (vendor) structure values are deserialized straight from the notification's body,
+	// returns the lua table or nil if there is nothing to decode.
+	sol::object decodeNotification(lua_State* L, void* monContext, const UA_DataValue& val) {
+		if (!monContext || !val.hasValue || !UA_Variant_hasScalarType(&val.value, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]))
+			return sol::make_object(L, sol::lua_nil);
+		const UA_ExtensionObject* eo = (const UA_ExtensionObject*)val.value.data;
+		if (eo->encoding != UA_EXTENSIONOBJECT_ENCODED_BYTESTRING)
+			return sol::make_object(L, sol::lua_nil);
+		const he::Symbols::TypeNode* tn = (const he::Symbols::TypeNode*)monContext;
+		int top = lua_gettop(L);
+		int n = he::lua::Serializer::Deserialize(L, _mgr->_db, *tn, eo->content.encoded.body.data, eo->content.encoded.body.length);
+		if (n != 1) {
+			lua_settop(L, top);                 // nil, error
+			return sol::make_object(L, sol::lua_nil);
+		}
+		sol::object decoded(L, -1);
+		lua_pop(L, 1);
+		return decoded;
+	}
+	// Type of the given name to decode the notifications with, NULL if unknown
+	void* findNotificationType(const std::string& typeName) {
+		if (!_mgr->_db.HasTypeByName(typeName))
+			return NULL;
+		return (void*)&_mgr->_db.FindTypeByName(typeName);     // the type db never drops entries
+	}
+	std::map<UA_UInt32, NotificationBuffer> _subBatchMap;
+	// deleted subscriptions (by lua, the server or a reconnect), their callbacks are removed
+	// after the delivery: a callback may delete its own subscription
+	std::vector<UA_UInt32> _deletedSubs;
+
+	void pruneSubscriptions() {
+		for (UA_UInt32 subId : _deletedSubs) {
+			auto bptr = _subBatchMap.find(subId);
+			if (bptr != _subBatchMap.end()) {
+				NotificationBuffer& buf = bptr->second;
+				for (size_t i = 0; i < buf.count; ++i)
+					UA_DataValue_clear(&buf.values[i]);
+				_subBatchMap.erase(bptr);
+			}
+			_subCallbackMap.erase(subId);
+		}
+		_deletedSubs.clear();
+	}
+
+	void flushNotifications(UA_UInt32 subId, NotificationBuffer& buf) {
+		if (buf.count == 0)
+			return;
+		sol::state_view lua(buf.callback.lua_state());
+		sol::table monIds = lua.create_table(buf.count, 0);
+		sol::table values = lua.create_table(buf.count, 0);
+		sol::table decoded;                 // only created if there are typed items
+		for (size_t i = 0; i < buf.count; ++i) {
+			monIds[i + 1] = buf.monIds[i];
+			if (buf.contexts[i]) {
+				// decode before the value is handed over (same index as in data_values)
+				if (!decoded.valid())
+					decoded = lua.create_table();
+				decoded[i + 1] = decodeNotification(lua, buf.contexts[i], buf.values[i]);
+			}
+			values[i + 1] = buf.values[i];     // the lua object owns the value from now on
+			UA_DataValue_init(&buf.values[i]);
+		}
+		buf.count = 0;
+		if (decoded.valid())
+			buf.callback(subId, monIds, values, decoded);
+		else
+			buf.callback(subId, monIds, values);
+	}
+
 	/*
 	struct SubscribeCallbackItem {
 		UA_UInt32 sub_id;
@@ -783,6 +1465,153 @@ protected:
 			UA_StatusCode connectStatus)> StateCallback;
 	StateCallback _stateCallback;
 	//UA_ClientState _stateCallbackNew;
+
+	// Async service requests (readAsync, writeAsync, callAsync). The request context owns
+	// the lua completion target (callback function or coroutine) until it is delivered.
+	struct AsyncRequest {
+		UA_Client_Proxy* proxy;
+		const UA_DataType* responseType;
+		sol::object done;
+	};
+	struct AsyncResponse {
+		UA_UInt32 requestId;
+		AsyncRequest* request;
+		void* response;
+	};
+	std::vector<AsyncResponse> _asyncResponses;     // received, delivered by run_iterate
+	bool _closing;                                  // client is deleted, don't call lua anymore
+
+	static void
+		asyncServiceCallback(UA_Client *client, void *userdata, UA_UInt32 requestId, void *response) {
+			AsyncRequest* req = (AsyncRequest*)userdata;
+			UA_Client_Proxy* pClient = req->proxy;
+			// Take the response over, the library clears what is left. Lua is never called
+			// from here (we may be inside another service call), see run_iterate/poll.
+			void* resp = UA_new(req->responseType);
+			memcpy(resp, response, req->responseType->memSize);
+			UA_init(response, req->responseType);
+			if (pClient->_closing) {
+				freeAsyncResponse(req, resp);
+			} else if (pClient->_netThread) {
+				TOpcUA_ClientEvent* ev = new TOpcUA_ClientEvent(TOpcUA_ClientEvent::AsyncResponse);
+				ev->requestId = requestId;
+				ev->userdata = req;
+				ev->response = resp;
+				pClient->_netThread->Post(ev);
+			} else {
+				AsyncResponse r = { requestId, req, resp };
+				pClient->_asyncResponses.push_back(r);
+			}
+		}
+	static void freeAsyncResponse(AsyncRequest* req, void* response) {
+		UA_delete(response, req->responseType);
+		delete req;
+	}
+	// Turn the response into lua values and hand them to the callback as
+	// callback(request_id, results) / callback(request_id, nil, err), or resume the
+	// coroutine with (results) / (nil, err). L is the running lua thread (the one
+	// calling run_iterate/poll), the request may have been sent from a coroutine.
+	void deliverAsyncResponse(lua_State* L, UA_UInt32 requestId, AsyncRequest* req, void* response) {
+		sol::state_view lua(L);
+		sol::object results = sol::make_object(L, sol::lua_nil);
+		UA_StatusCode re = ((UA_ResponseHeader*)response)->serviceResult;     // every response starts with the header
+		if (re == UA_STATUSCODE_GOOD) {
+			if (req->responseType == &UA_TYPES[UA_TYPES_READRESPONSE]) {
+				UA_ReadResponse* rr = (UA_ReadResponse*)response;
+				sol::table values = lua.create_table(rr->resultsSize, 0);
+				for (size_t i = 0; i < rr->resultsSize; ++i) {
+					values[i + 1] = rr->results[i];             // the lua object owns the value from now on
+					UA_DataValue_init(&rr->results[i]);
+				}
+				results = values;
+			} else if (req->responseType == &UA_TYPES[UA_TYPES_WRITERESPONSE]) {
+				UA_WriteResponse* wr = (UA_WriteResponse*)response;
+				sol::table statuses = lua.create_table(wr->resultsSize, 0);
+				for (size_t i = 0; i < wr->resultsSize; ++i)
+					statuses[i + 1] = wr->results[i];
+				results = statuses;
+			} else if (req->responseType == &UA_TYPES[UA_TYPES_CALLRESPONSE]) {
+				UA_CallResponse* cr = (UA_CallResponse*)response;
+				if (cr->resultsSize != 1)
+					re = UA_STATUSCODE_BADUNEXPECTEDERROR;
+				else
+					re = cr->results[0].statusCode;
+				if (re == UA_STATUSCODE_GOOD) {
+					UA_CallMethodResult& mr = cr->results[0];
+					sol::table outputs = lua.create_table(mr.outputArgumentsSize, 0);
+					for (size_t i = 0; i < mr.outputArgumentsSize; ++i) {
+						outputs[i + 1] = mr.outputArguments[i];     // the lua object owns the variant from now on
+						UA_Variant_init(&mr.outputArguments[i]);
+					}
+					results = outputs;
+				}
+			}
+		}
+		req->done.push(L);
+		sol::object done(L, -1);
+		lua_pop(L, 1);
+		freeAsyncResponse(req, response);
+
+		if (done.get_type() == sol::type::function) {
+			sol::function callback = done;
+			if (re == UA_STATUSCODE_GOOD)
+				callback(requestId, results);
+			else
+				callback(requestId, sol::lua_nil, UA_StatusCode_name(re));
+			return;
+		}
+		lua_State* co = done.as<sol::thread>().thread_state();
+		if (lua_status(co) != LUA_YIELD) {
+			XTRACE(XPERRORS, "OPC-UA async request %u: coroutine is not suspended, result dropped", requestId);
+			return;
+		}
+		int nargs = 1;
+		if (re == UA_STATUSCODE_GOOD) {
+			sol::stack::push(co, results);
+		} else {
+			lua_pushnil(co);
+			lua_pushstring(co, UA_StatusCode_name(re));
+			nargs = 2;
+		}
+#if LUA_VERSION_NUM >= 504
+		int nresults = 0;
+		int status = lua_resume(co, L, nargs, &nresults);
+#elif LUA_VERSION_NUM >= 502
+		int status = lua_resume(co, L, nargs);
+#else
+		int status = lua_resume(co, nargs);
+#endif
+		if (status != 0 && status != LUA_YIELD) {
+			XTRACE(XPERRORS, "OPC-UA async request %u: coroutine failed: %s", requestId, lua_tostring(co, -1));
+			lua_pop(co, 1);
+		}
+	}
+	void deliverAsyncResponses(lua_State* L) {
+		std::vector<AsyncResponse> responses;
+		responses.swap(_asyncResponses);        // lua may send new requests meanwhile
+		for (auto & r : responses)
+			deliverAsyncResponse(L, r.requestId, r.request, r.response);
+	}
+	sol::variadic_results sendAsyncRequest(const void* request, const UA_DataType* requestType,
+			const UA_DataType* responseType, sol::object done, sol::this_state L) {
+		if (done.get_type() != sol::type::function && done.get_type() != sol::type::thread)
+			RETURN_ERROR("callback function or coroutine expected")
+		AsyncRequest* req = new AsyncRequest;
+		req->proxy = this;
+		req->responseType = responseType;
+		req->done = done;
+		UA_UInt32 requestId = 0;
+		UA_StatusCode re;
+		{
+			TOpcUA_ClientLock::Guard guard(&_lock);
+			re = __UA_Client_AsyncService(_client, request, requestType, asyncServiceCallback, responseType, req, &requestId);
+		}
+		if (re != UA_STATUSCODE_GOOD) {
+			delete req;
+			RETURN_ERROR(UA_StatusCode_name(re))
+		}
+		RETURN_RESULT(UA_UInt32, requestId)
+	}
 	
 
 	static void
@@ -806,7 +1635,15 @@ protected:
 
 			UA_ClientConfig* cc = UA_Client_getConfig(client);
 			UA_Client_Proxy* pClient = (UA_Client_Proxy*)cc->clientContext;
-			if (pClient->_stateCallback) {
+			pClient->_mgr->resetSessionCache();
+			if (pClient->_netThread) {
+				// never call lua from the network thread, see poll()
+				TOpcUA_ClientEvent* ev = new TOpcUA_ClientEvent(TOpcUA_ClientEvent::StateChange);
+				ev->channelState = channelState;
+				ev->sessionState = sessionState;
+				ev->connectStatus = connectStatus;
+				pClient->_netThread->Post(ev);
+			} else if (pClient->_stateCallback) {
 				pClient->_stateCallback(pClient, channelState, sessionState, connectStatus);
 			}
 		}
@@ -825,12 +1662,23 @@ protected:
 	static void
 		deleteSubscriptionCallback(UA_Client *client, UA_UInt32 subscriptionId, void *subscriptionContext) {
 			UA_LOG_INFO(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, "Subscription Id %u was deleted", subscriptionId);
+			UA_Client_Proxy* pClient = (UA_Client_Proxy*)subscriptionContext;
+			if (pClient->_netThread) {
+				// the maps belong to the lua thread, see poll()
+				TOpcUA_ClientEvent* ev = new TOpcUA_ClientEvent(TOpcUA_ClientEvent::SubscriptionDeleted);
+				ev->subId = subscriptionId;
+				pClient->_netThread->Post(ev);
+			} else {
+				pClient->_deletedSubs.push_back(subscriptionId);
+			}
 		}
 public:
 	UA_ClientConfig_Proxy *_config;
 
 	UA_Client_Proxy() {
 		_stateCallback = nullptr;
+		_netThread = NULL;
+		_closing = false;
 		//_stateCallbackNew = (UA_ClientState)-1;
 		_client = UA_Client_new();
 		if (!_client) {
@@ -844,12 +1692,14 @@ public:
 		cc->stateCallback = &UA_Client_Proxy::clientStateChangeCallback;
 		cc->subscriptionInactivityCallback = &UA_Client_Proxy::subscriptionInactivityCallback;
 
-		_mgr = new ClientNodeMgr(_client);
+		_mgr = new ClientNodeMgr(_client, &_lock);
 		_config = new UA_ClientConfig_Proxy(cc);
 	}
 
 	UA_Client_Proxy(UA_MessageSecurityMode securityMode, const std::string& priCert, const std::string& priKey) {
 		_stateCallback = nullptr;
+		_netThread = NULL;
+		_closing = false;
 		//_stateCallbackNew = (UA_ClientState)-1;
 		/* Load certificate and private key */
 		UA_ByteString certificate = loadFile(priCert.c_str());
@@ -895,13 +1745,23 @@ public:
 		cc->stateCallback = &UA_Client_Proxy::clientStateChangeCallback;
 		cc->subscriptionInactivityCallback = &UA_Client_Proxy::subscriptionInactivityCallback;
 
-		_mgr = new ClientNodeMgr(_client);
+		_mgr = new ClientNodeMgr(_client, &_lock);
 		_config = new UA_ClientConfig_Proxy(cc);
 	}
 
 	~UA_Client_Proxy() {
+		stopNetworkThread();
+		_closing = true;                // pending async requests are cancelled by the library
 		UA_Client_delete(_client);
+		for (auto & r : _asyncResponses)
+			freeAsyncResponse(r.request, r.response);
 		delete _mgr;
+		// drop notifications not delivered
+		for (auto & it : _subBatchMap) {
+			NotificationBuffer& buf = it.second;
+			for (size_t i = 0; i < buf.count; ++i)
+				UA_DataValue_clear(&buf.values[i]);
+		}
 	}
 
 	void setStateCallback(StateCallback callback) {
@@ -918,6 +1778,7 @@ public:
 		UA_SecureChannelState chn_s;
 		UA_SessionState ss_s;
 		UA_StatusCode sc;
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		UA_Client_getState(_client, &chn_s, &ss_s, &sc);
 
 		sol::variadic_results result;
@@ -933,22 +1794,28 @@ public:
 	}
 	*/
 	UA_StatusCode connect(const char* endpoint_url) {
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_connect(_client, endpoint_url);
 	}
 	UA_StatusCode connect_username(const char* endpoint_url, const char* username, const char* password) {
 		//return UA_Client_connect_username(_client, endpoint_url, username, password);
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_connectUsername(_client, endpoint_url, username, password);
 	}
 	UA_StatusCode connectUsername(char* endpoint_url, const char* username, const char* password) {
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_connectUsername(_client, endpoint_url, username, password);
 	}
 	UA_StatusCode disconnect() {
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_disconnect(_client);
 	}
 	UA_StatusCode getEndpoints(const char* serverUrl, size_t* endpointDescriptionsSize, UA_EndpointDescription** endpointDescriptions) {
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_getEndpoints(_client, serverUrl, endpointDescriptionsSize, endpointDescriptions);
 	}
 	UA_StatusCode findServers(const char* serverUrl, size_t serverUrisSize, UA_String* serverUris, size_t localeIdsSize, UA_String* localeIds, size_t* registeredServersSize, UA_ApplicationDescription **registeredServers) {
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		return UA_Client_findServers(_client, serverUrl, serverUrisSize, serverUris, localeIdsSize, localeIds, registeredServersSize, registeredServers);
 	}
 	//UA_StatusCode findServersOnNetwork(
@@ -956,6 +1823,7 @@ public:
 	sol::variadic_results getNamespaceIndex(const char* namespaceUri, sol::this_state L) {
 		UA_UInt16 namespaceIndex = -1;
 		UA_String uri = UA_STRING_ALLOC(namespaceUri);
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		UA_StatusCode re = UA_Client_NamespaceGetIndex(_client, &uri, &namespaceIndex);
 		UA_free(uri.data);
 		RETURN_RESULT(UA_UInt16, namespaceIndex)
@@ -1006,7 +1874,304 @@ public:
 		return deleteNode(node._id, deleteReferences);
 	}
 
-	sol::variadic_results createSubscription(SubscribeCallback callback, sol::this_state L) {
+	// Forget the resolved browse paths (e.g. after the server changed its namespaces)
+	void clearPathCache() {
+		_mgr->clearPathCache();
+	}
+
+	// Like opcua.get_node_data_value_type, but also knows the structure types resolved
+	// by this client (returns their type name)
+	std::string get_node_data_value_type(const UA_NodeId& typeId) {
+		const char* name = lua_opcua::get_node_data_value_type(typeId);
+		if (typeId.namespaceIndex != 0) {
+			const std::string* typeName = _mgr->_db.FindTypeNameById(toString(typeId));
+			if (typeName)
+				return *typeName;
+		}
+		return name;
+	}
+
+	// Export the subtree below root into a NodeSet2 file: the nodes reached by forward hierarchical
+	// references (through all namespaces), except the ones of namespace 0 which are not written.
+	// The tree is walked level by level, each level with batched Browse and Read requests.
+	// Returns the number of nodes written or nil, error
+	sol::variadic_results exportNodeSet(sol::object root, const std::string& path, sol::this_state L) {
+		UA_NodeId rootId;
+		if (!toNodeId(root, &rootId))
+			RETURN_ERROR("invalid node")
+		AttributeReader* reader = _mgr->getAttributeReader();
+
+		// all namespaces of the server, so the node ids are written unchanged
+		std::vector<std::string> namespaceUris;
+		UA_ReadValueId nsItem;
+		UA_ReadValueId_init(&nsItem);
+		nsItem.nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_NAMESPACEARRAY);
+		nsItem.attributeId = UA_ATTRIBUTEID_VALUE;
+		std::vector<UA_DataValue> nsValue;
+		UA_StatusCode re = reader->readAttributes(1, &nsItem, nsValue);
+		if (re != UA_STATUSCODE_GOOD)
+			RETURN_ERROR(UA_StatusCode_name(re))
+		if (UA_Variant_hasArrayType(&nsValue[0].value, &UA_TYPES[UA_TYPES_STRING])) {
+			const UA_String* uris = (const UA_String*)nsValue[0].value.data;
+			for (size_t i = 1; i < nsValue[0].value.arrayLength; ++i)
+				namespaceUris.push_back(str(uris[i]));
+		}
+		UA_DataValue_clear(&nsValue[0]);
+
+		TOpcUA_NodeSetWriter writer;
+		if (!writer.Open(path.c_str(), namespaceUris))
+			RETURN_ERROR("cannot open " + path)
+
+		std::vector<TOpcUA_NodeSetNode*> level(1, new TOpcUA_NodeSetNode());
+		UA_NodeId_copy(&rootId, &level[0]->NodeId);
+		if (rootId.namespaceIndex != 0) {
+			// the root is exported too, with its parent
+			UA_BrowseDescription desc;
+			UA_BrowseDescription_init(&desc);
+			desc.nodeId = rootId;
+			desc.browseDirection = UA_BROWSEDIRECTION_INVERSE;
+			desc.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+			desc.includeSubtypes = true;
+			desc.resultMask = UA_BROWSERESULTMASK_REFERENCETYPEID;
+			std::vector< std::vector<UA_ReferenceDescription> > refs;
+			std::vector<UA_StatusCode> statuses;
+			if (_mgr->browseNodes(1, &desc, refs, statuses) == UA_STATUSCODE_GOOD && !refs[0].empty()) {
+				UA_NodeId_copy(&refs[0][0].nodeId.nodeId, &level[0]->ParentNodeId);
+				level[0]->AddReference(refs[0][0].referenceTypeId, refs[0][0].nodeId.nodeId, false);
+			}
+			for (size_t r = 0; r < refs[0].size(); ++r)
+				UA_ReferenceDescription_clear(&refs[0][r]);
+		}
+
+		static const UA_UInt32 attributes[] = { UA_ATTRIBUTEID_NODECLASS, UA_ATTRIBUTEID_BROWSENAME,
+			UA_ATTRIBUTEID_DISPLAYNAME, UA_ATTRIBUTEID_DATATYPE, UA_ATTRIBUTEID_VALUERANK,
+			UA_ATTRIBUTEID_ACCESSLEVEL, UA_ATTRIBUTEID_VALUE };
+		const size_t attributesSize = sizeof(attributes) / sizeof(attributes[0]);
+		const size_t batchSize = 256;              // nodes per request
+		std::unordered_set<std::string> visited;
+		visited.insert(toString(rootId));
+		size_t written = 0;
+		while (!level.empty()) {
+			std::vector<TOpcUA_NodeSetNode*> next;
+			for (size_t first = 0; first < level.size() && re == UA_STATUSCODE_GOOD; first += batchSize) {
+				size_t count = level.size() - first;
+				if (count > batchSize)
+					count = batchSize;
+				std::vector<UA_BrowseDescription> descs(count);
+				std::vector<UA_ReadValueId> items;
+				for (size_t i = 0; i < count; ++i) {
+					const UA_NodeId& id = level[first + i]->NodeId;
+					initChildrenBrowseDescription(&descs[i], id);
+					if (id.namespaceIndex == 0)
+						continue;   // only browsed, the attributes are not needed
+					for (size_t a = 0; a < attributesSize; ++a) {
+						UA_ReadValueId item;
+						UA_ReadValueId_init(&item);
+						item.nodeId = id;
+						item.attributeId = attributes[a];
+						items.push_back(item);
+					}
+				}
+				std::vector< std::vector<UA_ReferenceDescription> > refs;
+				std::vector<UA_StatusCode> statuses;
+				std::vector<UA_DataValue> values;
+				re = _mgr->browseNodes(count, &descs[0], refs, statuses);
+				if (re == UA_STATUSCODE_GOOD && !items.empty())
+					re = reader->readAttributes(items.size(), &items[0], values);
+				size_t valueIndex = 0;
+				for (size_t i = 0; i < count && re == UA_STATUSCODE_GOOD; ++i) {
+					TOpcUA_NodeSetNode& node = *level[first + i];
+					if (node.NodeId.namespaceIndex != 0) {
+						takeNodeAttributes(node, &values[valueIndex]);
+						valueIndex += attributesSize;
+					}
+					for (size_t r = 0; r < refs[i].size(); ++r) {
+						const UA_ReferenceDescription& rd = refs[i][r];
+						if (rd.nodeId.serverIndex != 0)
+							continue;
+						if (OpcUA_NodeSet::IsHierarchical(rd.referenceTypeId) &&
+								visited.insert(toString(rd.nodeId.nodeId)).second) {
+							// a child, it carries the reference (inverse) to its parent
+							TOpcUA_NodeSetNode* child = new TOpcUA_NodeSetNode();
+							UA_NodeId_copy(&rd.nodeId.nodeId, &child->NodeId);
+							UA_NodeId_copy(&node.NodeId, &child->ParentNodeId);
+							child->AddReference(rd.referenceTypeId, node.NodeId, false);
+							next.push_back(child);
+						} else {
+							node.AddReference(rd.referenceTypeId, rd.nodeId.nodeId, true);
+						}
+					}
+					if (node.NodeId.namespaceIndex != 0 && statuses[i] == UA_STATUSCODE_GOOD) {
+						writer.Write(node);
+						written++;
+					}
+				}
+				for (size_t i = 0; i < refs.size(); ++i)
+					for (size_t r = 0; r < refs[i].size(); ++r)
+						UA_ReferenceDescription_clear(&refs[i][r]);
+				for (size_t i = 0; i < values.size(); ++i)
+					UA_DataValue_clear(&values[i]);
+			}
+			for (size_t i = 0; i < level.size(); ++i)
+				delete level[i];
+			level.swap(next);
+			if (re != UA_STATUSCODE_GOOD) {
+				for (size_t i = 0; i < level.size(); ++i)
+					delete level[i];
+				level.clear();
+			}
+		}
+		if (!writer.Close() && re == UA_STATUSCODE_GOOD)
+			RETURN_ERROR("cannot write " + path)
+		RETURN_RESULT(size_t, written)
+	}
+	// The attributes read by exportNodeSet (in its order), the value is moved to the node
+	void takeNodeAttributes(TOpcUA_NodeSetNode& node, UA_DataValue* v) {
+		if (UA_Variant_hasScalarType(&v[0].value, &UA_TYPES[UA_TYPES_NODECLASS]))
+			node.NodeClass = *(UA_NodeClass*)v[0].value.data;
+		if (UA_Variant_hasScalarType(&v[1].value, &UA_TYPES[UA_TYPES_QUALIFIEDNAME]))
+			UA_QualifiedName_copy((UA_QualifiedName*)v[1].value.data, &node.BrowseName);
+		if (UA_Variant_hasScalarType(&v[2].value, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]))
+			UA_LocalizedText_copy((UA_LocalizedText*)v[2].value.data, &node.DisplayName);
+		if (UA_Variant_hasScalarType(&v[3].value, &UA_TYPES[UA_TYPES_NODEID]))
+			UA_NodeId_copy((UA_NodeId*)v[3].value.data, &node.DataType);
+		if (UA_Variant_hasScalarType(&v[4].value, &UA_TYPES[UA_TYPES_INT32]))
+			node.ValueRank = *(UA_Int32*)v[4].value.data;
+		if (UA_Variant_hasScalarType(&v[5].value, &UA_TYPES[UA_TYPES_BYTE]))
+			node.AccessLevel = *(UA_Byte*)v[5].value.data;
+		if (v[6].hasValue) {
+			node.Value = v[6].value;
+			UA_Variant_init(&v[6].value);
+		}
+	}
+
+	// Register nodes which are used often (e.g. with read/write), returns table of
+	// registered NodeIds (same order) to use instead of the original ones, or nil, error
+	sol::variadic_results registerNodes(sol::table nodes, sol::this_state L) {
+		std::vector<UA_NodeId> ids;
+		ids.reserve(nodes.size());
+		for (size_t i = 1; i <= nodes.size(); ++i) {
+			UA_NodeId id;
+			if (!toNodeId(nodes.get<sol::object>(i), &id))
+				RETURN_ERROR("invalid node")
+			ids.push_back(id);
+		}
+		std::vector<UA_NodeId> registered;
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		if (!ids.empty())
+			re = _mgr->registerNodes(ids.size(), &ids[0], registered);
+		sol::state_view lua(L);
+		sol::table registered_table = lua.create_table(registered.size(), 0);
+		for (size_t i = 0; i < registered.size(); ++i) {
+			registered_table[i + 1] = registered[i];	// the lua object owns the id from now on
+		}
+		RETURN_RESULT(sol::table, registered_table)
+	}
+	sol::variadic_results unregisterNodes(sol::table nodes, sol::this_state L) {
+		std::vector<UA_NodeId> ids;
+		ids.reserve(nodes.size());
+		for (size_t i = 1; i <= nodes.size(); ++i) {
+			UA_NodeId id;
+			if (!toNodeId(nodes.get<sol::object>(i), &id))
+				RETURN_ERROR("invalid node")
+			ids.push_back(id);
+		}
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		if (!ids.empty())
+			re = _mgr->unregisterNodes(ids.size(), &ids[0]);
+		RETURN_RESULT(bool, true)
+	}
+
+	// Read many attributes of many nodes with a single ReadRequest
+	// items: { {node|nodeId, attribute}, node|nodeId, ... } attribute defaults to "Value"
+	// returns table of DataValues (same order as items) or nil, error
+	sol::variadic_results read(sol::table items, sol::this_state L) {
+		std::vector<UA_ReadValueId> ids;
+		if (!toReadValueIds(items, ids))
+			RETURN_ERROR("invalid read item")
+		return readDataValues(_mgr->getAttributeReader(), ids, L);
+	}
+
+	// Write many values with as few WriteRequests as possible (split by the server's MaxNodesPerWrite)
+	// items: { {node|nodeId, Variant|DataValue [, attribute]}, ... } attribute defaults to "Value"
+	// returns table of StatusCodes (same order as items) or nil, error
+	sol::variadic_results write(sol::table items, sol::this_state L) {
+		std::vector<UA_WriteValue> values;
+		if (!toWriteValues(items, values))
+			RETURN_ERROR("invalid write item")
+		std::vector<UA_StatusCode> results;
+		results.reserve(values.size());
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		if (!values.empty()) {
+			re = _mgr->getAttributeWriter()->writeAttributes(values.size(), &values[0], results);
+		}
+		sol::state_view lua(L);
+		sol::table results_table = lua.create_table(results.size(), 0);
+		for (size_t i = 0; i < results.size(); ++i) {
+			results_table[i + 1] = results[i];
+		}
+		// a failed request: the results tell which items were written, plus the error
+		sol::variadic_results result;
+		result.push_back(results_table);
+		if (re != UA_STATUSCODE_GOOD)
+			result.push_back({ L, sol::in_place_type<std::string>, std::string(UA_StatusCode_name(re)) });
+		return result;
+	}
+
+	// Async variants: the request is sent and the request id returned right away (or nil, error).
+	// done is a callback function, called as callback(request_id, results) or callback(request_id, nil, err),
+	// or a (suspended) coroutine, resumed with (results) or (nil, err). Delivered by run_iterate/poll.
+	// items: see read()
+	sol::variadic_results readAsync(sol::table items, sol::object done, sol::this_state L) {
+		std::vector<UA_ReadValueId> ids;
+		if (!toReadValueIds(items, ids) || ids.empty())
+			RETURN_ERROR("invalid read item")
+		UA_ReadRequest request;
+		UA_ReadRequest_init(&request);
+		request.nodesToRead = &ids[0];
+		request.nodesToReadSize = ids.size();
+		return sendAsyncRequest(&request, &UA_TYPES[UA_TYPES_READREQUEST], &UA_TYPES[UA_TYPES_READRESPONSE], done, L);
+	}
+	// items: see write(), sent as one request (not split by MaxNodesPerWrite)
+	sol::variadic_results writeAsync(sol::table items, sol::object done, sol::this_state L) {
+		std::vector<UA_WriteValue> values;
+		if (!toWriteValues(items, values) || values.empty())
+			RETURN_ERROR("invalid write item")
+		UA_WriteRequest request;
+		UA_WriteRequest_init(&request);
+		request.nodesToWrite = &values[0];
+		request.nodesToWriteSize = values.size();
+		return sendAsyncRequest(&request, &UA_TYPES[UA_TYPES_WRITEREQUEST], &UA_TYPES[UA_TYPES_WRITERESPONSE], done, L);
+	}
+	// inputs: table of Variants, results: table of the output Variants
+	sol::variadic_results callAsync(const UA_NodeId& objectId, const UA_NodeId& methodId, sol::table inputs, sol::object done, sol::this_state L) {
+		std::vector<UA_Variant> args;
+		args.reserve(inputs.size());
+		for (size_t i = 1; i <= inputs.size(); ++i) {
+			sol::object input = inputs.get<sol::object>(i);
+			if (!input.is<UA_Variant>())
+				RETURN_ERROR("invalid input argument")
+			args.push_back(input.as<UA_Variant&>());          // shallow copy, owned by lua
+		}
+		UA_CallMethodRequest item;
+		UA_CallMethodRequest_init(&item);
+		item.objectId = objectId;
+		item.methodId = methodId;
+		item.inputArguments = args.empty() ? NULL : &args[0];
+		item.inputArgumentsSize = args.size();
+		UA_CallRequest request;
+		UA_CallRequest_init(&request);
+		request.methodsToCall = &item;
+		request.methodsToCallSize = 1;
+		return sendAsyncRequest(&request, &UA_TYPES[UA_TYPES_CALLREQUEST], &UA_TYPES[UA_TYPES_CALLRESPONSE], done, L);
+	}
+
+	// options (all optional): { publishingInterval = ms, keepAliveCount = n, lifetimeCount = n,
+	//                          maxNotificationsPerPublish = n, priority = n,
+	//                          batch = true, batchSize = n }
+	// callback(mon_id, data_value, sub_id, mon_context [, decoded]) for every notification, in batch mode
+	// callback(sub_id, mon_ids, data_values [, decoded]) once per run_iterate with all notifications received
+	sol::variadic_results createSubscription(sol::function callback, sol::optional<sol::table> options, sol::this_state L) {
 		UA_StatusCode re = -1;
 		if (!this->_client) {
 			RETURN_RESULT(UA_UInt32, -1);
@@ -1014,12 +2179,40 @@ public:
 		/* A new session was created. We need to create the subscription. */
 		/* Create a subscription */
 		UA_CreateSubscriptionRequest request = UA_CreateSubscriptionRequest_default();
+		if (options) {
+			sol::table& opts = *options;
+			request.requestedPublishingInterval = opts.get_or("publishingInterval", request.requestedPublishingInterval);
+			request.requestedMaxKeepAliveCount = opts.get_or("keepAliveCount", request.requestedMaxKeepAliveCount);
+			request.requestedLifetimeCount = opts.get_or("lifetimeCount", request.requestedLifetimeCount);
+			request.maxNotificationsPerPublish = opts.get_or("maxNotificationsPerPublish", request.maxNotificationsPerPublish);
+			request.priority = opts.get_or("priority", request.priority);
+		}
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(this->_client, request,
 				this, statusChangeSubscriptionCallback, deleteSubscriptionCallback);
 
 		re = response.responseHeader.serviceResult;
 		if ( re == UA_STATUSCODE_GOOD) {
-			_subCallbackMap[response.subscriptionId] = callback;
+			if (options && options->get_or("batch", false)) {
+				size_t size = options->get_or("batchSize", (size_t)1000);
+				if (size == 0)
+					size = 1;
+				NotificationBuffer& buf = _subBatchMap[response.subscriptionId];
+				buf.monIds.resize(size);
+				buf.values.resize(size);
+				buf.contexts.resize(size);
+				buf.count = 0;
+				buf.callback = callback;
+			} else {
+				_subCallbackMap[response.subscriptionId] = [this, callback](UA_UInt32 monId, UA_DataValue value, UA_UInt32 subId, void *monContext) {
+					if (monContext) {
+						sol::object decoded = decodeNotification(callback.lua_state(), monContext, value);
+						callback(monId, value, subId, monContext, decoded);
+					} else {
+						callback(monId, value, subId, monContext);
+					}
+				};
+			}
 		}
 		RETURN_RESULT(UA_UInt32, response.subscriptionId);
 	}
@@ -1032,77 +2225,277 @@ public:
 		_subCallbackItems.push_back(item);
 		*/
 
-		UA_DataValue val;
-		UA_DataValue_copy(value, &val);
+		// The value is moved out of the notification (the library clears what is left),
+		// from there it is owned by the event / the lua object.
+		UA_DataValue val = *value;
+		UA_DataValue_init(value);
+		if (_netThread) {
+			// never call lua from the network thread, see poll()
+			TOpcUA_ClientEvent* ev = new TOpcUA_ClientEvent(TOpcUA_ClientEvent::Notification);
+			ev->subId = subId;
+			ev->monId = monId;
+			ev->monContext = monContext;
+			ev->value = val;
+			_netThread->Post(ev);
+			return;
+		}
+		deliverNotification(subId, monId, monContext, val);
+	}
+	// lua thread only, takes the ownership of the value
+	void deliverNotification(UA_UInt32 subId, UA_UInt32 monId, void *monContext, UA_DataValue& val) {
+		auto bptr = _subBatchMap.find(subId);
+		if (bptr != _subBatchMap.end()) {
+			NotificationBuffer& buf = bptr->second;
+			if (buf.count == buf.values.size())
+				flushNotifications(subId, buf);
+			buf.monIds[buf.count] = monId;
+			buf.values[buf.count] = val;
+			buf.contexts[buf.count] = monContext;
+			buf.count++;
+			return;
+		}
 		auto ptr = _subCallbackMap.find(subId);
 		if (ptr != _subCallbackMap.end()) {
 			(ptr->second)(monId, val, subId, monContext);
 		} else {
 			UA_LOG_INFO(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, "Cannot find %u was deleted", subId);
+			UA_DataValue_clear(&val);
 		}
 	}
 
-	sol::variadic_results subscribeNode(UA_UInt32 sub_id, const UA_NodeId& nodeId, sol::this_state L) {
+	// typeName (optional): data type name as returned by node:resolveExtensionObjectType(),
+	// the structure values are then decoded to a lua table and passed to the callback too
+	sol::variadic_results subscribeNode(UA_UInt32 sub_id, const UA_NodeId& nodeId, sol::optional<std::string> typeName, sol::this_state L) {
+		void* context = NULL;
+		if (typeName) {
+			context = findNotificationType(*typeName);
+			if (!context)
+				RETURN_ERROR("Type not found!")
+		}
 		/* Add a MonitoredItem */
 		UA_MonitoredItemCreateRequest monRequest =
 			UA_MonitoredItemCreateRequest_default(nodeId);
 
+		TOpcUA_ClientLock::Guard guard(&_lock);
 		UA_MonitoredItemCreateResult monResponse =
 			UA_Client_MonitoredItems_createDataChange(this->_client, sub_id,
-					UA_TIMESTAMPSTORETURN_BOTH, monRequest, NULL,
+					UA_TIMESTAMPSTORETURN_BOTH, monRequest, context,
 					handler_MonitoredItemChanged, handler_MonitoredItemDeleted);
 
 		UA_StatusCode re = monResponse.statusCode;
 		RETURN_RESULT(UA_UInt32, monResponse.monitoredItemId)
 	}
 
+	// Create many monitored items with one CreateMonitoredItems request
+	// items: { {node|nodeId, samplingMs, queueSize, absDeadband, typeName}, node|nodeId, ... }
+	//   samplingMs, queueSize, absDeadband and typeName are optional (default: 250 ms sampling as
+	//   UA_MonitoredItemCreateRequest_default, -1 for the publishing interval; queue size 1, no deadband,
+	//   no decoding - see subscribeNode)
+	// returns table of monitored item ids, table of status codes (both in the same order as items) or nil, error
+	sol::variadic_results subscribeNodes(UA_UInt32 sub_id, sol::table items, sol::this_state L) {
+		size_t count = items.size();
+		std::vector<UA_MonitoredItemCreateRequest> monRequests;
+		std::vector<UA_DataChangeFilter> filters(count);     // referenced by the requests, no reallocation!
+		std::vector<void*> contexts(count, (void*)NULL);
+		monRequests.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			sol::object entry = items.get<sol::object>(i + 1);
+			UA_NodeId nodeId;
+			sol::optional<sol::table> item;
+			if (entry.get_type() == sol::type::table) {
+				item = entry.as<sol::table>();
+				if (!toNodeId(item->get<sol::object>(1), &nodeId))
+					RETURN_ERROR("invalid subscribe item")
+			} else if (!toNodeId(entry, &nodeId)) {
+				RETURN_ERROR("invalid subscribe item")
+			}
+			UA_MonitoredItemCreateRequest monRequest = UA_MonitoredItemCreateRequest_default(nodeId);
+			if (item) {
+				UA_MonitoringParameters& params = monRequest.requestedParameters;
+				params.samplingInterval = item->get_or(2, params.samplingInterval);
+				params.queueSize = item->get_or(3, params.queueSize);
+				sol::optional<UA_Double> deadband = item->get<sol::optional<UA_Double> >(4);
+				if (deadband) {
+					UA_DataChangeFilter& filter = filters[i];
+					UA_DataChangeFilter_init(&filter);
+					filter.trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+					filter.deadbandType = UA_DEADBANDTYPE_ABSOLUTE;
+					filter.deadbandValue = *deadband;
+					UA_ExtensionObject_setValue(&params.filter, &filter, &UA_TYPES[UA_TYPES_DATACHANGEFILTER]);
+				}
+				sol::optional<std::string> typeName = item->get<sol::optional<std::string> >(5);
+				if (typeName) {
+					contexts[i] = findNotificationType(*typeName);
+					if (!contexts[i])
+						RETURN_ERROR("Type not found!")
+				}
+			}
+			monRequests.push_back(monRequest);
+		}
+
+		std::vector<UA_Client_DataChangeNotificationCallback> callbacks(count, handler_MonitoredItemChanged);
+		std::vector<UA_Client_DeleteMonitoredItemCallback> deleteCallbacks(count, handler_MonitoredItemDeleted);
+		sol::state_view lua(L);
+		sol::table ids = lua.create_table(count, 0);
+		sol::table statuses = lua.create_table(count, 0);
+		sol::variadic_results result;
+		if (count == 0) {
+			result.push_back({ L, sol::in_place_type<sol::table>, ids});
+			result.push_back({ L, sol::in_place_type<sol::table>, statuses});
+			return result;
+		}
+
+		UA_CreateMonitoredItemsRequest request;
+		UA_CreateMonitoredItemsRequest_init(&request);
+		request.subscriptionId = sub_id;
+		request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+		request.itemsToCreate = &monRequests[0];
+		request.itemsToCreateSize = count;
+		UA_CreateMonitoredItemsResponse response;
+		{
+			TOpcUA_ClientLock::Guard guard(&_lock);
+			response = UA_Client_MonitoredItems_createDataChanges(this->_client, request,
+				&contexts[0], &callbacks[0], &deleteCallbacks[0]);
+		}
+		UA_StatusCode re = response.responseHeader.serviceResult;
+		if (re == UA_STATUSCODE_GOOD && response.resultsSize != count)
+			re = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		if (re == UA_STATUSCODE_GOOD) {
+			for (size_t i = 0; i < count; ++i) {
+				ids[i + 1] = response.results[i].monitoredItemId;
+				statuses[i + 1] = response.results[i].statusCode;
+			}
+		}
+		UA_CreateMonitoredItemsResponse_clear(&response);
+		if (re != UA_STATUSCODE_GOOD)
+			RETURN_ERROR(UA_StatusCode_name(re))
+
+		result.push_back({ L, sol::in_place_type<sol::table>, ids});
+		result.push_back({ L, sol::in_place_type<sol::table>, statuses});
+		return result;
+	}
+
 	sol::variadic_results callMethod(const UA_NodeId& objectId, const UA_NodeId& methodId, sol::variadic_args args, sol::this_state L) {
 		size_t inputSize = args.size();
 		size_t outputSize = 0;
-		UA_Variant *inputs = new UA_Variant[inputSize];
-		UA_Variant *outputs;
+		std::vector<UA_Variant> inputs(inputSize);
+		UA_Variant *outputs = NULL;
 		sol::variadic_results result;
 
-		// Copy the inputs
+		// The inputs are owned by lua and only used during the call (shallow copies)
 		for (int i = 0; i < inputSize; ++i) {
-			UA_Variant_init(inputs + i);
-			UA_Variant* v = args.get<UA_Variant*>(i);
-			UA_Variant_copy(v, inputs + i);
+			inputs[i] = *args.get<UA_Variant*>(i);
 		}
 
 		/// Call object method
-		UA_StatusCode re = _mgr->callMethod(objectId, methodId, inputSize, inputs, &outputSize, &outputs);
-
-		// Free input array
-		for (int i = 0; i < inputSize; ++i) {
-			UA_Variant_clear(inputs + i);
-		}
-		delete [] inputs;
+		UA_StatusCode re = _mgr->callMethod(objectId, methodId, inputSize, inputSize ? &inputs[0] : NULL, &outputSize, &outputs);
 
 		// Check the returns
 		if (re == UA_STATUSCODE_GOOD) {
 			// Push the output size
 			result.push_back({ L, sol::in_place_type<size_t>, outputSize});
-			// Push all output items
+			// Push all output items, lua owns them from now on
 			for (int i = 0; i < outputSize; ++i) {
-				UA_Variant var;
-				UA_Variant_copy(outputs + i, &var);
-				result.push_back({ L, sol::in_place_type<UA_Variant>, var});
+				result.push_back({ L, sol::in_place_type<UA_Variant>, outputs[i]});
 			}
+			// Free the outputs array which is constructed inside the library, not the
+			// items (a method without outputs returns the empty array sentinel)
+			UA_Array_delete(outputs, 0, &UA_TYPES[UA_TYPES_VARIANT]);
 		} else {
 			// Push the error message
 			result.push_back({ L, sol::in_place_type<sol::lua_nil_t>, sol::lua_nil_t()});
 			result.push_back({ L, sol::in_place_type<std::string>, std::string(UA_StatusCode_name(re))});
 		}
 
-		// Free the outputs array which is contrustured inside the library.
-		UA_Array_delete(outputs, outputSize, &UA_TYPES[UA_TYPES_VARIANT]);
+		return result;
+	}
 
+	// Call many methods with a single CallRequest
+	// calls: { {object, method, arg1, arg2, ...}, ... } object/method are nodes or NodeIds, the
+	// arguments Variants, plain lua values or tables for arrays (converted to the type of the method's input
+	// argument, the InputArguments are read once per method and cached for the session)
+	// returns table of output tables (each a table of Variants) and table of StatusCodes
+	// (same order as calls), or nil, error
+	sol::variadic_results callMethods(sol::table calls, sol::this_state L) {
+		size_t count = calls.size();
+		std::vector<UA_CallMethodRequest> requests(count);
+		std::vector<UA_NodeId> methods(count);
+		for (size_t i = 0; i < count; ++i) {
+			sol::object entry = calls.get<sol::object>(i + 1);
+			UA_CallMethodRequest_init(&requests[i]);
+			if (entry.get_type() != sol::type::table ||
+				!toNodeId(entry.as<sol::table>().get<sol::object>(1), &requests[i].objectId) ||
+				!toNodeId(entry.as<sol::table>().get<sol::object>(2), &requests[i].methodId))
+				RETURN_ERROR("invalid call item")
+			methods[i] = requests[i].methodId;
+		}
+		if (count == 0)
+			RETURN_ERROR("no calls")
+
+		// The argument types are only needed for plain lua values
+		std::vector< std::vector<const UA_DataType*> > types;
+		bool plain = false;
+		for (size_t i = 0; i < count && !plain; ++i) {
+			sol::table item = calls.get<sol::table>(i + 1);
+			for (size_t a = 3; a <= item.size() && !plain; ++a)
+				plain = !item.get<sol::object>(a).is<UA_Variant>();
+		}
+		if (plain)
+			_mgr->getInputArgumentTypes(count, &methods[0], types);
+
+		// Variants are used as they are (owned by lua), plain values are converted
+		std::vector< std::vector<UA_Variant> > inputs(count);
+		std::vector<UA_Variant*> converted;
+		bool valid = true;
+		for (size_t i = 0; i < count && valid; ++i) {
+			sol::table item = calls.get<sol::table>(i + 1);
+			size_t argsSize = item.size() >= 2 ? item.size() - 2 : 0;
+			inputs[i].resize(argsSize);
+			for (size_t a = 0; a < argsSize && valid; ++a) {
+				sol::object arg = item.get<sol::object>(a + 3);
+				if (arg.is<UA_Variant>()) {
+					inputs[i][a] = arg.as<UA_Variant&>();
+				} else {
+					const UA_DataType* type = (plain && a < types[i].size()) ? types[i][a] : NULL;
+					valid = variantFromLua(arg, type, &inputs[i][a]);
+					converted.push_back(&inputs[i][a]);
+				}
+			}
+			requests[i].inputArguments = argsSize ? &inputs[i][0] : NULL;
+			requests[i].inputArgumentsSize = argsSize;
+		}
+		std::vector<UA_CallMethodResult> results;
+		UA_StatusCode re = valid ? _mgr->callMethods(count, &requests[0], results) : UA_STATUSCODE_BADTYPEMISMATCH;
+		for (size_t k = 0; k < converted.size(); ++k) {
+			UA_Variant_clear(converted[k]);
+		}
+		if (re != UA_STATUSCODE_GOOD)
+			RETURN_ERROR(UA_StatusCode_name(re))
+
+		sol::state_view lua(L);
+		sol::table outputs_table = lua.create_table(count, 0);
+		sol::table statuses_table = lua.create_table(count, 0);
+		for (size_t i = 0; i < results.size(); ++i) {
+			UA_CallMethodResult& res = results[i];
+			sol::table outputs = lua.create_table(res.outputArgumentsSize, 0);
+			for (size_t o = 0; o < res.outputArgumentsSize; ++o) {
+				outputs[o + 1] = res.outputArguments[o];    // lua owns the output from now on
+			}
+			UA_Array_delete(res.outputArguments, 0, &UA_TYPES[UA_TYPES_VARIANT]);   // may be the sentinel
+			res.outputArguments = NULL;
+			res.outputArgumentsSize = 0;
+			outputs_table[i + 1] = outputs;
+			statuses_table[i + 1] = res.statusCode;
+			UA_CallMethodResult_clear(&res);
+		}
+		sol::variadic_results result;
+		result.push_back({ L, sol::in_place_type<sol::table>, outputs_table});
+		result.push_back({ L, sol::in_place_type<sol::table>, statuses_table});
 		return result;
 	}
 
 
-	UA_UInt16 run_iterate(UA_UInt32 waitInternal) {
+	UA_UInt16 run_iterate(UA_UInt32 waitInternal, sol::this_state L) {
 		/*
 		UA_UInt32 last = 0;
 		UA_StatusCode re;
@@ -1135,7 +2528,80 @@ public:
 
 		return re;
 		*/
-		return UA_Client_run_iterate(this->_client, waitInternal);
+		if (_netThread) {
+			// the network thread does the work, just wait for its events
+			_netThread->WaitForEvents(waitInternal);
+			poll(L);
+			return _netThread->GetLastStatus();
+		}
+		UA_StatusCode re = UA_Client_run_iterate(this->_client, waitInternal);
+		deliverAsyncResponses(L);
+		// deliver the notifications collected in batch mode
+		for (auto & it : _subBatchMap)
+			flushNotifications(it.first, it.second);
+		pruneSubscriptions();
+		return re;
+	}
+
+	// Run the network processing (keep alive, publish, reconnect) in a background thread,
+	// every intervalMs (default 10). The callbacks are called by poll() (or run_iterate)
+	// in the lua thread.
+	sol::variadic_results startNetworkThread(sol::optional<UA_UInt32> intervalMs, sol::this_state L) {
+		if (_netThread)
+			RETURN_ERROR("network thread already running")
+		_netThread = new TOpcUA_NetworkThread(_client, &_lock, intervalMs ? *intervalMs : 10);
+		_netThread->Start();
+		RETURN_OK(bool, true)
+	}
+	void stopNetworkThread() {
+		if (!_netThread)
+			return;
+		_netThread->Terminate();
+		_netThread->WaitFor();
+		TOpcUA_NetworkThread* thread = _netThread;
+		_netThread = NULL;
+		// drop the events not polled
+		TOpcUA_ClientEvent* ev;
+		while ((ev = thread->Fetch()) != NULL) {
+			if (ev->type == TOpcUA_ClientEvent::AsyncResponse)
+				freeAsyncResponse((AsyncRequest*)ev->userdata, ev->response);
+			else if (ev->type == TOpcUA_ClientEvent::SubscriptionDeleted)
+				_deletedSubs.push_back(ev->subId);
+			delete ev;
+		}
+		delete thread;
+	}
+	// Deliver the events queued by the network thread (subscription and state callbacks),
+	// returns the number of events
+	size_t poll(sol::this_state L) {
+		if (!_netThread)
+			return 0;
+		size_t count = 0;
+		TOpcUA_ClientEvent* ev;
+		while ((ev = _netThread->Fetch()) != NULL) {
+			if (ev->type == TOpcUA_ClientEvent::Notification) {
+				UA_DataValue val = ev->value;
+				UA_DataValue_init(&ev->value);
+				deliverNotification(ev->subId, ev->monId, ev->monContext, val);
+			} else if (ev->type == TOpcUA_ClientEvent::AsyncResponse) {
+				deliverAsyncResponse(L, ev->requestId, (AsyncRequest*)ev->userdata, ev->response);
+			} else if (ev->type == TOpcUA_ClientEvent::SubscriptionDeleted) {
+				_deletedSubs.push_back(ev->subId);
+			} else if (_stateCallback) {
+				_stateCallback(this, ev->channelState, ev->sessionState, ev->connectStatus);
+			}
+			delete ev;
+			count++;
+		}
+		deliverAsyncResponses(L);           // received before the thread was started
+		for (auto & it : _subBatchMap)
+			flushNotifications(it.first, it.second);
+		pruneSubscriptions();
+		return count;
+	}
+	// Socket which is readable while events are pending (for external event loops), -1 without network thread
+	int getPollFd() {
+		return _netThread ? _netThread->GetPollFd() : -1;
 	}
 
 	// returns table, bytestring, state or nil, nil, state
@@ -1287,6 +2753,7 @@ class UA_ClientConfig_Proxy_CyclicIO {
 protected:
 	friend class UA_Client_Proxy;
 	friend class UA_Client_CyclicIO;
+	friend class UA_ClientPool_Proxy;
 
 	UA_ClientConfig_Proxy_CyclicIO(IOThread_Params *params) : _params(params) {
 		_params->logger = (UA_Logger *)&XTraceLogger_;
@@ -1298,6 +2765,15 @@ public:
 	void setSecureChannelLifeTime(int time) {
 		_params->secureChannelLifeTime = time;
 	}
+	// The reconnect delay doubles with every failed attempt from minMs up to maxMs
+	void setReconnectDelay(int minMs, int maxMs) {
+		_params->reconnectMinMs = minMs;
+		_params->reconnectMaxMs = maxMs;
+	}
+	// Wait before the client is recreated after a severe error
+	void setSevereErrorCooldown(int ms) {
+		_params->severeCooldownMs = ms;
+	}
 #if 0
 	void setProductURI(const std::string& uri) {
 		/*
@@ -1364,9 +2840,14 @@ public:
         delete _ioThread;
 	}
 
+	// The getters and setters of the process image are called every cycle, so they are
+	// bound as raw lua_CFunctions (see RAW_SELF) and push their results directly.
+
 	// return true if cyclic IO is running, else false
-	bool getState(sol::this_state L) {
-		return _ioThread->IsCyclicIoRunning();
+	static int getState(lua_State* L) {
+		RAW_SELF(UA_Client_CyclicIO, self)
+		lua_pushboolean(L, self->_ioThread->IsCyclicIoRunning());
+		return 1;
 	}
 
 	sol::variadic_results getClientState(sol::this_state L) {
@@ -1386,98 +2867,69 @@ public:
 
 	// returns bytestring, state or nil, state
 	//
-	sol::variadic_results getInputsRaw(sol::this_state L) {
-
-		sol::variadic_results result;
-
+	static int getInputsRaw(lua_State* L) {
+		RAW_SELF(UA_Client_CyclicIO, self)
 		UA_ByteString bs;
 		UA_ByteString_init(&bs);
-		UA_StatusCode retval = _ioThread->GetInputs(&bs);
-		result.push_back({ L, sol::in_place_type<std::string>, std::string((const char*)bs.data, bs.length)});
-		result.push_back({ L, sol::in_place_type<uint32_t>, retval});
+		UA_StatusCode retval = self->_ioThread->GetInputs(&bs);
+		lua_pushlstring(L, (const char*)bs.data, bs.length);
+		sol::stack::push(L, retval);
 		UA_ByteString_clear(&bs);
-		return result;
+		return 2;
 	}
 
 	// returns last write state
 	//
-	uint32_t setOutputsRaw(std::string newValue, sol::this_state L) {
+	static int setOutputsRaw(lua_State* L) {
+		RAW_SELF(UA_Client_CyclicIO, self)
+		size_t len = 0;
+		const char* data = luaL_checklstring(L, 2, &len);
 		UA_ByteString bs;
 		UA_ByteString_init(&bs);
-		bs.data = (UA_Byte*)newValue.c_str();
-		bs.length = newValue.length();
-		UA_StatusCode retval = _ioThread->SetOutputs(&bs);
-		return retval;
+		bs.data = (UA_Byte*)data;
+		bs.length = len;
+		UA_StatusCode retval = self->_ioThread->SetOutputs(&bs);
+		sol::stack::push(L, retval);
+		return 1;
 	}
 
-	// returns table, bytestring, state or nil, nil, state
+	// returns table, bytestring, state or nil, bytestring, state
 	//
-	sol::variadic_results getInputs(sol::this_state L) {
-
-		sol::variadic_results result;
-
+	static int getInputs(lua_State* L) {
+		RAW_SELF(UA_Client_CyclicIO, self)
 		UA_ByteString bs;
 		UA_ByteString_init(&bs);
-		UA_StatusCode retval = _ioThread->GetInputs(&bs);
-		const he::Symbols::TypeNode& symDef = _ioThread->GetSymDefRd();
-		if (symDef.item.isValid) {
-			if (retval == UA_STATUSCODE_GOOD && _ioThread->IsCyclicIoRunning() && bs.data /*&& symDef.item.isValid()*/) {
-	//			// dump again? first the data structure definition, then the data
-	//			he::lua::Serializer::Dump(symDef);
-				// deserialize the results into a new table at TOS
-				he::lua::Serializer::Deserialize(L, _ioThread->GetDB(), symDef, bs.data, bs.length);
-				// wrap the native LUA table in a sol::table to return it through the variadic_result vector
-				sol::table table(L, -1);
-				result.push_back(table);
-				lua_pop(L,1);                       // remove the table created earlier from the LUA stack
-			}
-			else {
-				result.push_back({ L, sol::lua_nil });
-			}
-		}
-		else {
-			// fallback to raw I/O only
-			result.push_back({ L, sol::lua_nil });
-		}
-		result.push_back({ L, sol::in_place_type<std::string>, std::string((const char*)bs.data, bs.length)});
-		result.push_back({ L, sol::in_place_type<uint32_t>, retval});
-
+		UA_StatusCode retval = self->_ioThread->GetInputs(&bs);
+		self->pushImage(L, self->_ioThread->GetSymDefRd(), retval, bs);
 		UA_ByteString_clear(&bs);
-		return result;
+		return 3;
 	}
-	// returns table, bytestring, state or nil, nil, state
+	// returns table, bytestring, state or nil, bytestring, state
 	//
-	sol::variadic_results getOutputs(sol::this_state L) {
-
-		sol::variadic_results result;
-
+	static int getOutputs(lua_State* L) {
+		RAW_SELF(UA_Client_CyclicIO, self)
 		UA_ByteString bs;
 		UA_ByteString_init(&bs);
-		UA_StatusCode retval = _ioThread->GetOutputs(&bs);
-		const he::Symbols::TypeNode& symDef = _ioThread->GetSymDefWr();
-		if (symDef.item.isValid) {
-			if (retval == UA_STATUSCODE_GOOD && _ioThread->IsCyclicIoRunning() && bs.data /*&& symDef.item.isValid()*/) {
-				// deserialize the results into a new table at TOS
-				he::lua::Serializer::Deserialize(L, _ioThread->GetDB(), symDef, bs.data, bs.length);
-				// wrap the native LUA table in a sol::table to return it through the variadic_result vector
-				sol::table table(L, -1);
-				result.push_back(table);
-				lua_pop(L,1);                       // remove the table created earlier from the LUA stack
-			}
-			else {
-				result.push_back({ L, sol::lua_nil });
+		UA_StatusCode retval = self->_ioThread->GetOutputs(&bs);
+		self->pushImage(L, self->_ioThread->GetSymDefWr(), retval, bs);
+		UA_ByteString_clear(&bs);
+		return 3;
+	}
+	// push the deserialized table (or nil), the bytestring and the state
+	void pushImage(lua_State* L, const he::Symbols::TypeNode& symDef, UA_StatusCode retval, const UA_ByteString& bs) {
+		if (symDef.item.isValid() && retval == UA_STATUSCODE_GOOD && _ioThread->IsCyclicIoRunning() && bs.data) {
+			// deserialize the results into a new table at TOS
+			if (he::lua::Serializer::Deserialize(L, _ioThread->GetDB(), symDef, bs.data, bs.length) != 1) {
+				lua_pop(L, 2);                      // nil, error
+				lua_pushnil(L);
 			}
 		}
 		else {
-			// fallback to raw I/O only
-			result.push_back({ L, sol::lua_nil });
+			// no valid symbol definition: fallback to raw I/O only
+			lua_pushnil(L);
 		}
-
-		result.push_back({ L, sol::in_place_type<std::string>, std::string((const char*)bs.data, bs.length)});
-		result.push_back({ L, sol::in_place_type<uint32_t>, retval});
-
-		UA_ByteString_clear(&bs);
-		return result;
+		lua_pushlstring(L, (const char*)bs.data, bs.length);
+		sol::stack::push(L, retval);            // an integer, as the status codes of the other calls
 	}
 
 	// Get input variable type definition in internal (userdata) representation
@@ -1666,6 +3118,174 @@ public:
 	}
 */
 };
+
+// Many client sessions (e.g. one per PLC) connected and kept alive by a few worker
+// threads, see TOpcUA_ClientPool. Lua accesses the sessions by name.
+class UA_ClientPool_Proxy {
+protected:
+	IOThread_Params _params;
+	TOpcUA_ClientPool* _pool;
+
+	// Node managers of the sessions (lua thread only), recreated with the client or
+	// after a reconnect, so the session caches are dropped
+	struct SessionMgr {
+		SessionMgr() : client(NULL), connects(0), mgr(NULL) {}
+		UA_Client* client;
+		uint32_t connects;
+		ClientNodeMgr* mgr;
+	};
+	std::map<std::string, SessionMgr> _mgrs;
+
+	// session lock must be held
+	ClientNodeMgr* getNodeMgr(TOpcUA_PoolSession* session) {
+		TOpcUA_PoolSession::Stats stats;
+		session->GetStats(stats);
+		SessionMgr& m = _mgrs[session->Name];
+		if (m.mgr && (m.client != session->Client || m.connects != stats.cntConnects)) {
+			delete m.mgr;
+			m.mgr = NULL;
+		}
+		if (!m.mgr) {
+			m.mgr = new ClientNodeMgr(session->Client, &session->Lock);
+			m.client = session->Client;
+			m.connects = stats.cntConnects;
+		}
+		return m.mgr;
+	}
+	void init(int workers, int intervalMs) {
+		_config = new UA_ClientConfig_Proxy_CyclicIO(&_params);
+		_pool = new TOpcUA_ClientPool(&_params, workers, intervalMs);
+	}
+public:
+	UA_ClientConfig_Proxy_CyclicIO *_config;
+
+	UA_ClientPool_Proxy() {
+		init(2, 10);
+	}
+	UA_ClientPool_Proxy(int workers) {
+		init(workers, 10);
+	}
+	UA_ClientPool_Proxy(int workers, int intervalMs) {
+		init(workers, intervalMs);
+	}
+	~UA_ClientPool_Proxy() {
+		for (auto & it : _mgrs)
+			delete it.second.mgr;
+		delete _pool;
+		delete _config;
+	}
+
+	// Add a session, it is connected (and reconnected) in the background
+	sol::variadic_results add(const std::string& name, const std::string& url,
+			sol::optional<std::string> username, sol::optional<std::string> password, sol::this_state L) {
+		if (!_pool->Add(name, url, username ? *username : "", password ? *password : ""))
+			RETURN_ERROR("session exists")
+		RETURN_OK(bool, true)
+	}
+	bool remove(const std::string& name) {
+		auto it = _mgrs.find(name);
+		if (it != _mgrs.end()) {
+			delete it->second.mgr;
+			_mgrs.erase(it);
+		}
+		return _pool->Remove(name);
+	}
+	// returns connected, channel state, session state, last error or nil, error
+	sol::variadic_results getState(const std::string& name, sol::this_state L) {
+		TOpcUA_PoolSession* session = _pool->Find(name);
+		if (!session)
+			RETURN_ERROR("unknown session")
+		UA_SecureChannelState chn_s = UA_SECURECHANNELSTATE_CLOSED;
+		UA_SessionState ss_s = UA_SESSIONSTATE_CLOSED;
+		UA_StatusCode sc;
+		TOpcUA_PoolSession::Stats stats;
+		TOpcUA_ClientLock::Guard guard(&session->Lock);
+		if (session->Client)
+			UA_Client_getState(session->Client, &chn_s, &ss_s, &sc);
+		session->GetStats(stats);
+
+		sol::variadic_results result;
+		result.push_back({ L, sol::in_place_type<bool>, session->IsConnected()});
+		result.push_back({ L, sol::in_place_type<UA_SecureChannelState>, chn_s});
+		result.push_back({ L, sol::in_place_type<UA_SessionState>, ss_s});
+		result.push_back({ L, sol::in_place_type<UA_StatusCode>, stats.lastError});
+		return result;
+	}
+	// Same as client:read / client:write on the named session, nil, error if it is not connected
+	sol::variadic_results read(const std::string& name, sol::table items, sol::this_state L) {
+		TOpcUA_PoolSession* session = _pool->Find(name);
+		if (!session)
+			RETURN_ERROR("unknown session")
+		std::vector<UA_ReadValueId> ids;
+		if (!toReadValueIds(items, ids))
+			RETURN_ERROR("invalid read item")
+		// hold the lock for the whole request, the worker leaves the session alone meanwhile
+		TOpcUA_ClientLock::Guard guard(&session->Lock);
+		if (!session->IsConnected())
+			RETURN_ERROR("not connected")
+		return readDataValues(getNodeMgr(session)->getAttributeReader(), ids, L);
+	}
+	sol::variadic_results write(const std::string& name, sol::table items, sol::this_state L) {
+		TOpcUA_PoolSession* session = _pool->Find(name);
+		if (!session)
+			RETURN_ERROR("unknown session")
+		std::vector<UA_WriteValue> values;
+		if (!toWriteValues(items, values))
+			RETURN_ERROR("invalid write item")
+		TOpcUA_ClientLock::Guard guard(&session->Lock);
+		if (!session->IsConnected())
+			RETURN_ERROR("not connected")
+		std::vector<UA_StatusCode> results;
+		results.reserve(values.size());
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		if (!values.empty())
+			re = getNodeMgr(session)->getAttributeWriter()->writeAttributes(values.size(), &values[0], results);
+		sol::state_view lua(L);
+		sol::table results_table = lua.create_table(results.size(), 0);
+		for (size_t i = 0; i < results.size(); ++i) {
+			results_table[i + 1] = results[i];
+		}
+		// a failed request: the results tell which items were written, plus the error
+		sol::variadic_results result;
+		result.push_back(results_table);
+		if (re != UA_STATUSCODE_GOOD)
+			result.push_back({ L, sol::in_place_type<std::string>, std::string(UA_StatusCode_name(re)) });
+		return result;
+	}
+	// Health of all sessions: { sessions, connected, connecting, waiting, connects, failures }
+	sol::table getStats(sol::this_state L) {
+		TOpcUA_ClientPool::Stats stats;
+		_pool->GetStats(stats);
+		sol::state_view lua(L);
+		sol::table t = lua.create_table(0, 6);
+		t["sessions"] = stats.cntSessions;
+		t["connected"] = stats.cntConnected;
+		t["connecting"] = stats.cntConnecting;
+		t["waiting"] = stats.cntWaiting;
+		t["connects"] = stats.cntConnects;
+		t["failures"] = stats.cntFailures;
+		return t;
+	}
+	// { state, connects, failures, lastError, msLastConnect } or nil, error
+	sol::variadic_results getSessionStats(const std::string& name, sol::this_state L) {
+		TOpcUA_PoolSession* session = _pool->Find(name);
+		if (!session)
+			RETURN_ERROR("unknown session")
+		TOpcUA_PoolSession::Stats stats;
+		{
+			TOpcUA_ClientLock::Guard guard(&session->Lock);
+			session->GetStats(stats);
+		}
+		sol::state_view lua(L);
+		sol::table t = lua.create_table(0, 5);
+		t["state"] = stats.state;
+		t["connects"] = stats.cntConnects;
+		t["failures"] = stats.cntFailures;
+		t["lastError"] = stats.lastError;
+		t["msLastConnect"] = stats.msLastConnect;
+		RETURN_OK(sol::table, t)
+	}
+};
 // =============================================================================
 
 
@@ -1723,6 +3343,7 @@ void reg_opcua_client(sol::table& module) {
 		"getEndpoints", &UA_Client_Proxy::getEndpoints,
 		"findServers", &UA_Client_Proxy::findServers,
 		"getNamespaceIndex", &UA_Client_Proxy::getNamespaceIndex,
+		"exportNodeSet", &UA_Client_Proxy::exportNodeSet,
 		"getNodeMgr", &UA_Client_Proxy::getNodeMgr,
 		"getObjectsNode", &UA_Client_Proxy::getObjectsNode,
 		"getTypesNode", &UA_Client_Proxy::getTypesNode,
@@ -1739,11 +3360,26 @@ void reg_opcua_client(sol::table& module) {
 			static_cast<UA_StatusCode (UA_Client_Proxy::*)(const UA_NodeId&, bool) >(&UA_Client_Proxy::deleteNode),
 			static_cast<UA_StatusCode (UA_Client_Proxy::*)(const UA_Node&, bool) >(&UA_Client_Proxy::deleteNode)
 		),
+		"clearPathCache", &UA_Client_Proxy::clearPathCache,
+		"registerNodes", &UA_Client_Proxy::registerNodes,
+		"unregisterNodes", &UA_Client_Proxy::unregisterNodes,
+		"read", &UA_Client_Proxy::read,
+		"write", &UA_Client_Proxy::write,
+		"readAsync", &UA_Client_Proxy::readAsync,
+		"writeAsync", &UA_Client_Proxy::writeAsync,
+		"callAsync", &UA_Client_Proxy::callAsync,
 		"createSubscription", &UA_Client_Proxy::createSubscription,
 		"subscribeNode", &UA_Client_Proxy::subscribeNode,
+		"subscribeNodes", &UA_Client_Proxy::subscribeNodes,
 		"callMethod", &UA_Client_Proxy::callMethod,
+		"callMethods", &UA_Client_Proxy::callMethods,
 		"run_iterate", &UA_Client_Proxy::run_iterate,
+		"startNetworkThread", &UA_Client_Proxy::startNetworkThread,
+		"stopNetworkThread", &UA_Client_Proxy::stopNetworkThread,
+		"poll", &UA_Client_Proxy::poll,
+		"getPollFd", &UA_Client_Proxy::getPollFd,
 		// type cache database access methods
+		"get_node_data_value_type", &UA_Client_Proxy::get_node_data_value_type,
 		"dumpType", &UA_Client_Proxy::dumpType,
 		"decodeExtensionObject", &UA_Client_Proxy::decodeExtensionObject,
 		"encodeExtensionObject", &UA_Client_Proxy::encodeExtensionObject
@@ -1755,7 +3391,9 @@ void reg_opcua_client(sol::table& module) {
 		//"setApplicationURI", &UA_ClientConfig_Proxy_CyclicIO::setApplicationURI,
 		//"setApplicationName", &UA_ClientConfig_Proxy_CyclicIO::setApplicationName,
 		"setTimeout", &UA_ClientConfig_Proxy_CyclicIO::setTimeout,
-		"setSecureChannelLifeTime", &UA_ClientConfig_Proxy_CyclicIO::setSecureChannelLifeTime
+		"setSecureChannelLifeTime", &UA_ClientConfig_Proxy_CyclicIO::setSecureChannelLifeTime,
+		"setReconnectDelay", &UA_ClientConfig_Proxy_CyclicIO::setReconnectDelay,
+		"setSevereErrorCooldown", &UA_ClientConfig_Proxy_CyclicIO::setSevereErrorCooldown
 	);
 	module.new_usertype<UA_Client_CyclicIO>("CyclicIO",
 		sol::constructors<UA_Client_CyclicIO(), UA_Client_CyclicIO(UA_MessageSecurityMode, const std::string&, const std::string&)>(),
@@ -1775,6 +3413,17 @@ void reg_opcua_client(sol::table& module) {
 		"start", &UA_Client_CyclicIO::start
 //		"updateIO", &UA_Client_CyclicIO::updateIO
 	);
+	module.new_usertype<UA_ClientPool_Proxy>("ClientPool",
+		sol::constructors<UA_ClientPool_Proxy(), UA_ClientPool_Proxy(int), UA_ClientPool_Proxy(int, int)>(),
+		"config", &UA_ClientPool_Proxy::_config,
+		"add", &UA_ClientPool_Proxy::add,
+		"remove", &UA_ClientPool_Proxy::remove,
+		"getState", &UA_ClientPool_Proxy::getState,
+		"read", &UA_ClientPool_Proxy::read,
+		"write", &UA_ClientPool_Proxy::write,
+		"getStats", &UA_ClientPool_Proxy::getStats,
+		"getSessionStats", &UA_ClientPool_Proxy::getSessionStats
+	);
 
 	module.new_usertype<ClientNodeMgr>("ClientNodeMgr",
 		//sol::constructors<ClientNodeMgr(UA_Client*)>(),
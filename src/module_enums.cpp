@@ -115,6 +115,31 @@ void reg_opcua_enums(sol::table& module) {
 		"VALUEFORVARIABLETYPE", UA_WRITEMASK_VALUEFORVARIABLETYPE,
 		"ALL", 0xFF
 	);
+	module.new_enum("AttributeId",
+		"NODEID", UA_ATTRIBUTEID_NODEID,
+		"NODECLASS", UA_ATTRIBUTEID_NODECLASS,
+		"BROWSENAME", UA_ATTRIBUTEID_BROWSENAME,
+		"DISPLAYNAME", UA_ATTRIBUTEID_DISPLAYNAME,
+		"DESCRIPTION", UA_ATTRIBUTEID_DESCRIPTION,
+		"WRITEMASK", UA_ATTRIBUTEID_WRITEMASK,
+		"USERWRITEMASK", UA_ATTRIBUTEID_USERWRITEMASK,
+		"ISABSTRACT", UA_ATTRIBUTEID_ISABSTRACT,
+		"SYMMETRIC", UA_ATTRIBUTEID_SYMMETRIC,
+		"INVERSENAME", UA_ATTRIBUTEID_INVERSENAME,
+		"CONTAINSNOLOOPS", UA_ATTRIBUTEID_CONTAINSNOLOOPS,
+		"EVENTNOTIFIER", UA_ATTRIBUTEID_EVENTNOTIFIER,
+		"VALUE", UA_ATTRIBUTEID_VALUE,
+		"DATATYPE", UA_ATTRIBUTEID_DATATYPE,
+		"VALUERANK", UA_ATTRIBUTEID_VALUERANK,
+		"ARRAYDIMENSIONS", UA_ATTRIBUTEID_ARRAYDIMENSIONS,
+		"ACCESSLEVEL", UA_ATTRIBUTEID_ACCESSLEVEL,
+		"USERACCESSLEVEL", UA_ATTRIBUTEID_USERACCESSLEVEL,
+		"MINIMUMSAMPLINGINTERVAL", UA_ATTRIBUTEID_MINIMUMSAMPLINGINTERVAL,
+		"HISTORIZING", UA_ATTRIBUTEID_HISTORIZING,
+		"EXECUTABLE", UA_ATTRIBUTEID_EXECUTABLE,
+		"USEREXECUTABLE", UA_ATTRIBUTEID_USEREXECUTABLE,
+		"DATATYPEDEFINITION", UA_ATTRIBUTEID_DATATYPEDEFINITION
+	);
 	module.new_enum("ValueRank",
 		"SCALAR_OR_ONE_DIMENSION", UA_VALUERANK_SCALAR_OR_ONE_DIMENSION,
 		"ANY", UA_VALUERANK_ANY,
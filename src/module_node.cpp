@@ -1,55 +1,151 @@
+#include <map>
+
 #include "module_node.hpp"
 
 namespace lua_opcua {
 
-UA_StatusCode UA_Node_Iter::operator()(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId) {
-	if (isInverse)
-		return UA_STATUSCODE_GOOD;
+const static std::map<std::string, UA_UInt32> AttributeIdMap = {
+	{"NodeId", UA_ATTRIBUTEID_NODEID},
+	{"NodeClass", UA_ATTRIBUTEID_NODECLASS},
+	{"BrowseName", UA_ATTRIBUTEID_BROWSENAME},
+	{"DisplayName", UA_ATTRIBUTEID_DISPLAYNAME},
+	{"Description", UA_ATTRIBUTEID_DESCRIPTION},
+	{"WriteMask", UA_ATTRIBUTEID_WRITEMASK},
+	{"UserWriteMask", UA_ATTRIBUTEID_USERWRITEMASK},
+	{"IsAbstract", UA_ATTRIBUTEID_ISABSTRACT},
+	{"Symmetric", UA_ATTRIBUTEID_SYMMETRIC},
+	{"InverseName", UA_ATTRIBUTEID_INVERSENAME},
+	{"ContainsNoLoops", UA_ATTRIBUTEID_CONTAINSNOLOOPS},
+	{"EventNotifier", UA_ATTRIBUTEID_EVENTNOTIFIER},
+	{"Value", UA_ATTRIBUTEID_VALUE},
+	{"DataType", UA_ATTRIBUTEID_DATATYPE},
+	{"ValueRank", UA_ATTRIBUTEID_VALUERANK},
+	{"ArrayDimensions", UA_ATTRIBUTEID_ARRAYDIMENSIONS},
+	{"AccessLevel", UA_ATTRIBUTEID_ACCESSLEVEL},
+	{"UserAccessLevel", UA_ATTRIBUTEID_USERACCESSLEVEL},
+	{"MinimumSamplingInterval", UA_ATTRIBUTEID_MINIMUMSAMPLINGINTERVAL},
+	{"Historizing", UA_ATTRIBUTEID_HISTORIZING},
+	{"Executable", UA_ATTRIBUTEID_EXECUTABLE},
+	{"UserExecutable", UA_ATTRIBUTEID_USEREXECUTABLE},
+	{"DataTypeDefinition", UA_ATTRIBUTEID_DATATYPEDEFINITION},
+};
 
-	//std::cout << "UA_Node_Iter\t" << toString(childId) << "\t" << toString(referenceTypeId) << std::endl;
-	UA_Node node(_parent->_mgr, childId, referenceTypeId, UA_NODECLASS_UNSPECIFIED);
-	_childs.push_back(node);
-	return UA_STATUSCODE_GOOD;
+bool toAttributeId(const sol::object& attr, UA_UInt32* outAttributeId) {
+	switch (attr.get_type()) {
+	case sol::type::lua_nil:
+		*outAttributeId = UA_ATTRIBUTEID_VALUE;
+		return true;
+	case sol::type::number:
+		*outAttributeId = attr.as<UA_UInt32>();
+		return *outAttributeId >= UA_ATTRIBUTEID_NODEID;
+	case sol::type::string: {
+		auto ptr = AttributeIdMap.find(attr.as<std::string>());
+		if (ptr == AttributeIdMap.end())
+			return false;
+		*outAttributeId = ptr->second;
+		return true;
+	}
+	default:
+		return false;
+	}
 }
 
-UA_Node_Finder::UA_Node_Finder(const UA_Node* parent, const std::string& name, AttributeReader* reader)
-	: UA_Node_callback(parent), _reader(reader), _found(false)
-{
-	auto index = name.find(":");
-	if (index != name.npos) {
-		std::stringstream ss;
-		ss << name.substr(0, index);
-		ss >> _ns;
-		//std::cout << "autoQualifiedName ns:" << _ns << " name:" << name.substr(index+1) << std::endl;
-		_name = UA_STRING_ALLOC(name.substr(index + 1).c_str());
-	} else {
-		_ns = _parent->_id.namespaceIndex;
-		_name = UA_STRING_ALLOC(name.c_str());
+bool toNodeId(const sol::object& obj, UA_NodeId* outNodeId) {
+	if (obj.is<UA_Node>()) {
+		*outNodeId = obj.as<UA_Node&>()._id;
+		return true;
 	}
+	if (obj.is<UA_NodeId>()) {
+		*outNodeId = obj.as<UA_NodeId&>();
+		return true;
+	}
+	return false;
 }
 
-UA_StatusCode UA_Node_Finder::operator()(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId) {
-	if (childId.namespaceIndex != _ns)
-		return UA_STATUSCODE_GOOD;
-
-	UA_Node node(_parent->_mgr, childId, referenceTypeId, UA_NODECLASS_OBJECT);
-	UA_QualifiedName browse_name; UA_QualifiedName_init(&browse_name);
-	UA_StatusCode re = _reader->readBrowseName(childId, &browse_name);
-	//std::cout << "UA_Node_Finder ns:" << browse_name.namespaceIndex << "," << childId.namespaceIndex << " name:" << (char*)browse_name.name.data << std::endl;
-	if (re == UA_STATUSCODE_GOOD && UA_String_equal(&browse_name.name, &_name)) {
-		_nodes.push_back(node);
-		_found = true;
+sol::variadic_results readDataValues(AttributeReader* reader, const std::vector<UA_ReadValueId>& items, sol::this_state L) {
+	std::vector<UA_DataValue> values;
+	values.reserve(items.size());
+	UA_StatusCode re = UA_STATUSCODE_GOOD;
+	if (!items.empty()) {
+		re = reader->readAttributes(items.size(), &items[0], values);
+	}
+	sol::state_view lua(L);
+	sol::table values_table = lua.create_table(values.size(), 0);
+	for (size_t i = 0; i < values.size(); ++i) {
+		values_table[i + 1] = values[i];	// the lua object owns the value from now on
 	}
+	RETURN_RESULT(sol::table, values_table)
+}
+
+void initChildrenBrowseDescription(UA_BrowseDescription* desc, const UA_NodeId& parentNodeId) {
+	UA_BrowseDescription_init(desc);
+	desc->nodeId = parentNodeId;
+	desc->browseDirection = UA_BROWSEDIRECTION_FORWARD;
+	desc->includeSubtypes = true;
+	desc->resultMask = UA_BROWSERESULTMASK_REFERENCETYPEID | UA_BROWSERESULTMASK_NODECLASS |
+		UA_BROWSERESULTMASK_BROWSENAME | UA_BROWSERESULTMASK_DISPLAYNAME;
+}
+
+UA_StatusCode takeBrowseResult(UA_BrowseResult& result, std::vector<UA_ReferenceDescription>& outReferences, UA_ByteString* outContinuationPoint) {
+	if (result.statusCode != UA_STATUSCODE_GOOD)
+		return result.statusCode;
+	outReferences.insert(outReferences.end(), result.references, result.references + result.referencesSize);
+	// Only the array itself is freed, the content belongs to outReferences now
+	UA_Array_delete(result.references, 0, &UA_TYPES[UA_TYPES_REFERENCEDESCRIPTION]);
+	result.references = NULL;
+	result.referencesSize = 0;
+	*outContinuationPoint = result.continuationPoint;
+	UA_ByteString_init(&result.continuationPoint);
 	return UA_STATUSCODE_GOOD;
 }
 
-UA_StatusCode UA_Node_IteratorCallback(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId, void* handle) {
-	UA_Node_callback* cb = (UA_Node_callback*)handle;
-	return (*cb)(childId, isInverse, referenceTypeId);
+void initBrowsePath(UA_BrowsePath* path, const UA_NodeId& startNodeId, const std::vector<std::string>& names) {
+	UA_BrowsePath_init(path);
+	UA_NodeId_copy(&startNodeId, &path->startingNode);
+	if (names.empty())
+		return;
+	path->relativePath.elements = (UA_RelativePathElement*)UA_Array_new(names.size(), &UA_TYPES[UA_TYPES_RELATIVEPATHELEMENT]);
+	path->relativePath.elementsSize = names.size();
+	int ns = startNodeId.namespaceIndex;
+	for (size_t i = 0; i < names.size(); ++i) {
+		const std::string& name = names[i];
+		UA_RelativePathElement& elem = path->relativePath.elements[i];
+		elem.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+		elem.isInverse = false;
+		elem.includeSubtypes = true;
+		auto index = name.find(":");
+		if (index != name.npos) {
+			std::stringstream ss;
+			ss << name.substr(0, index);
+			ss >> ns;
+			elem.targetName = UA_QUALIFIEDNAME_ALLOC(ns, name.substr(index + 1).c_str());
+		} else {
+			elem.targetName = UA_QUALIFIEDNAME_ALLOC(ns, name.c_str());
+		}
+	}
 }
 
 
+sol::object takeLuaValue(sol::state_view lua, UA_Variant& var) {
+	sol::object obj;
+	if (var.type != NULL && var.type->typeIndex < UA_TYPES_COUNT && var.type == &UA_TYPES[var.type->typeIndex]) {
+		obj = variantToLua(lua, var);
+		UA_Variant_clear(&var);
+	} else {
+		obj = sol::make_object(lua, var);   // lua owns it from now on
+		UA_Variant_init(&var);
+	}
+	return obj;
+}
+
 void reg_opcua_node(sol::table& module) {
+	module.new_usertype<UA_HistoryReader>("HistoryReader",
+		"new", sol::no_constructor,
+		"next", &UA_HistoryReader::next,
+		sol::meta_function::call, [](UA_HistoryReader& reader, sol::variadic_args, sol::this_state L) { return reader.next(L); },
+		"close", &UA_HistoryReader::close,
+		"error", sol::readonly(&UA_HistoryReader::_error)
+	);
 	module.new_usertype<UA_Node>("Node",
 		"new", sol::no_constructor,
 		"id", sol::readonly(&UA_Node::_id),
@@ -66,6 +162,9 @@ void reg_opcua_node(sol::table& module) {
 		"addMethod", &UA_Node::addMethod,
 		"deleteReference", &UA_Node::deleteReference,
 		"getChildren", &UA_Node::getChildren,
+		"resolvePaths", &UA_Node::resolvePaths,
+		"readAttributes", &UA_Node::readAttributes,
+		"historyRead", &UA_Node::historyRead,
 		"getChild", sol::overload(
 			static_cast<sol::variadic_results (UA_Node::*)(const std::string& name, sol::this_state L) >(&UA_Node::getChild),
 			static_cast<sol::variadic_results (UA_Node::*)(const sol::as_table_t<std::vector<std::string> > names, sol::this_state L) >(&UA_Node::getChild)
@@ -11,41 +11,125 @@
 namespace lua_opcua {
 extern std::string toString(const UA_NodeId& id);
 
-UA_StatusCode UA_Node_IteratorCallback(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId, void* handle);
+// Browse description for all forward references with the attributes needed for UA_Node
+void initChildrenBrowseDescription(UA_BrowseDescription* desc, const UA_NodeId& parentNodeId);
+// Move the references and the continuation point out of the browse result (no copies)
+UA_StatusCode takeBrowseResult(UA_BrowseResult& result, std::vector<UA_ReferenceDescription>& outReferences, UA_ByteString* outContinuationPoint);
+
+// Get the attribute id from an AttributeId enum value or an attribute name (e.g. "Value"), nil means Value
+bool toAttributeId(const sol::object& attr, UA_UInt32* outAttributeId);
+// Get the node id of a Node or NodeId object. The id is not copied, it stays owned by the lua object!
+bool toNodeId(const sol::object& obj, UA_NodeId* outNodeId);
+// Read all items with one request and return them as table of DataValues or nil, error
+sol::variadic_results readDataValues(AttributeReader* reader, const std::vector<UA_ReadValueId>& items, sol::this_state L);
+
+// Browse path along hierarchical references for browse names ("name" or "ns:name"). A name without
+// namespace uses the namespace of the previous name (the first one the namespace of the start node).
+// Release with UA_BrowsePath_clear.
+void initBrowsePath(UA_BrowsePath* path, const UA_NodeId& startNodeId, const std::vector<std::string>& names);
+// Name of a builtin data type ("int32", "string", ...) or "unknown", constant time
+const char* get_node_data_value_type(const UA_NodeId& typeId);
+// Variant to native lua values (see Variant:toLua), scalars become lua values, arrays (nested) tables
+sol::object variantToLua(sol::state_view lua, const UA_Variant& var);
+// Variant from a lua value or (nested) table (see opcua.fromLua). Without a type it is taken
+// from the lua value (boolean, Double, String, ...). The variant owns its data.
+bool variantFromLua(const sol::object& value, const UA_DataType* type, UA_Variant* out);
+// As variantToLua, but takes the value: Variants without lua representation are moved into
+// lua instead of being copied. The variant is empty (owns nothing) afterwards.
+sol::object takeLuaValue(sol::state_view lua, UA_Variant& var);
 
 class UA_Node;
-struct UA_Node_callback {
-	const UA_Node* _parent;
 
-	UA_Node_callback(const UA_Node* parent) : _parent(parent) {}
-	virtual ~UA_Node_callback(){};
-	virtual UA_StatusCode operator()(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId) = 0;
-};
-struct UA_Node_Iter : public UA_Node_callback {
-	std::vector<UA_Node> _childs;
-
-	UA_Node_Iter(const UA_Node* parent) : UA_Node_callback(parent) {}
-	UA_StatusCode operator()(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId);
-};
-
-struct UA_Node_Finder : public UA_Node_callback {
-	UA_String _name;
-	int _ns;
-	AttributeReader* _reader;
-	std::vector<UA_Node> _nodes;
-	bool _found;
+// Iterator over the raw history of a node (see UA_Node::historyRead). Every call reads the next
+// page, following the continuation points lazily, so only one page is held in memory.
+class UA_HistoryReader {
+public:
+	NodeMgr* _mgr;
+	std::shared_ptr<bool> _mgrAlive;
+	UA_NodeId _id;
+	UA_DateTime _startTime;
+	UA_DateTime _endTime;
+	UA_UInt32 _pageSize;
+	UA_Boolean _returnBounds;
+	UA_TimestampsToReturn _timestamps;
+	UA_ByteString _continuationPoint;
+	bool _done;
+	std::string _error;         // why the iteration stopped early (empty if not)
+
+	UA_HistoryReader(NodeMgr* mgr, const UA_NodeId& id, UA_DateTime startTime, UA_DateTime endTime)
+		: _mgr(mgr), _mgrAlive(mgr->alive), _startTime(startTime), _endTime(endTime), _pageSize(1000), _returnBounds(false),
+		  _timestamps(UA_TIMESTAMPSTORETURN_SOURCE), _done(false) {
+		UA_NodeId_copy(&id, &_id);
+		UA_ByteString_init(&_continuationPoint);
+	}
+	UA_HistoryReader(const UA_HistoryReader& obj) : _mgr(obj._mgr), _mgrAlive(obj._mgrAlive), _startTime(obj._startTime), _endTime(obj._endTime),
+		  _pageSize(obj._pageSize), _returnBounds(obj._returnBounds), _timestamps(obj._timestamps),
+		  _done(obj._done), _error(obj._error) {
+		UA_NodeId_copy(&obj._id, &_id);
+		UA_ByteString_copy(&obj._continuationPoint, &_continuationPoint);
+	}
+	// no request from the collector: a loop left early (break) keeps the continuation
+	// point on the server until close() or the session ends
+	~UA_HistoryReader() {
+		UA_ByteString_clear(&_continuationPoint);
+		UA_NodeId_clear(&_id);
+	}
 
-	UA_Node_Finder(const UA_Node* parent, const std::string& name, AttributeReader* reader);
-	~UA_Node_Finder() { UA_String_clear(&_name); }
-	UA_StatusCode operator()(UA_NodeId childId, UA_Boolean isInverse, UA_NodeId referenceTypeId);
+	// returns timestamps, values, statuses of the next page (tables) or nil at the end
+	sol::variadic_results next(sol::this_state L) {
+		sol::variadic_results result;
+		std::vector<UA_DataValue> values;
+		if (!_done && !*_mgrAlive) {
+			_error = UA_StatusCode_name(UA_STATUSCODE_BADSESSIONCLOSED);
+			_done = true;
+		}
+		while (!_done && values.empty()) {
+			UA_StatusCode re = _mgr->historyReadRaw(_id, _startTime, _endTime, _pageSize, _returnBounds,
+				_timestamps, &_continuationPoint, false, values);
+			if (re != UA_STATUSCODE_GOOD)
+				_error = UA_StatusCode_name(re);
+			_done = re != UA_STATUSCODE_GOOD || _continuationPoint.length == 0;
+		}
+		if (values.empty()) {
+			result.push_back({ L, sol::in_place_type<sol::lua_nil_t>, sol::lua_nil_t()});
+			return result;
+		}
+		sol::state_view lua(L);
+		sol::table timestamps = lua.create_table(values.size(), 0);
+		sol::table data = lua.create_table(values.size(), 0);
+		sol::table statuses = lua.create_table(values.size(), 0);
+		for (size_t i = 0; i < values.size(); ++i) {
+			UA_DataValue& dv = values[i];
+			bool source = _timestamps != UA_TIMESTAMPSTORETURN_SERVER && dv.hasSourceTimestamp;
+			timestamps[i + 1] = source ? dv.sourceTimestamp : dv.serverTimestamp;
+			data[i + 1] = takeLuaValue(lua, dv.value);
+			statuses[i + 1] = dv.hasStatus ? dv.status : UA_STATUSCODE_GOOD;
+			UA_DataValue_clear(&dv);
+		}
+		result.push_back({ L, sol::in_place_type<sol::table>, timestamps});
+		result.push_back({ L, sol::in_place_type<sol::table>, data});
+		result.push_back({ L, sol::in_place_type<sol::table>, statuses});
+		return result;
+	}
+	// stop early, the server frees the continuation point
+	void close() {
+		if (!_done && _continuationPoint.length > 0 && *_mgrAlive) {
+			std::vector<UA_DataValue> values;
+			_mgr->historyReadRaw(_id, _startTime, _endTime, _pageSize, _returnBounds,
+				_timestamps, &_continuationPoint, true, values);
+		}
+		UA_ByteString_clear(&_continuationPoint);
+		_done = true;
+	}
 };
 
 #define MAP_NODE_PROPERTY(PT, PN) \
-	sol::variadic_results get_##PN##_lua(sol::this_state L) const { \
+	static int get_##PN##_raw(lua_State* L) { \
+		RAW_SELF(UA_Node, self) \
 		PT val; PT##_init(&val); \
-		auto reader = _mgr->getAttributeReader(); \
-		UA_StatusCode re = reader->read##PN(_id, &val); \
-		RETURN_RESULT(PT, val) \
+		auto reader = self->_mgr->getAttributeReader(); \
+		UA_StatusCode re = reader->read##PN(self->_id, &val); \
+		RAW_RETURN_RESULT(PT, val) \
 	} \
 	PT get_##PN() const { \
 		PT val; PT##_init(&val); \
@@ -69,7 +153,7 @@ struct UA_Node_Finder : public UA_Node_callback {
 		RETURN_RESULT(bool, true) \
 	}
 
-#define SOL_MAP_NODE_PROPERTY(LN, DN) #LN, sol::property(&UA_Node::get_##DN, &UA_Node::set_##DN), "get_"#DN, &UA_Node::get_##DN##_lua, "set_"#DN, &UA_Node::set_##DN##_lua
+#define SOL_MAP_NODE_PROPERTY(LN, DN) #LN, sol::property(&UA_Node::get_##DN, &UA_Node::set_##DN), "get_"#DN, &UA_Node::get_##DN##_raw, "set_"#DN, &UA_Node::set_##DN##_lua
 
 
 struct AutoReleaseNodeId {
@@ -89,8 +173,6 @@ class UA_Node {
 protected:
 	friend class UA_Client_Proxy;
 	friend class UA_Server_Proxy;
-	friend class UA_Node_Iter;
-	friend class UA_Node_Finder;
 	UA_Node(NodeMgr* mgr, const UA_NodeId id, const UA_NodeId referenceType, UA_NodeClass node_class) : _mgr(mgr), _class(node_class) {
 		UA_NodeId_copy(&id, &_id);
 		UA_NodeId_copy(&referenceType, &_referenceType);
@@ -212,83 +294,102 @@ public:
 		RETURN_RESULT(bool, true)
 	}
 	sol::as_table_t< std::vector<UA_Node> > getChildren() const {
-		//std::cout << "getChildren\t" << toString(_id) << "\t" << toString(_referenceType) << std::endl;
-		UA_Node_Iter iter(this);
-		UA_StatusCode re = _mgr->forEachChildNodeCall(_id, UA_Node_IteratorCallback, &iter);
-		UA_NodeClass outNodeClass;
-		auto reader = _mgr->getAttributeReader();
-		for (auto & node : iter._childs) {
-			auto ret = reader->readNodeClass(node._id, &outNodeClass);
-			if (UA_STATUSCODE_GOOD == ret) {
-				node._class = outNodeClass;
-				//std::cout << "!!!! Read NodeClass\t" << outNodeClass << "\t" << node._class << std::endl;
-			} else {
-				//std::cout << "Failed to read NodeClass\t" << ret << std::endl;
-			}
-		}
-		return sol::as_table_t< std::vector<UA_Node> >( iter._childs );
-	}
-	bool _getChild(const std::string& name, std::vector<UA_Node>& result) {
-		UA_Node_Finder op(this, name, _mgr->getAttributeReader());
-		UA_StatusCode re = _mgr->forEachChildNodeCall(_id, UA_Node_IteratorCallback, &op);
-		if (op._found) {
-			result.insert(result.end(), op._nodes.begin(), op._nodes.end());
-			UA_NodeClass outNodeClass;
-			auto reader = _mgr->getAttributeReader();
-			for (auto & node: result) {
-				auto ret = reader->readNodeClass(node._id, &outNodeClass);
-				if (UA_STATUSCODE_GOOD == ret) {
-					node._class = outNodeClass;
-					//std::cout << "Read NodeClass\t" << outNodeClass << "\t" << node._class << std::endl;
-				} else {
-					//std::cout << "Failed to read NodeClass\t" << ret << std::endl;
-				}
-			}
+		// One browse (plus BrowseNext if needed) delivers the node class, no extra reads per child
+		std::vector<UA_ReferenceDescription> refs;
+		_mgr->browseChildren(_id, refs);
+		std::vector<UA_Node> childs;
+		childs.reserve(refs.size());
+		for (auto & ref : refs) {
+			childs.push_back(UA_Node(_mgr, ref.nodeId.nodeId, ref.referenceTypeId, ref.nodeClass));
+			UA_ReferenceDescription_clear(&ref);
 		}
-		return op._found;
+		return sol::as_table_t< std::vector<UA_Node> >( childs );
 	}
 	sol::variadic_results getChild(const std::string& name, sol::this_state L) {
-		//std::cout << "getChild in name" << std::endl;
+		std::vector<std::string> names;
+		names.push_back(name);
+		return getChild(sol::as_table_t< std::vector<std::string> >(names), L);
+	}
+	sol::variadic_results getChild(const sol::as_table_t<std::vector<std::string> > names, sol::this_state L) {
+		if (names.source.empty())
+			RETURN_OK(UA_Node, *this)
+		// The whole path is resolved by the server (TranslateBrowsePathsToNodeIds), client side cached
+		UA_BrowsePath path;
+		initBrowsePath(&path, _id, names.source);
+		std::vector< std::vector<BrowsePathTarget> > targets;
+		UA_StatusCode re = _mgr->resolveBrowsePaths(1, &path, targets);
+		UA_BrowsePath_clear(&path);
+		if (re != UA_STATUSCODE_GOOD)
+			RETURN_ERROR(UA_StatusCode_name(re))
+		if (targets[0].empty())
+			RETURN_ERROR("Not found!")
 		sol::variadic_results result;
-		std::vector<UA_Node> nodes;
-		bool found = _getChild(name, nodes);
-		if (found) { 
-			for(auto & node : nodes) {
-				result.push_back({ L, sol::in_place_type<UA_Node>, node});
-			}
-		} else {
-			result.push_back({ L, sol::in_place_type<sol::lua_nil_t>, sol::lua_nil_t()});
-			result.push_back({ L, sol::in_place_type<std::string>, std::string("Not found!")});
-		}
+		for (auto & target : targets[0])
+			result.push_back({ L, sol::in_place_type<UA_Node>, UA_Node(_mgr, target.nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES), target.nodeClass)});
 		return result;
 	}
-	void _getChild(std::vector<UA_Node>& nodes, const std::string& name, std::vector<UA_Node>& results) {
-		for(auto parent : nodes) {
-			parent._getChild(name, results);
+	// Resolve many paths with one request
+	// paths: { {"1:Folder", "Variable"}, "Name", ... }
+	// returns table with the (first) node of each path, nil for paths not found
+	sol::variadic_results resolvePaths(sol::table paths, sol::this_state L) {
+		size_t count = paths.size();
+		std::vector<UA_BrowsePath> browsePaths(count);
+		for (size_t i = 0; i < count; ++i) {
+			sol::object path = paths.get<sol::object>(i + 1);
+			std::vector<std::string> names;
+			if (path.get_type() == sol::type::string)
+				names.push_back(path.as<std::string>());
+			else if (path.get_type() == sol::type::table)
+				names = path.as< std::vector<std::string> >();
+			initBrowsePath(&browsePaths[i], _id, names);
+		}
+		std::vector< std::vector<BrowsePathTarget> > targets;
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		if (count > 0)
+			re = _mgr->resolveBrowsePaths(count, &browsePaths[0], targets);
+		for (auto & browsePath : browsePaths)
+			UA_BrowsePath_clear(&browsePath);
+		sol::state_view lua(L);
+		sol::table nodes = lua.create_table(count, 0);
+		for (size_t i = 0; i < targets.size(); ++i) {
+			if (!targets[i].empty())
+				nodes[i + 1] = UA_Node(_mgr, targets[i][0].nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES), targets[i][0].nodeClass);
 		}
+		RETURN_RESULT(sol::table, nodes)
 	}
-	sol::variadic_results getChild(const sol::as_table_t<std::vector<std::string> > names, sol::this_state L) {
-		//std::cout << "getChild in vector" << std::endl;
-		sol::variadic_results result;
-		auto ptr = names.source.begin();
-
-		std::vector<UA_Node> results;
-		results.push_back(*this);
-		for(; ptr != names.source.end(); ++ptr) {
-			std::string name = *ptr;
-			std::vector<UA_Node> founds; 
-			_getChild(results, name, founds);
-			if (founds.empty())
-			{
-				result.push_back({ L, sol::in_place_type<sol::lua_nil_t>, sol::lua_nil_t()});
-				result.push_back({ L, sol::in_place_type<std::string>, name + " Not found!"});
-				return result;
-			}
-			founds.swap(results);
+
+	// Read the raw history between startTime and endTime (DateTime), returns an iterator for
+	// a generic for: for timestamps, values, statuses in node:historyRead(t0, t1) do ... end
+	// options (all optional): { pageSize = n (values per request, default 1000),
+	//                          returnBounds = boolean, timestamps = "source" | "server" }
+	sol::variadic_results historyRead(UA_DateTime startTime, UA_DateTime endTime, sol::optional<sol::table> options, sol::this_state L) {
+		UA_HistoryReader reader(_mgr, _id, startTime, endTime);
+		if (options) {
+			sol::table& opts = *options;
+			reader._pageSize = opts.get_or("pageSize", reader._pageSize);
+			reader._returnBounds = opts.get_or("returnBounds", false);
+			std::string timestamps = opts.get_or<std::string>("timestamps", "source");
+			if (timestamps == "server")
+				reader._timestamps = UA_TIMESTAMPSTORETURN_SERVER;
+			else if (timestamps != "source")
+				RETURN_ERROR("invalid timestamps option")
 		}
-		for (auto node : results)
-			result.push_back({ L, sol::in_place_type<UA_Node>, node});
-		return result;
+		RETURN_OK(UA_HistoryReader, reader)
+	}
+
+	// Read several attributes of this node with a single request
+	// attributes: { "Value", "DisplayName", opcua.AttributeId.DATATYPE, ... }
+	sol::variadic_results readAttributes(sol::table attributes, sol::this_state L) const {
+		std::vector<UA_ReadValueId> items;
+		items.reserve(attributes.size());
+		for (size_t i = 1; i <= attributes.size(); ++i) {
+			UA_ReadValueId item; UA_ReadValueId_init(&item);
+			item.nodeId = _id;
+			if (!toAttributeId(attributes.get<sol::object>(i), &item.attributeId))
+				RETURN_ERROR("invalid attribute")
+			items.push_back(item);
+		}
+		return readDataValues(_mgr->getAttributeReader(), items, L);
 	}
 
 	MAP_NODE_PROPERTY(UA_NodeClass, NodeClass)
@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
 #include <list>
+#include <memory>
 
 #include "open62541.h"
 #include "read_file.h"
@@ -9,9 +13,74 @@
 
 #include "opcua_interfaces.hpp"
 #include "module_node.hpp"
+#include "OpcUA_ProcessImage.h"
+#include "OpcUA_ServerThread.h"
+#include "OpcUA_NodeSet.h"
+#include "OpcUA_Serializer_Lua.h"
 
 namespace lua_opcua {
 
+// The arguments of a read or write callback, copied for the lua thread (queued by the server thread)
+struct UA_QueuedValue {
+	UA_NodeId sessionId;
+	void* sessionContext;
+	UA_NodeId nodeId;
+	UA_NumericRange range;
+	bool hasRange;
+	UA_DataValue value;
+
+	UA_QueuedValue(const UA_NodeId* session, void* context, const UA_NodeId* node,
+			const UA_NumericRange* numericRange, const UA_DataValue* data) : sessionContext(context) {
+		UA_NodeId_copy(session, &sessionId);
+		UA_NodeId_copy(node, &nodeId);
+		hasRange = numericRange != NULL;
+		range.dimensionsSize = 0;
+		range.dimensions = NULL;
+		if (hasRange && numericRange->dimensionsSize > 0) {
+			range.dimensions = (UA_NumericRangeDimension*)UA_malloc(numericRange->dimensionsSize * sizeof(UA_NumericRangeDimension));
+			if (range.dimensions) {
+				memcpy(range.dimensions, numericRange->dimensions, numericRange->dimensionsSize * sizeof(UA_NumericRangeDimension));
+				range.dimensionsSize = numericRange->dimensionsSize;
+			}
+		}
+		if (data)
+			UA_DataValue_copy(data, &value);
+		else
+			UA_DataValue_init(&value);
+	}
+	~UA_QueuedValue() {
+		UA_NodeId_clear(&sessionId);
+		UA_NodeId_clear(&nodeId);
+		UA_free(range.dimensions);
+		UA_DataValue_clear(&value);
+	}
+	const UA_NumericRange* getRange() const {
+		return hasRange ? &range : NULL;
+	}
+};
+
+// The last value of a lua backed read (data source), the server thread answers the reads
+// from it instead of waiting for lua. Shared with the queued refresh.
+struct UA_ReadCache {
+	UA_DataValue value;
+	UA_StatusCode status;           // of the last lua read
+	std::atomic<bool> refreshing;   // a refresh is queued, at most one at a time
+	UA_ReadCache() : status(UA_STATUSCODE_BADWAITINGFORINITIALDATA), refreshing(false) {
+		UA_DataValue_init(&value);
+	}
+	~UA_ReadCache() {
+		UA_DataValue_clear(&value);
+	}
+};
+// Held by a queued refresh, the next one can be queued when it ran or was dropped
+struct UA_RefreshToken {
+	std::shared_ptr<UA_ReadCache> cache;
+	UA_RefreshToken(const std::shared_ptr<UA_ReadCache>& c) : cache(c) {}
+	~UA_RefreshToken() {
+		cache->refreshing = false;
+	}
+};
+
 struct UA_DataSource_Proxy {
 	UA_DataSource _ds;
 
@@ -27,12 +96,36 @@ struct UA_DataSource_Proxy {
 
 	OnReadCallback _read;
 	OnWriteCallback _write;
+	std::shared_ptr<UA_ReadCache> _cache;   // the reads of the server thread
 
 	static UA_StatusCode ReadCallback(UA_Server *server, const UA_NodeId *sessionId,
                           void *sessionContext, const UA_NodeId *nodeId,
                           void *nodeContext, UA_Boolean includeSourceTimeStamp,
                           const UA_NumericRange *range, UA_DataValue *value) {
 		UA_DataSource_Proxy* p = (UA_DataSource_Proxy*)nodeContext;
+		TOpcUA_ServerThread* thread = TOpcUA_ServerThread::Current();
+		if (p->_read && thread) {
+			// called by the server thread: answered from the last value lua returned, lua
+			// reads again in its own thread (the sessions don't wait for lua)
+			p->refresh(thread, sessionId, sessionContext, nodeId);
+			UA_ReadCache& cache = *p->_cache;
+			if (cache.status != UA_STATUSCODE_GOOD)
+				return cache.status;
+			if (range) {
+				UA_Variant part;
+				UA_Variant_init(&part);
+				UA_StatusCode re = UA_Variant_copyRange(&cache.value.value, &part, *range);
+				if (re != UA_STATUSCODE_GOOD)
+					return re;
+				*value = cache.value;       // the timestamps and status, the variant is replaced
+				value->value = part;
+			} else {
+				UA_DataValue_copy(&cache.value, value);
+			}
+			if (!includeSourceTimeStamp)
+				value->hasSourceTimestamp = false;
+			return UA_STATUSCODE_GOOD;
+		}
 		if (p->_read) {
 			return p->_read(*p, sessionId, sessionContext, nodeId, includeSourceTimeStamp, range, value);
 		} else {
@@ -45,13 +138,39 @@ struct UA_DataSource_Proxy {
                            void *nodeContext, const UA_NumericRange *range,
                            const UA_DataValue *value) {
 		UA_DataSource_Proxy* p = (UA_DataSource_Proxy*)nodeContext;
+		TOpcUA_ServerThread* thread = TOpcUA_ServerThread::Current();
+		if (p->_write && thread) {
+			// the server thread doesn't wait for lua, startNetworkThread refuses data source writers
+			return UA_STATUSCODE_BADNOTWRITABLE;
+		}
 		if (p->_write) {
 			return p->_write(*p, sessionId, sessionContext, nodeId, range, value);
 		} else {
 			return UA_STATUSCODE_BADINTERNALERROR;
 		}
 	}
-	UA_DataSource_Proxy(OnReadCallback onRead, OnWriteCallback onWrite) : _read(onRead), _write(onWrite) {
+	// server thread: queue a lua read, unless one is queued already. The read value is stored in
+	// the cache under the server lock (the server thread reads it inside its iteration).
+	void refresh(TOpcUA_ServerThread* thread, const UA_NodeId* sessionId, void* sessionContext, const UA_NodeId* nodeId) {
+		if (_cache->refreshing.exchange(true))
+			return;
+		std::shared_ptr<UA_RefreshToken> token = std::make_shared<UA_RefreshToken>(_cache);
+		std::shared_ptr<UA_QueuedValue> r = std::make_shared<UA_QueuedValue>(sessionId, sessionContext, nodeId, (const UA_NumericRange*)NULL, (const UA_DataValue*)NULL);
+		UA_DataSource_Proxy* p = this;
+		TOpcUA_ServerLock* lock = thread->GetLock();
+		thread->Post([p, r, token, lock]() {
+			UA_StatusCode re = p->_read(*p, &r->sessionId, r->sessionContext, &r->nodeId, true, NULL, &r->value);
+			TOpcUA_ServerLock::Guard guard(lock);
+			UA_ReadCache& cache = *token->cache;
+			UA_DataValue_clear(&cache.value);
+			cache.value = r->value;         // moved
+			UA_DataValue_init(&r->value);
+			cache.status = re;
+		});
+	}
+
+	UA_DataSource_Proxy(OnReadCallback onRead, OnWriteCallback onWrite) : _read(onRead), _write(onWrite),
+		  _cache(std::make_shared<UA_ReadCache>()) {
 		_ds.read = &UA_DataSource_Proxy::ReadCallback;
 		_ds.write = &UA_DataSource_Proxy::WriteCallback;
 	}
@@ -61,6 +180,57 @@ struct UA_DataSource_Proxy {
 	}
 };
 
+// Lua access to a process image, the image itself is owned by the server
+struct UA_ProcessImage_Proxy {
+	static bool write(TOpcUA_ProcessImage& image, size_t offset, const std::string& data) {
+		return image.Write(offset, data.data(), data.length());
+	}
+	static sol::variadic_results read(TOpcUA_ProcessImage& image, size_t offset, size_t len, sol::this_state L) {
+		std::string data(len, '\0');
+		if (len > 0 && !image.Read(offset, &data[0], len))
+			RETURN_ERROR("out of range")
+		RETURN_OK(std::string, data)
+	}
+	// a lua value (number, boolean, table for arrays) converted to the type (UA_TYPES index)
+	static sol::variadic_results setValue(TOpcUA_ProcessImage& image, size_t offset, int typeIndex, sol::object value, sol::this_state L) {
+		if (typeIndex < 0 || typeIndex >= UA_TYPES_COUNT || !UA_TYPES[typeIndex].pointerFree)
+			RETURN_ERROR("invalid type index")
+		const UA_DataType* type = &UA_TYPES[typeIndex];
+		UA_Variant var;
+		UA_Variant_init(&var);
+		if (!variantFromLua(value, type, &var))
+			RETURN_ERROR("cannot convert value")
+		size_t count = UA_Variant_isScalar(&var) ? 1 : var.arrayLength;
+		bool ok = image.Write(offset, var.data, count * type->memSize);
+		UA_Variant_clear(&var);
+		if (!ok)
+			RETURN_ERROR("out of range")
+		RETURN_OK(bool, true)
+	}
+	static sol::variadic_results getValue(TOpcUA_ProcessImage& image, size_t offset, int typeIndex, sol::optional<size_t> count, sol::this_state L) {
+		if (typeIndex < 0 || typeIndex >= UA_TYPES_COUNT || !UA_TYPES[typeIndex].pointerFree)
+			RETURN_ERROR("invalid type index")
+		const UA_DataType* type = &UA_TYPES[typeIndex];
+		size_t n = count.value_or(0);
+		UA_Variant var;
+		UA_Variant_init(&var);
+		void* data = UA_Array_new(n > 0 ? n : 1, type);
+		if (data == NULL)
+			RETURN_ERROR("out of memory")
+		if (n > 0)
+			UA_Variant_setArray(&var, data, n, type);
+		else
+			UA_Variant_setScalar(&var, data, type);
+		if (!image.Read(offset, data, (n > 0 ? n : 1) * type->memSize)) {
+			UA_Variant_clear(&var);
+			RETURN_ERROR("out of range")
+		}
+		sol::variadic_results result;
+		result.push_back(takeLuaValue(L, var));
+		return result;
+	}
+};
+
 class UA_Server_Proxy;
 
 struct UA_ValueCallback_Proxy {
@@ -77,6 +247,7 @@ struct UA_ValueCallback_Proxy {
 	OnReadCallback _read;
 	OnWriteCallback _write;
 	UA_Server_Proxy* _proxy;
+	std::shared_ptr<UA_ReadCache> _cache;   // server thread: only its refreshing flag, the value is in the node
 
 	static void ReadCallback(UA_Server *server, const UA_NodeId *sessionId,
                    void *sessionContext, const UA_NodeId *nodeId,
@@ -88,7 +259,8 @@ struct UA_ValueCallback_Proxy {
                     void *nodeContext, const UA_NumericRange *range,
                     const UA_DataValue *data);
 
-	UA_ValueCallback_Proxy(OnReadCallback onRead, OnWriteCallback onWrite) : _read(onRead), _write(onWrite), _proxy(nullptr) {
+	UA_ValueCallback_Proxy(OnReadCallback onRead, OnWriteCallback onWrite) : _read(onRead), _write(onWrite), _proxy(nullptr),
+		  _cache(std::make_shared<UA_ReadCache>()) {
 		_callback.onRead = &UA_ValueCallback_Proxy::ReadCallback;
 		_callback.onWrite = &UA_ValueCallback_Proxy::WriteCallback;
 	}
@@ -101,45 +273,57 @@ struct UA_ValueCallback_Proxy {
 
 class ServerAttributeReader : public AttributeReader {
 	UA_Server* _server;
+	TOpcUA_ServerLock* _lock;
 public:
-	ServerAttributeReader(UA_Server* client) : _server(client) {}
+	ServerAttributeReader(UA_Server* client, TOpcUA_ServerLock* lock) : _server(client), _lock(lock) {}
 	UA_StatusCode readNodeId(const UA_NodeId nodeId, UA_NodeId *outNodeId) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readNodeId(_server, nodeId, outNodeId);
 	}
 	UA_StatusCode readNodeClass(const UA_NodeId nodeId, UA_NodeClass *outNodeClass) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readNodeClass(_server, nodeId, outNodeClass);
 	}
 	UA_StatusCode readBrowseName(const UA_NodeId nodeId, UA_QualifiedName *outBrowseName) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readBrowseName(_server, nodeId, outBrowseName);
 	}
 	UA_StatusCode readDisplayName(const UA_NodeId nodeId, UA_LocalizedText *outDisplayName) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readDisplayName(_server, nodeId, outDisplayName);
 	}
 	UA_StatusCode readDescription(const UA_NodeId nodeId, UA_LocalizedText *outDescription) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readDescription(_server, nodeId, outDescription);
 	}
 	UA_StatusCode readWriteMask(const UA_NodeId nodeId, UA_UInt32 *outWriteMask) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readWriteMask(_server, nodeId, outWriteMask);
 	}
 	UA_StatusCode readUserWriteMask(const UA_NodeId nodeId, UA_UInt32 *outUserWriteMask) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode readIsAbstract(const UA_NodeId nodeId, UA_Boolean *outIsAbstract) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readIsAbstract(_server, nodeId, outIsAbstract);
 	}
 	UA_StatusCode readSymmetric(const UA_NodeId nodeId, UA_Boolean *outSymmetric) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readSymmetric(_server, nodeId, outSymmetric);
 	}
 	UA_StatusCode readInverseName(const UA_NodeId nodeId, UA_LocalizedText *outInverseName) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readInverseName(_server, nodeId, outInverseName);
 	}
 	UA_StatusCode readContainsNoLoops(const UA_NodeId nodeId, UA_Boolean *outContainsNoLoops) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode readEventNotifier(const UA_NodeId nodeId, UA_Byte *outEventNotifier) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readEventNotifier(_server, nodeId, outEventNotifier);
 	}
 	UA_StatusCode readValue(const UA_NodeId nodeId, UA_Variant *outValue) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readValue(_server, nodeId, outValue);
 	}
 	UA_StatusCode readExtensionObjectValue(const UA_NodeId nodeId, UA_Variant *outValue, UA_NodeId* outExpandedNodeId) {
@@ -154,6 +338,7 @@ public:
 	}
 
 	UA_StatusCode readDataValue(const UA_NodeId nodeId, UA_DataValue *outDataValue) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		UA_ReadValueId id; UA_ReadValueId_init(&id);
 		id.nodeId = nodeId;
 		id.attributeId = UA_ATTRIBUTEID_VALUE;
@@ -161,9 +346,11 @@ public:
 		return outDataValue->status;
 	}
 	UA_StatusCode readDataType(const UA_NodeId nodeId, UA_NodeId *outDataType) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readDataType(_server, nodeId, outDataType);
 	}
 	UA_StatusCode readValueRank(const UA_NodeId nodeId, UA_Int32 *outValueRank) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readValueRank(_server, nodeId, outValueRank);
 	}
 	UA_StatusCode readArrayDimensions(const UA_NodeId nodeId, size_t *outArrayDimensionsSize, UA_UInt32 **outArrayDimensions) {
@@ -172,29 +359,42 @@ public:
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode readAccessLevel(const UA_NodeId nodeId, UA_Byte *outAccessLevel) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readAccessLevel(_server, nodeId, outAccessLevel);
 	}
 	UA_StatusCode readUserAccessLevel(const UA_NodeId nodeId, UA_Byte *outUserAccessLevel) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode readMinimumSamplingInterval(const UA_NodeId nodeId, UA_Double *outMinSamplingInterval) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readMinimumSamplingInterval(_server, nodeId, outMinSamplingInterval);
 	}
 	UA_StatusCode readHistorizing(const UA_NodeId nodeId, UA_Boolean *outHistorizing) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readHistorizing(_server, nodeId, outHistorizing);
 	}
 	UA_StatusCode readExecutable(const UA_NodeId nodeId, UA_Boolean *outExecutable) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_readExecutable(_server, nodeId, outExecutable);
 	}
 	UA_StatusCode readUserExecutable(const UA_NodeId nodeId, UA_Boolean *outUserExecutable) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
+	UA_StatusCode readAttributes(size_t itemsSize, const UA_ReadValueId *items, std::vector<UA_DataValue>& outDataValues) {
+		TOpcUA_ServerLock::Guard guard(_lock);
+		// Local access, there is no round trip to save here
+		for (size_t i = 0; i < itemsSize; ++i) {
+			outDataValues.push_back(UA_Server_read(_server, &items[i], UA_TIMESTAMPSTORETURN_BOTH));
+		}
+		return UA_STATUSCODE_GOOD;
+	}
 };
 
 class ServerAttributeWriter : public AttributeWriter {
 	UA_Server* _server;
+	TOpcUA_ServerLock* _lock;
 public:
-	ServerAttributeWriter(UA_Server* client) : _server(client) {}
+	ServerAttributeWriter(UA_Server* client, TOpcUA_ServerLock* lock) : _server(client), _lock(lock) {}
 	UA_StatusCode writeNodeId(const UA_NodeId nodeId, const UA_NodeId *newNodeId) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
@@ -202,43 +402,53 @@ public:
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeBrowseName(const UA_NodeId nodeId, const UA_QualifiedName *newBrowseName) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeBrowseName(_server, nodeId, *newBrowseName);
 	}
 	UA_StatusCode writeDisplayName(const UA_NodeId nodeId, const UA_LocalizedText *newDisplayName) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeDisplayName(_server, nodeId, *newDisplayName);
 	}
 	UA_StatusCode writeDescription(const UA_NodeId nodeId, const UA_LocalizedText *newDescription) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeDescription(_server, nodeId, *newDescription);
 	}
 	UA_StatusCode writeWriteMask(const UA_NodeId nodeId, const UA_UInt32 *newWriteMask) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeWriteMask(_server, nodeId, *newWriteMask);
 	}
 	UA_StatusCode writeUserWriteMask(const UA_NodeId nodeId, const UA_UInt32 *newUserWriteMask) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeIsAbstract(const UA_NodeId nodeId, const UA_Boolean *newIsAbstract) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeIsAbstract(_server, nodeId, *newIsAbstract);
 	}
 	UA_StatusCode writeSymmetric(const UA_NodeId nodeId, const UA_Boolean *newSymmetric) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeInverseName(const UA_NodeId nodeId, const UA_LocalizedText *newInverseName)  {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeInverseName(_server, nodeId, *newInverseName);
 	}
 	UA_StatusCode writeContainsNoLoops(const UA_NodeId nodeId, const UA_Boolean *newContainsNoLoops) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeEventNotifier(const UA_NodeId nodeId, const UA_Byte *newEventNotifier) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeEventNotifier(_server, nodeId, *newEventNotifier);
 	}
 	UA_StatusCode writeValue(const UA_NodeId nodeId, const UA_Variant *newValue) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeValue(_server, nodeId, *newValue);
 	}
 	UA_StatusCode writeExtensionObjectValue(const UA_NodeId nodeId, const UA_NodeId& dataTypeNodeId, const UA_Variant *newValue) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		// TODO:: implement ExtensionObject
 		return UA_Server_writeValue(_server, nodeId, *newValue);
 	}
 	UA_StatusCode writeDataValue(const UA_NodeId nodeId, const UA_DataValue *newDataValue) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		UA_WriteValue val; UA_WriteValue_init(&val);
 		val.nodeId = nodeId;
 		val.attributeId = UA_ATTRIBUTEID_VALUE;
@@ -246,9 +456,11 @@ public:
 		return UA_Server_write(_server, &val);
 	}
 	UA_StatusCode writeDataType(const UA_NodeId nodeId, const UA_NodeId *newDataType) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeDataType(_server, nodeId, *newDataType);
 	}
 	UA_StatusCode writeValueRank(const UA_NodeId nodeId, const UA_Int32 *newValueRank) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeValueRank(_server, nodeId, *newValueRank);
 	}
 	UA_StatusCode writeArrayDimensions(const UA_NodeId nodeId, size_t newArrayDimensionsSize, const UA_UInt32 *newArrayDimensions) {
@@ -257,12 +469,14 @@ public:
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeAccessLevel(const UA_NodeId nodeId, const UA_Byte *newAccessLevel) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeAccessLevel(_server, nodeId, *newAccessLevel);
 	}
 	UA_StatusCode writeUserAccessLevel(const UA_NodeId nodeId, const UA_Byte *newUserAccessLevel) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeMinimumSamplingInterval(const UA_NodeId nodeId, const UA_Double *newMinInterval) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeMinimumSamplingInterval(_server, nodeId, *newMinInterval);
 	}
 	UA_StatusCode writeHistorizing(const UA_NodeId nodeId, const UA_Boolean *newHistorizing) {
@@ -270,19 +484,45 @@ public:
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
 	UA_StatusCode writeExecutable(const UA_NodeId nodeId, const UA_Boolean *newExecutable) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_writeExecutable(_server, nodeId, *newExecutable);
 	}
 	UA_StatusCode writeUserExecutable(const UA_NodeId nodeId, const UA_Boolean *newUserExecutable) {
 		return UA_STATUSCODE_BADNOTSUPPORTED;
 	}
+	UA_StatusCode writeAttributes(size_t itemsSize, const UA_WriteValue *items, std::vector<UA_StatusCode>& outResults) {
+		TOpcUA_ServerLock::Guard guard(_lock);
+		for (size_t i = 0; i < itemsSize; ++i) {
+			outResults.push_back(UA_Server_write(_server, &items[i]));
+		}
+		return UA_STATUSCODE_GOOD;
+	}
 };
 
 class ServerNodeMgr : public NodeMgr {
 	UA_Server* _server;
+	TOpcUA_ServerLock _lock;            // held by the server thread while it runs an iteration
 	ServerAttributeReader _reader;
 	ServerAttributeWriter _writer;
+	std::list<UA_DataSource_Proxy*> _dataSources;  // the node contexts of addDataSourceVariable
 public:
-	ServerNodeMgr(UA_Server* client) : _server(client), _reader(client), _writer(client) {}
+	ServerNodeMgr(UA_Server* client) : _server(client), _reader(client, &_lock), _writer(client, &_lock) {}
+	~ServerNodeMgr() {
+		for (auto p : _dataSources) {
+			delete p;
+		}
+	}
+	// a data source with a lua write handler, the network thread cannot answer its writes
+	bool hasDataSourceWriter() {
+		for (auto p : _dataSources) {
+			if (p->_write)
+				return true;
+		}
+		return false;
+	}
+	TOpcUA_ServerLock* getLock() {
+		return &_lock;
+	}
 	AttributeReader* getAttributeReader() {
 		return &_reader;
 	}
@@ -295,6 +535,7 @@ public:
 			UA_Boolean isForward,
 			const UA_String targetServerUri,
 			UA_NodeClass targetNodeClass) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addReference(_server, sourceNodeId, referenceTypeId, targetNodeId, isForward);
 	}
 	UA_StatusCode deleteReference(const UA_NodeId sourceNodeId,
@@ -302,9 +543,11 @@ public:
 			const UA_ExpandedNodeId targetNodeId,
 			UA_Boolean isForward,
 			UA_NodeClass targetNodeClass) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_deleteReference(_server, sourceNodeId, referenceTypeId, isForward, targetNodeId, targetNodeClass);
 	}
 	UA_StatusCode deleteNode(const UA_NodeId nodeId, bool deleteTargetReferences) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_deleteNode(_server, nodeId, deleteTargetReferences);
 	}
 	UA_StatusCode addVariable(const UA_NodeId requestedNewNodeId,
@@ -314,6 +557,7 @@ public:
 			const UA_NodeId typeDefinition,
 			const UA_VariableAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addVariableNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addDataSourceVariable(const UA_NodeId requestedNewNodeId,
@@ -324,7 +568,15 @@ public:
 			const UA_VariableAttributes attr,
 			UA_DataSource_Proxy dataSource,
 			UA_NodeId *outNewNodeId) {
-		return UA_Server_addDataSourceVariableNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, dataSource._ds, &dataSource, outNewNodeId);
+		// the node context must outlive the call, the copy is kept with the server
+		UA_DataSource_Proxy* p = new UA_DataSource_Proxy(dataSource);
+		TOpcUA_ServerLock::Guard guard(&_lock);
+		UA_StatusCode re = UA_Server_addDataSourceVariableNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, p->_ds, p, outNewNodeId);
+		if (re == UA_STATUSCODE_GOOD)
+			_dataSources.push_back(p);
+		else
+			delete p;
+		return re;
 	}
 	UA_StatusCode addVariableType(const UA_NodeId requestedNewNodeId,
 			const UA_NodeId parentNodeId,
@@ -332,6 +584,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_VariableTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addVariableTypeNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, UA_NODEID_NULL, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addObject(const UA_NodeId requestedNewNodeId,
@@ -341,6 +594,7 @@ public:
 			const UA_NodeId typeDefinition,
 			const UA_ObjectAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addObjectNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, typeDefinition, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addObjectType(const UA_NodeId requestedNewNodeId,
@@ -349,6 +603,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ObjectTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addObjectTypeNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addView(const UA_NodeId requestedNewNodeId,
@@ -357,6 +612,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ViewAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addViewNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addReferenceType(const UA_NodeId requestedNewNodeId,
@@ -365,6 +621,7 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_ReferenceTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addReferenceTypeNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, NULL, outNewNodeId);
 	}
 	UA_StatusCode addDataType(const UA_NodeId requestedNewNodeId,
@@ -373,10 +630,12 @@ public:
 			const UA_QualifiedName browseName,
 			const UA_DataTypeAttributes attr,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addDataTypeNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, NULL, outNewNodeId);
 	}
 #if defined(UA_OPEN62541_VER) && UA_OPEN62541_VER > 1400
 	const UA_DataType* findDataType(const UA_NodeId *typeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_findDataType(_server, typeId);
 	}
 #endif
@@ -390,6 +649,7 @@ public:
 			size_t outputArgumentsSize, const UA_Argument* outputArguments,
 			void *nodeContext,
 			UA_NodeId *outNewNodeId) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_addMethodNode(_server, requestedNewNodeId, parentNodeId, referenceTypeId, browseName, attr, NULL, inputArgumentsSize, inputArguments, outputArgumentsSize, outputArguments, nodeContext, outNewNodeId);
 	}
 	UA_StatusCode callMethod(const UA_NodeId objectId,
@@ -404,8 +664,52 @@ public:
 	UA_StatusCode forEachChildNodeCall(UA_NodeId parentNodeId, 
 			UA_NodeIteratorCallback callback,
 			void *handle) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
 		return UA_Server_forEachChildNodeCall(_server, parentNodeId, callback, handle);
 	}
+	UA_StatusCode browseChildren(const UA_NodeId parentNodeId,
+			std::vector<UA_ReferenceDescription>& outReferences) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
+		UA_BrowseDescription desc;
+		initChildrenBrowseDescription(&desc, parentNodeId);
+		UA_ByteString cp; UA_ByteString_init(&cp);
+		UA_BrowseResult result = UA_Server_browse(_server, 0, &desc);
+		UA_StatusCode retval = takeBrowseResult(result, outReferences, &cp);
+		UA_BrowseResult_clear(&result);
+		while (retval == UA_STATUSCODE_GOOD && cp.length > 0) {
+			result = UA_Server_browseNext(_server, false, &cp);
+			UA_ByteString_clear(&cp);
+			retval = takeBrowseResult(result, outReferences, &cp);
+			UA_BrowseResult_clear(&result);
+		}
+		// a failed result has no continuation point, nothing to release
+		return retval;
+	}
+	UA_StatusCode resolveBrowsePaths(size_t pathsSize, const UA_BrowsePath* paths,
+			std::vector< std::vector<BrowsePathTarget> >& outTargets) {
+		TOpcUA_ServerLock::Guard guard(&_lock);
+		for (size_t i = 0; i < pathsSize; ++i) {
+			std::vector<BrowsePathTarget> targets;
+			UA_BrowsePathResult result = UA_Server_translateBrowsePathToNodeIds(_server, &paths[i]);
+			for (size_t t = 0; result.statusCode == UA_STATUSCODE_GOOD && t < result.targetsSize; ++t) {
+				const UA_BrowsePathTarget& target = result.targets[t];
+				if (target.remainingPathIndex != UA_UINT32_MAX || target.targetId.serverIndex != 0)
+					continue;
+				UA_NodeClass nodeClass = UA_NODECLASS_UNSPECIFIED;
+				UA_Server_readNodeClass(_server, target.targetId.nodeId, &nodeClass);
+				targets.push_back(BrowsePathTarget(target.targetId.nodeId, nodeClass));
+			}
+			UA_BrowsePathResult_clear(&result);
+			outTargets.push_back(targets);
+		}
+		return UA_STATUSCODE_GOOD;
+	}
+	UA_StatusCode historyReadRaw(const UA_NodeId nodeId, UA_DateTime startTime, UA_DateTime endTime,
+			UA_UInt32 numValuesPerNode, UA_Boolean returnBounds, UA_TimestampsToReturn timestamps,
+			UA_ByteString* continuationPoint, bool release, std::vector<UA_DataValue>& outValues) {
+		// the history database is accessed by the server's clients only
+		return UA_STATUSCODE_BADNOTSUPPORTED;
+	}
 	UA_StatusCode resolveExtensionObjectType(const UA_NodeId& nodeId, const std::string& Name)
 	{
 		throw "not implemented!";
@@ -413,6 +717,154 @@ public:
 
 };
 
+// One node of server:addNodes, read from a lua table or a CSV line
+struct UA_NodeSpec {
+	UA_NodeSpec() : parentIndex(0), nodeClass(UA_NODECLASS_VARIABLE), folder(false), accessLevel(UA_ACCESSLEVELMASK_READ) {
+		UA_NodeId_init(&id);
+		UA_NodeId_init(&parentId);
+		UA_Variant_init(&value);
+	}
+	void clear() {
+		UA_NodeId_clear(&id);
+		UA_NodeId_clear(&parentId);
+		UA_Variant_clear(&value);
+	}
+	UA_NodeId     id;           // numeric 0: assigned by the server
+	UA_NodeId     parentId;     // null: the parent passed to addNodes
+	size_t        parentIndex;  // 1 based index of a node created before by the same call
+	UA_NodeClass  nodeClass;    // object or variable
+	bool          folder;
+	std::string   browseName;
+	std::string   displayName;
+	UA_Variant    value;
+	UA_Byte       accessLevel;
+};
+
+static bool nodeSpecClass(const std::string& name, UA_NodeSpec& spec) {
+	if (name == "variable" || name.empty()) {
+		spec.nodeClass = UA_NODECLASS_VARIABLE;
+	} else if (name == "object") {
+		spec.nodeClass = UA_NODECLASS_OBJECT;
+	} else if (name == "folder") {
+		spec.nodeClass = UA_NODECLASS_OBJECT;
+		spec.folder = true;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// id: "" (assigned by the server), digits (numeric) or a string identifier
+static void nodeSpecId(const std::string& id, UA_UInt16 ns, UA_NodeId* out) {
+	if (id.empty()) {
+		*out = UA_NODEID_NUMERIC(ns, 0);
+	} else if (id.find_first_not_of("0123456789") == std::string::npos) {
+		*out = UA_NODEID_NUMERIC(ns, (UA_UInt32)strtoul(id.c_str(), NULL, 10));
+	} else {
+		*out = UA_NODEID_STRING_ALLOC(ns, id.c_str());
+	}
+}
+
+static const char* nodeSpecFromTable(sol::table entry, UA_UInt16 ns, size_t index, UA_NodeSpec& spec) {
+	if (!nodeSpecClass(entry.get_or<std::string>("class", ""), spec))
+		return "unknown class";
+	sol::object browseName = entry["browseName"];
+	if (browseName.get_type() != sol::type::string)
+		return "browseName missing";
+	spec.browseName = browseName.as<std::string>();
+	spec.displayName = entry.get_or<std::string>("displayName", spec.browseName);
+	sol::object id = entry["id"];
+	UA_NodeId nodeId;
+	if (toNodeId(id, &nodeId))
+		UA_NodeId_copy(&nodeId, &spec.id);
+	else if (id.get_type() == sol::type::number)
+		spec.id = UA_NODEID_NUMERIC(ns, id.as<UA_UInt32>());
+	else
+		nodeSpecId(id.get_type() == sol::type::string ? id.as<std::string>() : "", ns, &spec.id);
+	sol::object parent = entry["parent"];
+	if (parent.get_type() == sol::type::number) {
+		spec.parentIndex = parent.as<size_t>();
+		if (spec.parentIndex >= index)
+			return "parent must be created before";
+	} else if (toNodeId(parent, &nodeId)) {
+		UA_NodeId_copy(&nodeId, &spec.parentId);
+	}
+	if (spec.nodeClass == UA_NODECLASS_VARIABLE) {
+		spec.accessLevel = entry.get_or("accessLevel", spec.accessLevel);
+		int typeIndex = entry.get_or("type", -1);
+		if (typeIndex >= UA_TYPES_COUNT)
+			return "invalid type index";
+		const UA_DataType* type = typeIndex >= 0 ? &UA_TYPES[typeIndex] : NULL;
+		sol::object value = entry["value"];
+		if (value.valid() && value.get_type() != sol::type::lua_nil) {
+			if (!variantFromLua(value, type, &spec.value))
+				return "cannot convert value";
+		} else if (type != NULL) {
+			UA_Variant_setScalar(&spec.value, UA_new(type), type);  // default value of the type
+		}
+	}
+	return NULL;
+}
+
+// class,id,parent,browseName,type,value (see SERVER.md)
+static const char* nodeSpecFromCsv(sol::state_view& lua, const std::string& line, UA_UInt16 ns, size_t index, UA_NodeSpec& spec) {
+	std::vector<std::string> fields;
+	size_t start = 0;
+	for (;;) {
+		size_t end = line.find(',', start);
+		fields.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+		if (end == std::string::npos)
+			break;
+		start = end + 1;
+	}
+	fields.resize(6);
+	if (!nodeSpecClass(fields[0], spec))
+		return "unknown class";
+	if (fields[3].empty())
+		return "browseName missing";
+	nodeSpecId(fields[1], ns, &spec.id);
+	spec.parentIndex = strtoul(fields[2].c_str(), NULL, 10);
+	if (spec.parentIndex >= index)
+		return "parent must be created before";
+	spec.browseName = fields[3];
+	spec.displayName = fields[3];
+	if (spec.nodeClass == UA_NODECLASS_VARIABLE && !fields[4].empty()) {
+		int typeIndex = atoi(fields[4].c_str());
+		if (typeIndex < 0 || typeIndex >= UA_TYPES_COUNT)
+			return "invalid type index";
+		const UA_DataType* type = &UA_TYPES[typeIndex];
+		if (fields[5].empty()) {
+			UA_Variant_setScalar(&spec.value, UA_new(type), type);
+		} else if (typeIndex == UA_TYPES_INT64 || typeIndex == UA_TYPES_UINT64) {
+			// parsed as integer, a lua number (double) would round above 2^53
+			const char* str = fields[5].c_str();
+			char* end = NULL;
+			errno = 0;
+			void* data = UA_new(type);
+			if (typeIndex == UA_TYPES_INT64)
+				*(UA_Int64*)data = strtoll(str, &end, 10);
+			else if (fields[5].find('-') == std::string::npos)
+				*(UA_UInt64*)data = strtoull(str, &end, 10);
+			if (end == NULL || end == str || *end != '\0' || errno == ERANGE) {
+				UA_delete(data, type);
+				return "cannot convert value";
+			}
+			UA_Variant_setScalar(&spec.value, data, type);
+		} else {
+			sol::object value;
+			if (typeIndex == UA_TYPES_STRING || typeIndex == UA_TYPES_BYTESTRING)
+				value = sol::make_object(lua, fields[5]);
+			else if (typeIndex == UA_TYPES_BOOLEAN)
+				value = sol::make_object(lua, fields[5] == "true" || fields[5] == "1");
+			else
+				value = sol::make_object(lua, strtod(fields[5].c_str(), NULL));
+			if (!variantFromLua(value, type, &spec.value))
+				return "cannot convert value";
+		}
+	}
+	return NULL;
+}
+
 class UA_ServerConfig_Proxy {
 	UA_ServerConfig *_config;
 protected:
@@ -446,6 +898,9 @@ protected:
 	UA_Server_Proxy(UA_Server_Proxy& prox);
 	UA_Server* _server;
 	ServerNodeMgr* _mgr;
+	TOpcUA_ServerLock* _lock;
+	TOpcUA_ServerThread* _thread = NULL;
+	bool _started = false;                      // between startup and shutdown
 
 public:
 	UA_ServerConfig_Proxy *_config;
@@ -458,6 +913,7 @@ public:
 		UA_ServerConfig_setDefault(cc);
 		_config = new UA_ServerConfig_Proxy(cc);
 		_mgr = new ServerNodeMgr(_server);
+		_lock = _mgr->getLock();
 	}
 	UA_Server_Proxy(int port) {
 		_server = UA_Server_new();
@@ -465,6 +921,7 @@ public:
 		UA_ServerConfig_setDefault(cc);
 		_config = new UA_ServerConfig_Proxy(cc);
 		_mgr = new ServerNodeMgr(_server);
+		_lock = _mgr->getLock();
 	}
 	UA_Server_Proxy(int port, const std::string cert, const std::string pkey) {
 		_server = UA_Server_new();
@@ -490,83 +947,247 @@ public:
 #endif
 		_config = new UA_ServerConfig_Proxy(cc);
 		_mgr = new ServerNodeMgr(_server);
+		_lock = _mgr->getLock();
 	}
 	~UA_Server_Proxy() {
+		stopThread();
 		delete _config;
 		delete _mgr;
 		UA_Server_delete(_server);
+		_images.clear();                // lua may still hold an image
 
-		for (auto p : _callbacks) {
-			p->func = nullptr;
+		for (auto p : _tasks) {
+			delete p;
+		}
+		for (auto p : _writeGroups) {
 			delete p;
 		}
 	}
 
-	struct CallbackData {
-		std::function<void (void) > func;
-		UA_Server_Proxy* server;
+	// Repeated callbacks (addCallback). The server's timer only marks the task as due, the
+	// lua function runs as coroutine after the network processing of the tick (run / run_once).
+	// A callback which yields is resumed in the next tick, all tasks of a tick share the
+	// time budget (setCallbackBudget), the ones not reached go first in the next tick.
+	struct CallbackTask {
+		UA_UInt64 id;               // repeated callback in the server
+		sol::main_function func;    // bound to the main thread: addCallback may run in a callback's coroutine
+		sol::thread thread;         // of the current run, created from the main thread
+		sol::coroutine co;
+		std::atomic<bool> due;      // the interval elapsed, start with the next tick (set by the server thread)
+		bool running;               // yielded, resume with the next tick
+		bool removed;               // deleted by runTasks (the callback may remove itself)
 	};
-	/*
-		CallbackData(UA_Server_Proxy* server, sol::function f, sol::this_state& lua)
-			: _server(server), _runner_thread(sol::thread::create(lua))
-		{
-			_task = new sol::coroutine(_runner_thread.state(), f);
-		}
-		~CallbackData() {
-			delete _task;
-		}
-		void operator()() {
-			std::cout << "ServerCallback Start" << std::endl;
-			int ms = (*this->_task)();
-			std::cout << "ServerCallback End" << ms << std::endl;
-		}
-	private:
-		UA_Server_Proxy* _server;
-		sol::thread _runner_thread;
-		sol::coroutine* _task;
-	};
-	*/
-	std::list<CallbackData*> _callbacks;
+	std::list<CallbackTask*> _tasks;
+	UA_DateTime _taskBudget = 10 * UA_DATETIME_MSEC;
+	bool _inTasks = false;                      // a callback calls run_once
 
 	static void ServerCallback(UA_Server* server, void* data) {
-		CallbackData* p = (CallbackData*)data;
-		//(*p)();
-		p->func();
+		((CallbackTask*)data)->due = true;      // no lua inside the server's iteration
+	}
+	bool hasPendingTasks() {
+		for (auto p : _tasks) {
+			if (!p->removed && (p->due || p->running))
+				return true;
+		}
+		return false;
+	}
+	void runTasks() {
+		if (_inTasks)
+			return;
+		_inTasks = true;
+		UA_DateTime start = UA_DateTime_nowMonotonic();
+		size_t count = _tasks.size();           // not the tasks added by the callbacks
+		std::list<CallbackTask*>::iterator it = _tasks.begin();
+		for (size_t i = 0; i < count && it != _tasks.end(); ++i) {
+			CallbackTask* task = *it;
+			if (!task->removed && (task->due || task->running)) {
+				if (!task->running) {
+					task->thread = sol::thread::create(task->func.lua_state());
+					task->co = sol::coroutine(task->thread.state(), task->func);
+					task->due = false;
+					task->running = true;
+				}
+				sol::protected_function_result r = task->co(task->id);
+				if (task->co.status() != sol::call_status::yielded) {
+					if (!r.valid()) {
+						sol::error err = r;
+						UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, "Server callback %llu failed: %s",
+							(unsigned long long)task->id, err.what());
+					}
+					task->co = sol::coroutine();
+					task->thread = sol::thread();
+					task->running = false;
+				}
+			}
+			if (task->removed) {
+				delete task;
+				it = _tasks.erase(it);
+			} else {
+				++it;
+			}
+			if (UA_DateTime_nowMonotonic() - start >= _taskBudget) {
+				// budget used up, the tasks not reached go first in the next tick
+				_tasks.splice(_tasks.end(), _tasks, _tasks.begin(), it);
+				break;
+			}
+		}
+		_inTasks = false;
 	}
-	// TODO: for change and remove callback
-	UA_StatusCode addCallback(std::function<void(void)> func, int ms) {
-	//UA_StatusCode addCallback(sol::function f, int ms, sol::this_state L) {
+	// Returns the callback id (for removeCallback / changeCallbackInterval) or nil, error
+	sol::variadic_results addCallback(sol::function func, UA_Double ms, sol::this_state L) {
 		if (ms < 5)
 			ms = 5;
-		//CallbackData* p = new CallbackData(this, f, L);
-		CallbackData* p = new CallbackData();
-		p->func = func;
-		p->server = this;
-
-		_callbacks.push_back(p);
-		return UA_Server_addRepeatedCallback(_server, &UA_Server_Proxy::ServerCallback, p, ms, NULL);
+		CallbackTask* task = new CallbackTask();
+		task->id = 0;
+		task->func = sol::main_function(sol::main_thread(L, L), func);
+		task->due = false;
+		task->running = false;
+		task->removed = false;
+		TOpcUA_ServerLock::Guard guard(_lock);
+		UA_StatusCode re = UA_Server_addRepeatedCallback(_server, &UA_Server_Proxy::ServerCallback, task, ms, &task->id);
+		if (re != UA_STATUSCODE_GOOD) {
+			delete task;
+			RETURN_ERROR(UA_StatusCode_name(re))
+		}
+		_tasks.push_back(task);
+		RETURN_RESULT(UA_UInt64, task->id)
+	}
+	CallbackTask* findTask(UA_UInt64 id) {
+		for (auto p : _tasks) {
+			if (p->id == id && !p->removed)
+				return p;
+		}
+		return NULL;
+	}
+	// A running (yielded) callback is not resumed again
+	UA_StatusCode removeCallback(UA_UInt64 id) {
+		CallbackTask* task = findTask(id);
+		if (task == NULL)
+			return UA_STATUSCODE_BADNOTFOUND;
+		TOpcUA_ServerLock::Guard guard(_lock);
+		UA_Server_removeRepeatedCallback(_server, id);
+		task->removed = true;
+		return UA_STATUSCODE_GOOD;
+	}
+	UA_StatusCode changeCallbackInterval(UA_UInt64 id, UA_Double ms) {
+		if (findTask(id) == NULL)
+			return UA_STATUSCODE_BADNOTFOUND;
+		if (ms < 5)
+			ms = 5;
+		TOpcUA_ServerLock::Guard guard(_lock);
+		return UA_Server_changeRepeatedCallbackInterval(_server, id, ms);
+	}
+	void setCallbackBudget(UA_Double ms) {
+		_taskBudget = (UA_DateTime)(ms * UA_DATETIME_MSEC);
 	}
 
+	// Startup (unless done for the network thread), the loop and shutdown
 	UA_StatusCode run() {
-		return UA_Server_run(_server, &_running);
+		if (!_started) {
+			UA_StatusCode re = startup();
+			if (re != UA_STATUSCODE_GOOD)
+				return re;
+		}
+		while (_running) {
+			if (_thread) {
+				// the server thread does the network processing, serve its calls to lua
+				_thread->WaitForCalls(hasPendingTasks() ? 0 : 10);
+				poll();
+				continue;
+			}
+			// don't wait for network events while callbacks are due or suspended
+			UA_Server_run_iterate(_server, !hasPendingTasks());
+			flushWrites();
+			runTasks();
+		}
+		return shutdown();
 	}
 
 	UA_StatusCode startup() {
-		return UA_Server_run_startup(_server);
+		TOpcUA_ServerLock::Guard guard(_lock);
+		UA_StatusCode re = UA_Server_run_startup(_server);
+		_started = re == UA_STATUSCODE_GOOD;
+		return re;
 	}
 	UA_UInt16 run_once(bool waitInternal) {
-		return UA_Server_run_iterate(_server, waitInternal);
+		if (_thread) {
+			_thread->WaitForCalls(waitInternal && !hasPendingTasks() ? 10 : 0);
+			poll();
+			return 0;
+		}
+		UA_UInt16 timeout = UA_Server_run_iterate(_server, waitInternal && !hasPendingTasks());
+		flushWrites();
+		runTasks();
+		return timeout;
 	}
 	UA_StatusCode shutdown() {
+		if (!stopThread())
+			return UA_STATUSCODE_BADINVALIDSTATE;   // from a call of the network thread
+		if (!_started)
+			return UA_STATUSCODE_GOOD;
+		_started = false;
 		return UA_Server_run_shutdown(_server);
 	}
 
+	// Run the network processing in a background thread (after startup), every intervalMs
+	// (default 5). The lua callbacks (value callbacks, data sources, methods) are called by
+	// poll (or run / run_once) in the lua thread, the server thread doesn't wait for them:
+	// reads return the value lua gave last (refreshed by a queued call), writes are queued,
+	// methods are async operations. Only builds without those wait up to callTimeoutMs
+	// (default 1000) for a method call. Refused if a data source has a lua write handler
+	// (its status could not be returned).
+	sol::variadic_results startNetworkThread(sol::optional<UA_UInt32> intervalMs, sol::optional<UA_UInt32> callTimeoutMs, sol::this_state L) {
+		if (_thread)
+			RETURN_ERROR("network thread already running")
+		if (!_started)
+			RETURN_ERROR("server not started, call startup first")
+		if (_mgr->hasDataSourceWriter())
+			RETURN_ERROR("a data source has a write handler, its writes need the lua thread")
+		_thread = new TOpcUA_ServerThread(_server, _lock, intervalMs.value_or(5), callTimeoutMs.value_or(1000));
+		setMethodsAsync(true);
+		_thread->Start();
+		RETURN_OK(bool, true)
+	}
+	// The calls not polled yet are dropped (a waiting read or method call fails)
+	sol::variadic_results stopNetworkThread(sol::this_state L) {
+		if (!stopThread())
+			RETURN_ERROR("cannot stop the network thread from its own call")
+		RETURN_OK(bool, true)
+	}
+	// false inside a call of the server thread (poll): it waits for the call, Stop would deadlock
+	bool stopThread() {
+		if (!_thread)
+			return true;
+		if (_thread->IsPolling())
+			return false;
+		TOpcUA_ServerThread* thread = _thread;
+		_thread = NULL;
+		thread->Stop();
+		delete thread;
+		setMethodsAsync(false);
+		return true;
+	}
+	// Readable while calls of the network thread are pending (for an external event loop), -1 without
+	int getPollFd() {
+		return _thread ? _thread->GetPollFd() : -1;
+	}
+	// Run the calls queued by the server thread, then the due callbacks (addCallback) and
+	// the collected writes (watchWrites). Returns the number of calls
+	size_t poll() {
+		size_t count = _thread ? _thread->Poll() : 0;
+		flushWrites();
+		runTasks();
+		return count;
+	}
+
 	UA_UInt16 addNamespace(const std::string& namespaceUri) {
+		TOpcUA_ServerLock::Guard guard(_lock);
 		return UA_Server_addNamespace(_server, namespaceUri.c_str());
 	}
 	sol::variadic_results getNamespaceByName(const std::string& namespaceUri, sol::this_state L) {
 		size_t index = 0;
 		UA_String uri = UA_STRING((char*)namespaceUri.c_str());
+		TOpcUA_ServerLock::Guard guard(_lock);
 		UA_StatusCode re = UA_Server_getNamespaceByName(_server, uri, &index);
 		RETURN_RESULT(size_t, index)
 	}
@@ -618,9 +1239,363 @@ public:
 		return deleteNode(node._id, deleteReferences);
 	}
 
+	// Process images: the variables mapped onto an image are read by the server
+	// straight from its buffer (see TOpcUA_ProcessImage), lua only updates the buffer.
+	// Shared by lua and the servers with variables on it (their node contexts).
+	std::list<std::shared_ptr<TOpcUA_ProcessImage> > _images;
+
+	std::shared_ptr<TOpcUA_ProcessImage> newProcessImage(size_t size) {
+		std::shared_ptr<TOpcUA_ProcessImage> image = std::make_shared<TOpcUA_ProcessImage>(size);
+		_images.push_back(image);
+		return image;
+	}
+	sol::variadic_results addProcessImageVariable(const UA_Node& parent, const UA_NodeId id, const char* browse,
+			const UA_VariableAttributes attr, std::shared_ptr<TOpcUA_ProcessImage> image, size_t offset, int typeIndex,
+			sol::optional<size_t> count, sol::this_state L) {
+		if (!image)
+			RETURN_ERROR("invalid image")
+		if (typeIndex < 0 || typeIndex >= UA_TYPES_COUNT)
+			RETURN_ERROR("invalid type index")
+		const UA_DataType* type = &UA_TYPES[typeIndex];
+		TOpcUA_ProcessImage::Var* var = image->AddVar(offset, type, count.value_or(0));
+		if (var == NULL)
+			RETURN_ERROR("type is not pointer free or does not fit into the image")
+		UA_VariableAttributes a = attr;     // shallow, only the type is changed
+		a.dataType = type->typeId;
+		a.valueRank = var->Count > 0 ? UA_VALUERANK_ONE_DIMENSION : UA_VALUERANK_SCALAR;
+		UA_QualifiedName browse_name = UA_QUALIFIEDNAME_ALLOC(id.namespaceIndex, browse);
+		AutoReleaseNodeId outId;
+		TOpcUA_ServerLock::Guard guard(_lock);
+		UA_StatusCode re = UA_Server_addDataSourceVariableNode(_server, id, parent._id, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+			browse_name, UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), a, TOpcUA_ProcessImage::GetDataSource(), var, outId);
+		UA_QualifiedName_clear(&browse_name);
+		if (re != UA_STATUSCODE_GOOD)
+			image->RemoveVar(var);
+		else if (std::find(_images.begin(), _images.end(), image) == _images.end())
+			_images.push_back(image);   // an image of another server, the node needs it
+		RETURN_RESULT(UA_Node, UA_Node(_mgr, *outId, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES), UA_NODECLASS_VARIABLE))
+	}
+
+	// Create a whole subtree in one call: spec is a table of node tables or CSV lines (see SERVER.md).
+	// Returns the number of created nodes, a table with the status of each node and one with the node ids
+	sol::variadic_results addNodes(const UA_Node& parent, sol::object spec, sol::optional<int> nsIndex, sol::this_state L) {
+		sol::state_view lua(L);
+		UA_UInt16 ns = (UA_UInt16)nsIndex.value_or(parent._id.namespaceIndex);
+		std::vector<UA_NodeSpec> specs;
+		std::vector<UA_StatusCode> statuses;
+		const char* err = NULL;
+		size_t parsed = 0;
+		if (spec.get_type() == sol::type::table) {
+			sol::table tbl = spec.as<sol::table>();
+			size_t count = tbl.size();
+			specs.resize(count);
+			for (size_t i = 0; i < count && err == NULL; ++i) {
+				sol::object entry = tbl[++parsed];
+				err = entry.get_type() == sol::type::table ? nodeSpecFromTable(entry.as<sol::table>(), ns, i + 1, specs[i]) : "table expected";
+			}
+		} else if (spec.get_type() == sol::type::string) {
+			std::string csv = spec.as<std::string>();
+			size_t start = 0;
+			while (start < csv.length() && err == NULL) {
+				size_t end = csv.find('\n', start);
+				if (end == std::string::npos)
+					end = csv.length();
+				std::string line = csv.substr(start, end - start);
+				start = end + 1;
+				if (!line.empty() && line[line.length() - 1] == '\r')
+					line.erase(line.length() - 1);
+				if (line.empty() || line[0] == '#')
+					continue;
+				specs.push_back(UA_NodeSpec());
+				parsed++;
+				err = nodeSpecFromCsv(lua, line, ns, specs.size(), specs.back());
+			}
+		} else {
+			err = "table or string expected";
+		}
+		if (err != NULL) {
+			std::string msg = std::string(err) + " (node " + std::to_string(parsed) + ")";
+			for (size_t i = 0; i < specs.size(); ++i)
+				specs[i].clear();
+			RETURN_ERROR(msg)
+		}
+
+		// all lua work is done, now create the nodes natively
+		std::vector<UA_NodeId> created(specs.size());
+		statuses.resize(specs.size());
+		size_t good = 0;
+		TOpcUA_ServerLock::Guard guard(_lock);
+		for (size_t i = 0; i < specs.size(); ++i) {
+			UA_NodeSpec& s = specs[i];
+			UA_NodeId_init(&created[i]);
+			UA_NodeId parentId = parent._id;
+			if (s.parentIndex > 0) {
+				if (statuses[s.parentIndex - 1] != UA_STATUSCODE_GOOD) {
+					statuses[i] = UA_STATUSCODE_BADPARENTNODEIDINVALID;
+					continue;
+				}
+				parentId = created[s.parentIndex - 1];
+			} else if (!UA_NodeId_isNull(&s.parentId)) {
+				parentId = s.parentId;
+			}
+			UA_QualifiedName browseName = UA_QUALIFIEDNAME(ns, (char*)s.browseName.c_str());
+			UA_LocalizedText displayName = UA_LOCALIZEDTEXT((char*)"", (char*)s.displayName.c_str());
+			if (s.nodeClass == UA_NODECLASS_OBJECT) {
+				UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+				attr.displayName = displayName;
+				statuses[i] = UA_Server_addObjectNode(_server, s.id, parentId, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES), browseName,
+					UA_NODEID_NUMERIC(0, s.folder ? UA_NS0ID_FOLDERTYPE : UA_NS0ID_BASEOBJECTTYPE), attr, NULL, &created[i]);
+			} else {
+				UA_VariableAttributes attr = UA_VariableAttributes_default;
+				attr.displayName = displayName;
+				attr.accessLevel = s.accessLevel;
+				if (s.value.type != NULL) {
+					attr.value = s.value;   // shallow, copied by the server
+					attr.dataType = s.value.type->typeId;
+					if (UA_Variant_isScalar(&s.value))
+						attr.valueRank = UA_VALUERANK_SCALAR;
+					else
+						attr.valueRank = s.value.arrayDimensionsSize > 1 ? (UA_Int32)s.value.arrayDimensionsSize : UA_VALUERANK_ONE_DIMENSION;
+				}
+				statuses[i] = UA_Server_addVariableNode(_server, s.id, parentId, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES), browseName,
+					UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), attr, NULL, &created[i]);
+			}
+			if (statuses[i] == UA_STATUSCODE_GOOD)
+				good++;
+		}
+
+		sol::table statusTable = lua.create_table(specs.size(), 0);
+		sol::table idTable = lua.create_table(specs.size(), 0);
+		for (size_t i = 0; i < specs.size(); ++i) {
+			statusTable[i + 1] = statuses[i];
+			idTable[i + 1] = created[i];    // the lua object owns the id from now on
+			specs[i].clear();
+		}
+		sol::variadic_results result;
+		result.push_back({ L, sol::in_place_type<size_t>, good });
+		result.push_back(statusTable);
+		result.push_back(idTable);
+		return result;
+	}
+
+	// NodeSet2 import: the structure definitions of the file go into the type DB,
+	// so their values can be (de)serialized like on the client side (see getTypeInfo)
+	he::Symbols::TypeDB _db;
+
+	sol::variadic_results importNodeSet(const std::string& path, sol::this_state L) {
+		sol::state_view lua(L);
+		TOpcUA_ServerLock::Guard guard(_lock);
+		TOpcUA_NodeSetImporter importer(_server, &_db);
+		if (importer.Import(path.c_str()) != UA_STATUSCODE_GOOD)
+			RETURN_ERROR(importer.GetError())
+		const TOpcUA_NodeSetImporter::Stats& stats = importer.GetStats();
+		sol::table info = lua.create_table(0, 5);
+		info["nodes"] = stats.cntNodes;
+		info["existing"] = stats.cntExisting;
+		info["references"] = stats.cntReferences;
+		info["types"] = stats.cntTypes;
+		info["failed"] = stats.cntFailed;
+		RETURN_OK(sol::table, info)
+	}
+	// type: the data type (NodeId, its string or Node) or the name of the structure
+	sol::variadic_results getTypeInfo(sol::object type, sol::this_state L) {
+		std::string typeName;
+		UA_NodeId id;
+		if (toNodeId(type, &id))
+			typeName = toString(id);
+		else if (type.get_type() == sol::type::string)
+			typeName = type.as<std::string>();
+		// the types are kept by name, the data type id maps to it
+		const std::string* name = _db.FindTypeNameById(typeName);
+		if (name)
+			typeName = *name;
+		if (!_db.HasTypeByName(typeName))
+			RETURN_ERROR("Type not found!")
+		RETURN_OK(TypeNode_Proxy, TypeNode_Proxy(_db, _db.FindTypeByName(typeName)))
+	}
+
+	// Value store: lua pushes the values into the nodes with writeValues (one native call), the
+	// reads and the subscriptions (sampling) of the server's clients are served from the nodes
+	// without calling lua. The clients' writes to watched nodes (watchWrites) are collected, the
+	// last value per node, and handed to lua once per tick (run / run_once).
+	struct WriteGroup;
+	struct WriteWatch {
+		UA_NodeId id;
+		UA_DataValue value;         // last written by a client
+		bool pending;
+		WriteGroup* group;
+		UA_Server_Proxy* proxy;
+		~WriteWatch() {
+			UA_NodeId_clear(&id);
+			UA_DataValue_clear(&value);
+		}
+	};
+	struct WriteGroup {
+		sol::main_function func;    // func(node_ids, data_values), bound to the main thread (see CallbackTask)
+		std::vector<WriteWatch*> watches;
+		std::vector<WriteWatch*> pending;
+		~WriteGroup() {
+			for (auto w : watches)
+				delete w;
+		}
+	};
+	std::list<WriteGroup*> _writeGroups;
+	bool _storingValues = false;    // writeValues is running, not a client write
+
+	static void WriteWatchCallback(UA_Server *server, const UA_NodeId *sessionId,
+			void *sessionContext, const UA_NodeId *nodeId, void *nodeContext,
+			const UA_NumericRange *range, const UA_DataValue *data) {
+		WriteWatch* w = (WriteWatch*)nodeContext;
+		if (w == NULL || w->proxy->_storingValues)
+			return;
+		UA_DataValue_clear(&w->value);
+		if (range) {
+			// partial write, hand over the whole value
+			if (UA_Server_readValue(server, *nodeId, &w->value.value) == UA_STATUSCODE_GOOD)
+				w->value.hasValue = true;
+			w->value.sourceTimestamp = UA_DateTime_now();
+			w->value.hasSourceTimestamp = true;
+		} else {
+			UA_DataValue_copy(data, &w->value);
+		}
+		if (!w->pending) {
+			w->pending = true;
+			w->group->pending.push_back(w);
+		}
+	}
+	void flushWrites() {
+		for (auto group : _writeGroups) {
+			std::vector<WriteWatch*> pending;
+			std::vector<UA_DataValue> taken;
+			{
+				// the server thread collects the writes
+				TOpcUA_ServerLock::Guard guard(_lock);
+				pending.swap(group->pending);   // the callback may write again
+				taken.resize(pending.size());
+				for (size_t i = 0; i < pending.size(); ++i) {
+					taken[i] = pending[i]->value;
+					UA_DataValue_init(&pending[i]->value);
+					pending[i]->pending = false;
+				}
+			}
+			if (pending.empty())
+				continue;
+			sol::state_view lua(group->func.lua_state());
+			sol::table ids = lua.create_table(pending.size(), 0);
+			sol::table values = lua.create_table(pending.size(), 0);
+			for (size_t i = 0; i < pending.size(); ++i) {
+				UA_NodeId id;
+				UA_NodeId_copy(&pending[i]->id, &id);
+				ids[i + 1] = id;                // the lua objects own the id and the value from now on
+				values[i + 1] = taken[i];
+			}
+			sol::protected_function func = group->func;
+			sol::protected_function_result r = func(ids, values);
+			if (!r.valid()) {
+				sol::error err = r;
+				UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, "Server write callback failed: %s", err.what());
+			}
+		}
+	}
+	// items: { {node|NodeId, value}, ... }, value is a Variant, DataValue or lua value (converted to
+	// the data type of the node). All items are converted first, then written natively in one go.
+	// Returns table of StatusCodes (same order) or nil, error
+	sol::variadic_results writeValues(sol::table items, sol::this_state L) {
+		size_t count = items.size();
+		TOpcUA_ServerLock::Guard guard(_lock);
+		std::vector<UA_WriteValue> values(count);
+		std::vector<size_t> converted;      // indexes of the values converted from lua (owned)
+		UA_DateTime now = UA_DateTime_now();
+		size_t invalid = 0;
+		for (size_t i = 0; i < count && invalid == 0; ++i) {
+			UA_WriteValue& wv = values[i];
+			UA_WriteValue_init(&wv);
+			wv.attributeId = UA_ATTRIBUTEID_VALUE;
+			sol::object entry = items.get<sol::object>(i + 1);
+			if (entry.get_type() != sol::type::table || !toNodeId(entry.as<sol::table>().get<sol::object>(1), &wv.nodeId)) {
+				invalid = i + 1;
+				break;
+			}
+			sol::object value = entry.as<sol::table>().get<sol::object>(2);
+			if (value.is<UA_DataValue>()) {
+				wv.value = value.as<UA_DataValue&>();
+				continue;
+			}
+			if (value.is<UA_Variant>()) {
+				wv.value.value = value.as<UA_Variant&>();
+			} else {
+				const UA_DataType* type = NULL;
+				UA_NodeId typeId;
+				if (UA_Server_readDataType(_server, wv.nodeId, &typeId) == UA_STATUSCODE_GOOD) {
+					type = UA_findDataType(&typeId);
+					UA_NodeId_clear(&typeId);
+				}
+				if (!variantFromLua(value, type, &wv.value.value)) {
+					invalid = i + 1;
+					break;
+				}
+				converted.push_back(i);
+			}
+			wv.value.hasValue = true;
+			wv.value.sourceTimestamp = now;
+			wv.value.hasSourceTimestamp = true;
+		}
+		if (invalid == 0) {
+			std::vector<UA_StatusCode> results(count);
+			_storingValues = true;
+			for (size_t i = 0; i < count; ++i)
+				results[i] = UA_Server_write(_server, &values[i]);
+			_storingValues = false;
+			for (size_t i : converted)
+				UA_Variant_clear(&values[i].value.value);
+			sol::state_view lua(L);
+			sol::table results_table = lua.create_table(count, 0);
+			for (size_t i = 0; i < count; ++i)
+				results_table[i + 1] = results[i];
+			RETURN_OK(sol::table, results_table)
+		}
+		for (size_t i : converted)
+			UA_Variant_clear(&values[i].value.value);
+		RETURN_ERROR("invalid write item " + std::to_string(invalid))
+	}
+	// Watch the writes of the server's clients to the variables (replaces their node context and
+	// value callback), func(node_ids, data_values) is called once per tick with the last value
+	// written to each node. Returns the number of watched nodes or nil, error
+	sol::variadic_results watchWrites(sol::table nodes, sol::function func, sol::this_state L) {
+		std::vector<UA_NodeId> ids(nodes.size());
+		for (size_t i = 0; i < ids.size(); ++i) {
+			if (!toNodeId(nodes.get<sol::object>(i + 1), &ids[i]))
+				RETURN_ERROR("invalid node " + std::to_string(i + 1))
+		}
+		TOpcUA_ServerLock::Guard guard(_lock);
+		WriteGroup* group = new WriteGroup();
+		group->func = sol::main_function(sol::main_thread(L, L), func);
+		_writeGroups.push_back(group);
+		UA_ValueCallback callback;
+		callback.onRead = NULL;
+		callback.onWrite = &UA_Server_Proxy::WriteWatchCallback;
+		UA_StatusCode re = UA_STATUSCODE_GOOD;
+		for (size_t i = 0; i < ids.size() && re == UA_STATUSCODE_GOOD; ++i) {
+			WriteWatch* w = new WriteWatch();
+			UA_NodeId_copy(&ids[i], &w->id);
+			UA_DataValue_init(&w->value);
+			w->pending = false;
+			w->group = group;
+			w->proxy = this;
+			group->watches.push_back(w);
+			re = UA_Server_setNodeContext(_server, ids[i], w);
+			if (re == UA_STATUSCODE_GOOD)
+				re = UA_Server_setVariableNode_valueCallback(_server, ids[i], callback);
+		}
+		if (re != UA_STATUSCODE_GOOD)       // the nodes before stay watched
+			RETURN_ERROR("node " + std::to_string(group->watches.size()) + ": " + UA_StatusCode_name(re))
+		RETURN_OK(size_t, group->watches.size())
+	}
+
 	UA_StatusCode setVariableNode_valueCallback(const UA_NodeId nodeId,
 			UA_ValueCallback_Proxy* callback) {
 		callback->_proxy = this; // Set the callback
+		TOpcUA_ServerLock::Guard guard(_lock);
 		UA_StatusCode re = UA_Server_setNodeContext(_server, nodeId, callback);
 		if (re == UA_STATUSCODE_GOOD) {
 			return UA_Server_setVariableNode_valueCallback(_server, nodeId, callback->_callback);
@@ -639,9 +1614,23 @@ public:
 	struct MethodCallbackData {
 		MethodCallbackFunction func;
 		UA_Server_Proxy* server;
+		UA_NodeId methodId;
+		~MethodCallbackData() {
+			UA_NodeId_clear(&methodId);
+		}
 	};
 	std::list<MethodCallbackData*> _method_callbacks;
 
+	// With the network thread the methods are async operations: the server thread hands the
+	// calls to lua without waiting (see TOpcUA_ServerThread). Without them a call waits for lua.
+	void setMethodsAsync(bool isAsync) {
+#if UA_MULTITHREADING >= 100
+		TOpcUA_ServerLock::Guard guard(_lock);
+		for (auto p : _method_callbacks)
+			UA_Server_setMethodNode_async(_server, p->methodId, isAsync);
+#endif
+	}
+
 
 	static UA_StatusCode MethodCallback(UA_Server *server, const UA_NodeId *sessionId,
                      void *sessionContext, const UA_NodeId *methodId,
@@ -650,6 +1639,13 @@ public:
                      const UA_Variant *input, size_t outputSize,
                      UA_Variant *output) {
 			auto p = (MethodCallbackData*)objectContext;
+			TOpcUA_ServerThread* thread = TOpcUA_ServerThread::Current();
+			if (thread) {
+				// called by the server thread (no async operations in this build), wait for lua
+				UA_StatusCode re = UA_STATUSCODE_BADTIMEOUT;
+				thread->Invoke([&]() { re = p->func(*p->server, sessionId, sessionContext, methodId, methodContext, objectId, objectContext, inputSize, input, outputSize, output); });
+				return re;
+			}
 			return p->func(*p->server, sessionId, sessionContext, methodId, methodContext, objectId, objectContext, inputSize, input, outputSize, output);
 	}
 
@@ -657,17 +1653,22 @@ public:
 		auto p = new MethodCallbackData();
 		p->server = this;
 		p->func = func;
+		UA_NodeId_copy(&methodNodeId, &p->methodId);
 		_method_callbacks.push_back(p);
 		/*
 		UA_Server_getNodeContext(_server, methodNodeId, &pfunc);
 		if (pfunc) {
 		}
 		*/
+		TOpcUA_ServerLock::Guard guard(_lock);
 		auto ret = UA_Server_setNodeContext(_server, methodNodeId, p);
 		if (UA_STATUSCODE_GOOD == ret)
-			return UA_Server_setMethodNode_callback(_server, methodNodeId, &UA_Server_Proxy::MethodCallback);
-		else
-			return ret;
+			ret = UA_Server_setMethodNode_callback(_server, methodNodeId, &UA_Server_Proxy::MethodCallback);
+#if UA_MULTITHREADING >= 100
+		if (UA_STATUSCODE_GOOD == ret && _thread)
+			ret = UA_Server_setMethodNode_async(_server, methodNodeId, true);
+#endif
+		return ret;
 	}
 };
 
@@ -682,7 +1683,16 @@ void UA_ValueCallback_Proxy::ReadCallback(UA_Server *server, const UA_NodeId *se
 		printf("ReadCallback Error!!!\n");
 		return;
 	}
-	if (p->_read) {
+	TOpcUA_ServerThread* thread = TOpcUA_ServerThread::Current();
+	if (p->_read && thread) {
+		// called by the server thread: the read returns the value lua wrote into the node last,
+		// the callback runs in the lua thread to update it for the next read
+		if (p->_cache->refreshing.exchange(true))
+			return;
+		std::shared_ptr<UA_RefreshToken> token = std::make_shared<UA_RefreshToken>(p->_cache);
+		std::shared_ptr<UA_QueuedValue> r = std::make_shared<UA_QueuedValue>(sessionId, sessionContext, nodeId, range, value);
+		thread->Post([p, r, token]() { p->_read(p->_proxy, &r->sessionId, r->sessionContext, &r->nodeId, r->getRange(), &r->value); });
+	} else if (p->_read) {
 		p->_read(p->_proxy, sessionId, sessionContext, nodeId, range, value);
 	}
 }
@@ -698,7 +1708,12 @@ void UA_ValueCallback_Proxy::WriteCallback(UA_Server *server, const UA_NodeId *s
 		printf("ReadCallback Error!!!\n");
 		return;
 	}
-	if (p->_write) {
+	TOpcUA_ServerThread* thread = TOpcUA_ServerThread::Current();
+	if (p->_write && thread) {
+		// called by the server thread, queued for lua
+		std::shared_ptr<UA_QueuedValue> w = std::make_shared<UA_QueuedValue>(sessionId, sessionContext, nodeId, range, data);
+		thread->Post([p, w]() { p->_write(p->_proxy, &w->sessionId, w->sessionContext, &w->nodeId, w->getRange(), &w->value); });
+	} else if (p->_write) {
 		p->_write(p->_proxy, sessionId, sessionContext, nodeId, range, data);
 	}
 }
@@ -707,6 +1722,14 @@ void reg_opcua_server(sol::table& module) {
 	module.new_usertype<UA_ValueCallback_Proxy>("ValueCallback",
 		sol::constructors<UA_ValueCallback_Proxy(UA_ValueCallback_Proxy::OnReadCallback, UA_ValueCallback_Proxy::OnWriteCallback)>()
 	);
+	module.new_usertype<TOpcUA_ProcessImage>("ProcessImage",
+		"new", sol::no_constructor,
+		"size", sol::readonly_property(&TOpcUA_ProcessImage::GetSize),
+		"write", &UA_ProcessImage_Proxy::write,
+		"read", &UA_ProcessImage_Proxy::read,
+		"setValue", &UA_ProcessImage_Proxy::setValue,
+		"getValue", &UA_ProcessImage_Proxy::getValue
+	);
 	module.new_usertype<UA_ServerConfig_Proxy>("ServerConfig",
 		"new", sol::no_constructor, 
 		"setProductURI", &UA_ServerConfig_Proxy::setProductURI,
@@ -718,10 +1741,17 @@ void reg_opcua_server(sol::table& module) {
 		"running", sol::readonly(&UA_Server_Proxy::_running),
 		"config", &UA_Server_Proxy::_config,
 		"addCallback", &UA_Server_Proxy::addCallback,
+		"removeCallback", &UA_Server_Proxy::removeCallback,
+		"changeCallbackInterval", &UA_Server_Proxy::changeCallbackInterval,
+		"setCallbackBudget", &UA_Server_Proxy::setCallbackBudget,
 		"run", &UA_Server_Proxy::run,
 		"startup", &UA_Server_Proxy::startup,
 		"run_once", &UA_Server_Proxy::run_once,
 		"shutdown", &UA_Server_Proxy::shutdown,
+		"startNetworkThread", &UA_Server_Proxy::startNetworkThread,
+		"stopNetworkThread", &UA_Server_Proxy::stopNetworkThread,
+		"poll", &UA_Server_Proxy::poll,
+		"getPollFd", &UA_Server_Proxy::getPollFd,
 		"addNamespace", &UA_Server_Proxy::addNamespace,
 		"getNodeMgr", &UA_Server_Proxy::getNodeMgr,
 		"getObjectsNode", &UA_Server_Proxy::getObjectsNode,
@@ -740,7 +1770,14 @@ void reg_opcua_server(sol::table& module) {
 			static_cast<UA_StatusCode (UA_Server_Proxy::*)(const UA_Node&, bool) >(&UA_Server_Proxy::deleteNode)
 		),
 		"setVariableNode_valueCallback", &UA_Server_Proxy::setVariableNode_valueCallback,
-		"setMethodCallback", &UA_Server_Proxy::setMethodCallback
+		"setMethodCallback", &UA_Server_Proxy::setMethodCallback,
+		"addNodes", &UA_Server_Proxy::addNodes,
+		"newProcessImage", &UA_Server_Proxy::newProcessImage,
+		"addProcessImageVariable", &UA_Server_Proxy::addProcessImageVariable,
+		"importNodeSet", &UA_Server_Proxy::importNodeSet,
+		"writeValues", &UA_Server_Proxy::writeValues,
+		"watchWrites", &UA_Server_Proxy::watchWrites,
+		"getTypeInfo", &UA_Server_Proxy::getTypeInfo
 	);
 
 	module.new_usertype<ServerNodeMgr>("ServerNodeMgr",
@@ -1,5 +1,9 @@
+#include <cmath>
 #include <iomanip>
+#include <limits>
 #include <map>
+#include <type_traits>
+#include <vector>
 //#include <iostream>
 #ifdef _WIN32
 #include <rpc.h>
@@ -90,18 +94,455 @@ const static std::map<size_t, const char*> DataValueTypeMap = {
 	{UA_TYPES_STATUSCODE, "statuscode"},
 };
 
+// NS0 numeric type id => name. The builtin types have small ids, so a table indexed
+// by the id is enough (built once).
+static std::vector<const char*> buildNs0TypeNames() {
+	std::vector<const char*> names;
+	for (auto & entry : DataValueTypeMap) {
+		UA_UInt32 id = UA_TYPES[entry.first].typeId.identifier.numeric;
+		if (id >= names.size())
+			names.resize(id + 1, NULL);
+		names[id] = entry.second;
+	}
+	return names;
+}
+
 const char* get_node_data_value_type(const UA_NodeId& typeId) {
-    for(size_t i = 0; i < UA_TYPES_COUNT; ++i) {
-		if (UA_NodeId_equal(&typeId, &UA_TYPES[i].typeId)) {
-			auto ptr = DataValueTypeMap.find(i);
-			if (ptr != DataValueTypeMap.end()) {
-				return ptr->second;
-			}
-		}
+	static const std::vector<const char*> names = buildNs0TypeNames();
+	if (typeId.namespaceIndex == 0 && typeId.identifierType == UA_NODEIDTYPE_NUMERIC &&
+		typeId.identifier.numeric < names.size() && names[typeId.identifier.numeric] != NULL) {
+		return names[typeId.identifier.numeric];
 	}
 	return "unknown";
 }
 
+//---------------------------------------------------------------------------
+// Integer element from the lua number at index. Lua integers (5.3) are taken exactly, only
+// numbers with a fraction go through double (truncated). false if out of the range of T.
+template<typename T>
+static bool integerFromLua(lua_State* L, int index, T* out) {
+#if LUA_VERSION_NUM >= 503
+	int isnum = 0;
+	lua_Integer n = lua_tointegerx(L, index, &isnum);
+	if (isnum) {
+		if (n < 0 ? !std::numeric_limits<T>::is_signed || n < (lua_Integer)std::numeric_limits<T>::min()
+				  : (unsigned long long)n > (unsigned long long)std::numeric_limits<T>::max())
+			return false;
+		*out = (T)n;
+		return true;
+	}
+#endif
+	if (!lua_isnumber(L, index))
+		return false;
+	lua_Number num = std::trunc(lua_tonumber(L, index));
+	// max + 1 is a power of two, exact as double also for 64 bit (NaN fails too)
+	if (!(num >= (lua_Number)std::numeric_limits<T>::min() && num < (lua_Number)std::numeric_limits<T>::max() + 1))
+		return false;
+	*out = (T)num;
+	return true;
+}
+
+// Element of a numeric builtin type (by index in UA_TYPES) from the lua number at index
+static bool numberFromLua(lua_State* L, int index, int typeIndex, void* p) {
+	switch (typeIndex) {
+	case UA_TYPES_BOOLEAN:    *(UA_Boolean*)p = lua_tonumber(L, index) != 0; return true;
+	case UA_TYPES_SBYTE:      return integerFromLua(L, index, (UA_SByte*)p);
+	case UA_TYPES_BYTE:       return integerFromLua(L, index, (UA_Byte*)p);
+	case UA_TYPES_INT16:      return integerFromLua(L, index, (UA_Int16*)p);
+	case UA_TYPES_UINT16:     return integerFromLua(L, index, (UA_UInt16*)p);
+	case UA_TYPES_INT32:      return integerFromLua(L, index, (UA_Int32*)p);
+	case UA_TYPES_UINT32:
+	case UA_TYPES_STATUSCODE: return integerFromLua(L, index, (UA_UInt32*)p);
+	case UA_TYPES_INT64:
+	case UA_TYPES_DATETIME:   return integerFromLua(L, index, (UA_Int64*)p);
+	case UA_TYPES_UINT64:     return integerFromLua(L, index, (UA_UInt64*)p);
+	case UA_TYPES_FLOAT:      *(UA_Float*)p = (UA_Float)lua_tonumber(L, index); return true;
+	case UA_TYPES_DOUBLE:     *(UA_Double*)p = lua_tonumber(L, index); return true;
+	default:                  return false;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Packed arrays (Variant.array): numbers are read straight from the lua stack.
+// false at the first element which is no number or out of range (the caller falls
+// back to variantFromLua, which reports it)
+template<typename T>
+static bool packedFromLua(lua_State* L, int index, T* out, std::true_type /* integral */) {
+	return integerFromLua(L, index, out);
+}
+template<typename T>
+static bool packedFromLua(lua_State* L, int index, T* out, std::false_type) {
+	*out = (T)lua_tonumber(L, index);
+	return true;
+}
+template<typename T>
+static bool fillNumbers(lua_State* L, int tableIndex, T* dst, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		lua_rawgeti(L, tableIndex, (int)(i + 1));
+		bool ok = lua_isnumber(L, -1) && packedFromLua(L, -1, &dst[i], std::is_integral<T>());
+		lua_pop(L, 1);
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+static bool fillNumberArray(lua_State* L, int tableIndex, const UA_DataType* type, void* dst, size_t count) {
+	switch (type->typeIndex) {
+	case UA_TYPES_SBYTE:      return fillNumbers(L, tableIndex, (UA_SByte*)dst, count);
+	case UA_TYPES_BYTE:       return fillNumbers(L, tableIndex, (UA_Byte*)dst, count);
+	case UA_TYPES_INT16:      return fillNumbers(L, tableIndex, (UA_Int16*)dst, count);
+	case UA_TYPES_UINT16:     return fillNumbers(L, tableIndex, (UA_UInt16*)dst, count);
+	case UA_TYPES_INT32:      return fillNumbers(L, tableIndex, (UA_Int32*)dst, count);
+	case UA_TYPES_UINT32:
+	case UA_TYPES_STATUSCODE: return fillNumbers(L, tableIndex, (UA_UInt32*)dst, count);
+	case UA_TYPES_INT64:
+	case UA_TYPES_DATETIME:   return fillNumbers(L, tableIndex, (UA_Int64*)dst, count);
+	case UA_TYPES_UINT64:     return fillNumbers(L, tableIndex, (UA_UInt64*)dst, count);
+	case UA_TYPES_FLOAT:      return fillNumbers(L, tableIndex, (UA_Float*)dst, count);
+	case UA_TYPES_DOUBLE:     return fillNumbers(L, tableIndex, (UA_Double*)dst, count);
+	default:
+		return false;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Conversion between Variants and native lua values. The element types are
+// dispatched by their index in UA_TYPES (constant time).
+sol::object variantToLua(sol::state_view lua, const UA_Variant& var);
+bool variantFromLua(const sol::object& value, const UA_DataType* type, UA_Variant* out);
+
+static bool isBuiltinType(const UA_DataType* type) {
+	return type != NULL && type->typeIndex < UA_TYPES_COUNT && type == &UA_TYPES[type->typeIndex];
+}
+
+static sol::object elementToLua(sol::state_view& lua, const UA_DataType* type, const void* p) {
+	switch (type->typeIndex) {
+	case UA_TYPES_BOOLEAN:    return sol::make_object(lua, *(const UA_Boolean*)p != 0);
+	case UA_TYPES_SBYTE:      return sol::make_object(lua, *(const UA_SByte*)p);
+	case UA_TYPES_BYTE:       return sol::make_object(lua, *(const UA_Byte*)p);
+	case UA_TYPES_INT16:      return sol::make_object(lua, *(const UA_Int16*)p);
+	case UA_TYPES_UINT16:     return sol::make_object(lua, *(const UA_UInt16*)p);
+	case UA_TYPES_INT32:      return sol::make_object(lua, *(const UA_Int32*)p);
+	case UA_TYPES_UINT32:     return sol::make_object(lua, *(const UA_UInt32*)p);
+	case UA_TYPES_STATUSCODE: return sol::make_object(lua, *(const UA_StatusCode*)p);
+	case UA_TYPES_INT64:      return sol::make_object(lua, *(const UA_Int64*)p);
+	case UA_TYPES_DATETIME:   return sol::make_object(lua, *(const UA_DateTime*)p);
+	case UA_TYPES_UINT64:     return sol::make_object(lua, *(const UA_UInt64*)p);
+	case UA_TYPES_FLOAT:      return sol::make_object(lua, *(const UA_Float*)p);
+	case UA_TYPES_DOUBLE:     return sol::make_object(lua, *(const UA_Double*)p);
+	case UA_TYPES_STRING:
+	case UA_TYPES_BYTESTRING:
+	case UA_TYPES_XMLELEMENT: {
+		const UA_String* str = (const UA_String*)p;
+		return sol::make_object(lua, std::string((const char*)str->data, str->length));
+	}
+	case UA_TYPES_NODEID: {
+		UA_NodeId id;
+		UA_NodeId_copy((const UA_NodeId*)p, &id);
+		return sol::make_object(lua, id);
+	}
+	case UA_TYPES_QUALIFIEDNAME: {
+		UA_QualifiedName name;
+		UA_QualifiedName_copy((const UA_QualifiedName*)p, &name);
+		return sol::make_object(lua, name);
+	}
+	case UA_TYPES_LOCALIZEDTEXT: {
+		UA_LocalizedText text;
+		UA_LocalizedText_copy((const UA_LocalizedText*)p, &text);
+		return sol::make_object(lua, text);
+	}
+	case UA_TYPES_VARIANT:
+		return variantToLua(lua, *(const UA_Variant*)p);
+	default: {
+		// no native representation (e.g. structures), keep it as Variant
+		UA_Variant var;
+		UA_Variant_init(&var);
+		UA_Variant_setScalarCopy(&var, p, type);
+		return sol::make_object(lua, var);
+	}
+	}
+}
+
+// Nested tables for multi dimensional arrays, the last dimension varies fastest
+static sol::object arrayToLua(sol::state_view& lua, const UA_DataType* type, const UA_Byte*& p,
+		const UA_UInt32* dims, size_t dimsSize) {
+	sol::table tbl = lua.create_table(dims[0], 0);
+	for (UA_UInt32 i = 0; i < dims[0]; ++i) {
+		if (dimsSize > 1) {
+			tbl[i + 1] = arrayToLua(lua, type, p, dims + 1, dimsSize - 1);
+		} else {
+			tbl[i + 1] = elementToLua(lua, type, p);
+			p += type->memSize;
+		}
+	}
+	return tbl;
+}
+
+sol::object variantToLua(sol::state_view lua, const UA_Variant& var) {
+	if (UA_Variant_isEmpty(&var))
+		return sol::make_object(lua, sol::lua_nil);
+	if (!isBuiltinType(var.type)) {
+		UA_Variant copy;
+		UA_Variant_copy(&var, &copy);
+		return sol::make_object(lua, copy);
+	}
+	if (UA_Variant_isScalar(&var))
+		return elementToLua(lua, var.type, var.data);
+	UA_UInt32 length = (UA_UInt32)var.arrayLength;
+	const UA_UInt32* dims = &length;
+	size_t dimsSize = 1;
+	if (var.arrayDimensionsSize > 1) {
+		size_t total = 1;
+		for (size_t i = 0; i < var.arrayDimensionsSize; ++i)
+			total *= var.arrayDimensions[i];
+		if (total == var.arrayLength) {
+			dims = var.arrayDimensions;
+			dimsSize = var.arrayDimensionsSize;
+		}
+	}
+	const UA_Byte* p = (const UA_Byte*)var.data;
+	return arrayToLua(lua, var.type, p, dims, dimsSize);
+}
+
+static const UA_DataType* luaValueType(const sol::object& value) {
+	switch (value.get_type()) {
+	case sol::type::boolean: return &UA_TYPES[UA_TYPES_BOOLEAN];
+	case sol::type::number:  return &UA_TYPES[UA_TYPES_DOUBLE];
+	case sol::type::string:  return &UA_TYPES[UA_TYPES_STRING];
+	default:
+		if (value.is<UA_NodeId>()) return &UA_TYPES[UA_TYPES_NODEID];
+		if (value.is<UA_QualifiedName>()) return &UA_TYPES[UA_TYPES_QUALIFIEDNAME];
+		if (value.is<UA_LocalizedText>()) return &UA_TYPES[UA_TYPES_LOCALIZEDTEXT];
+		if (value.is<UA_Variant>()) return &UA_TYPES[UA_TYPES_VARIANT];
+		return NULL;
+	}
+}
+
+// Convert one lua value into the (initialized) memory of an element of the given type
+static bool elementFromLua(const sol::object& value, const UA_DataType* type, void* p) {
+	sol::type t = value.get_type();
+	if (t == sol::type::number || t == sol::type::boolean) {
+		int index = isBuiltinType(type) ? type->typeIndex :
+			(type->typeKind == UA_DATATYPEKIND_ENUM ? UA_TYPES_INT32 : -1);
+		switch (index) {
+		case UA_TYPES_BOOLEAN: case UA_TYPES_SBYTE: case UA_TYPES_BYTE:
+		case UA_TYPES_INT16: case UA_TYPES_UINT16: case UA_TYPES_INT32:
+		case UA_TYPES_UINT32: case UA_TYPES_STATUSCODE: case UA_TYPES_INT64:
+		case UA_TYPES_DATETIME: case UA_TYPES_UINT64: case UA_TYPES_FLOAT:
+		case UA_TYPES_DOUBLE: {
+			// from the stack, so integers don't lose precision through double
+			lua_State* L = value.lua_state();
+			if (t == sol::type::boolean)
+				lua_pushinteger(L, value.as<bool>() ? 1 : 0);
+			else
+				value.push();
+			bool ok = numberFromLua(L, -1, index, p);
+			lua_pop(L, 1);
+			return ok;
+		}
+		default:
+			break;
+		}
+	}
+	if (!isBuiltinType(type))
+		return false;
+	switch (type->typeIndex) {
+	case UA_TYPES_STRING:
+	case UA_TYPES_BYTESTRING:
+	case UA_TYPES_XMLELEMENT: {
+		if (t != sol::type::string)
+			return false;
+		std::string str = value.as<std::string>();  // may contain nulls
+		UA_String tmp;
+		tmp.length = str.length();
+		tmp.data = (UA_Byte*)str.data();
+		return UA_String_copy(&tmp, (UA_String*)p) == UA_STATUSCODE_GOOD;
+	}
+	case UA_TYPES_NODEID:
+		return value.is<UA_NodeId>() && UA_NodeId_copy(&value.as<UA_NodeId&>(), (UA_NodeId*)p) == UA_STATUSCODE_GOOD;
+	case UA_TYPES_QUALIFIEDNAME:
+		return value.is<UA_QualifiedName>() && UA_QualifiedName_copy(&value.as<UA_QualifiedName&>(), (UA_QualifiedName*)p) == UA_STATUSCODE_GOOD;
+	case UA_TYPES_LOCALIZEDTEXT:
+		return value.is<UA_LocalizedText>() && UA_LocalizedText_copy(&value.as<UA_LocalizedText&>(), (UA_LocalizedText*)p) == UA_STATUSCODE_GOOD;
+	case UA_TYPES_VARIANT:
+		return variantFromLua(value, NULL, (UA_Variant*)p);
+	default:
+		return false;
+	}
+}
+
+// The dimensions of nested tables (the sizes along the first elements)
+static void tableDimensions(sol::table tbl, std::vector<UA_UInt32>& dims) {
+	for (;;) {
+		dims.push_back((UA_UInt32)tbl.size());
+		if (tbl.size() == 0)
+			return;
+		sol::object first = tbl.get<sol::object>(1);
+		if (first.get_type() != sol::type::table)
+			return;
+		tbl = first.as<sol::table>();
+	}
+}
+
+static bool arrayFromLua(sol::table tbl, const UA_DataType* type, UA_Byte*& p,
+		const UA_UInt32* dims, size_t dimsSize) {
+	if (tbl.size() != dims[0])
+		return false;           // not rectangular
+	for (UA_UInt32 i = 0; i < dims[0]; ++i) {
+		sol::object item = tbl.get<sol::object>(i + 1);
+		if (dimsSize > 1) {
+			if (item.get_type() != sol::type::table || !arrayFromLua(item.as<sol::table>(), type, p, dims + 1, dimsSize - 1))
+				return false;
+		} else {
+			if (!elementFromLua(item, type, p))
+				return false;
+			p += type->memSize;
+		}
+	}
+	return true;
+}
+
+bool variantFromLua(const sol::object& value, const UA_DataType* type, UA_Variant* out) {
+	UA_Variant_init(out);
+	if (value.is<UA_Variant>())
+		return UA_Variant_copy(&value.as<UA_Variant&>(), out) == UA_STATUSCODE_GOOD;
+	if (value.get_type() == sol::type::table) {
+		std::vector<UA_UInt32> dims;
+		tableDimensions(value.as<sol::table>(), dims);
+		size_t total = 1;
+		for (size_t i = 0; i < dims.size(); ++i)
+			total *= dims[i];
+		if (type == NULL) {
+			// the type of the first element
+			sol::object first = value;
+			for (size_t i = 0; i < dims.size() && total > 0; ++i)
+				first = first.as<sol::table>().get<sol::object>(1);
+			type = total > 0 ? luaValueType(first) : &UA_TYPES[UA_TYPES_VARIANT];
+		}
+		if (type == NULL)
+			return false;
+		void* data = UA_Array_new(total, type);
+		if (total > 0 && data == NULL)
+			return false;
+		UA_Byte* p = (UA_Byte*)data;
+		if (total > 0 && !arrayFromLua(value.as<sol::table>(), type, p, &dims[0], dims.size())) {
+			UA_Array_delete(data, total, type);
+			return false;
+		}
+		UA_Variant_setArray(out, data, total, type);
+		if (dims.size() > 1) {
+			UA_Array_copy(&dims[0], dims.size(), (void**)&out->arrayDimensions, &UA_TYPES[UA_TYPES_UINT32]);
+			out->arrayDimensionsSize = dims.size();
+		}
+		return true;
+	}
+	if (type == NULL)
+		type = luaValueType(value);
+	if (type == NULL)
+		return false;
+	void* data = UA_new(type);
+	if (data == NULL)
+		return false;
+	if (!elementFromLua(value, type, data)) {
+		UA_delete(data, type);
+		return false;
+	}
+	UA_Variant_setScalar(out, data, type);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Variant accessors, bound as raw lua_CFunctions (see RAW_SELF)
+template<typename T>
+static bool scalarAsNumber(const UA_Variant* var, T& val) {
+	if (!isBuiltinType(var->type))
+		return false;
+	switch (var->type->typeIndex) {
+	case UA_TYPES_BOOLEAN: val = *(UA_Boolean*)var->data ? 1 : 0; break;
+	case UA_TYPES_SBYTE:   val = (T)*(UA_SByte*)var->data; break;
+	case UA_TYPES_BYTE:    val = (T)*(UA_Byte*)var->data; break;
+	case UA_TYPES_INT16:   val = (T)*(UA_Int16*)var->data; break;
+	case UA_TYPES_UINT16:  val = (T)*(UA_UInt16*)var->data; break;
+	case UA_TYPES_INT32:   val = (T)*(UA_Int32*)var->data; break;
+	case UA_TYPES_UINT32:  val = (T)*(UA_UInt32*)var->data; break;
+	case UA_TYPES_INT64:   val = (T)*(UA_Int64*)var->data; break;
+	case UA_TYPES_UINT64:  val = (T)*(UA_UInt64*)var->data; break;
+	case UA_TYPES_FLOAT:   val = (T)*(UA_Float*)var->data; break;
+	case UA_TYPES_DOUBLE:  val = (T)*(UA_Double*)var->data; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Integers as lua integers where lua has them (5.3). Not by sol, its precision check
+// would throw through lua for big 64 bit values before 5.3.
+static void pushInteger(lua_State* L, std::int64_t val) {
+#if LUA_VERSION_NUM >= 503
+	lua_pushinteger(L, (lua_Integer)val);
+#else
+	lua_pushnumber(L, (lua_Number)val);
+#endif
+}
+
+static int variantAsLong(lua_State* L) {
+	RAW_SELF(UA_Variant, var)
+	std::int64_t val = 0;
+	if (!UA_Variant_isScalar(var))
+		RAW_RETURN_ERROR("not scalar type")
+	if (!scalarAsNumber(var, val))
+		RAW_RETURN_ERROR("not buildin numeric type")
+	pushInteger(L, val);
+	return 1;
+}
+
+static int variantAsDouble(lua_State* L) {
+	RAW_SELF(UA_Variant, var)
+	double val = 0;
+	if (!UA_Variant_isScalar(var))
+		RAW_RETURN_ERROR("not scalar type")
+	if (!scalarAsNumber(var, val))
+		RAW_RETURN_ERROR("not buildin numeric type")
+	lua_pushnumber(L, val);
+	return 1;
+}
+
+static int variantAsString(lua_State* L) {
+	RAW_SELF(UA_Variant, var)
+	if (!UA_Variant_isScalar(var))
+		RAW_RETURN_ERROR("not scalar type")
+	if (var->type != &UA_TYPES[UA_TYPES_STRING] && var->type != &UA_TYPES[UA_TYPES_BYTESTRING])
+		RAW_RETURN_ERROR("not string type")
+	const UA_String* str = (const UA_String*)var->data;
+	lua_pushlstring(L, (const char*)str->data, str->length);
+	return 1;
+}
+
+static int variantAsValue(lua_State* L) {
+	RAW_SELF(UA_Variant, var)
+	double val = 0;
+	std::int64_t ival = 0;
+	if (var->type == &UA_TYPES[UA_TYPES_BOOLEAN]) {
+		lua_pushboolean(L, *(UA_Boolean*)var->data);
+	} else if (var->type == &UA_TYPES[UA_TYPES_STRING]) {
+		const UA_String* str = (const UA_String*)var->data;
+		lua_pushlstring(L, (const char*)str->data, str->length);
+	} else if (var->type == &UA_TYPES[UA_TYPES_DATETIME]) {
+		pushInteger(L, *(UA_DateTime*)var->data);
+	} else if (var->type == &UA_TYPES[UA_TYPES_UINT64] && *(UA_UInt64*)var->data > (UA_UInt64)std::numeric_limits<std::int64_t>::max()) {
+		lua_pushnumber(L, (lua_Number)*(UA_UInt64*)var->data);  // beyond the lua integers
+	} else if (var->type == &UA_TYPES[UA_TYPES_FLOAT] || var->type == &UA_TYPES[UA_TYPES_DOUBLE]) {
+		scalarAsNumber(var, val);
+		lua_pushnumber(L, val);
+	} else if (scalarAsNumber(var, ival)) {
+		pushInteger(L, ival);
+	} else {
+		RAW_RETURN_ERROR("not supported data type")
+	}
+	return 1;
+}
+
 
 void reg_opcua_types(sol::table& module) {
 	module.new_usertype<UA_DateTime>("DateTime",
@@ -161,6 +602,19 @@ void reg_opcua_types(sol::table& module) {
 	);
 
 	module.set_function("get_node_data_value_type", get_node_data_value_type);
+	// Variant from a lua value or (nested) table, typeIndex (UA_TYPES index) is optional
+	module.set_function("fromLua", [](sol::object value, sol::optional<int> typeIndex, sol::this_state L) {
+		const UA_DataType* type = NULL;
+		if (typeIndex) {
+			if (*typeIndex < 0 || *typeIndex >= UA_TYPES_COUNT)
+				RETURN_ERROR("invalid type index")
+			type = &UA_TYPES[*typeIndex];
+		}
+		UA_Variant var;
+		if (!variantFromLua(value, type, &var))
+			RETURN_ERROR("cannot convert value")
+		RETURN_OK(UA_Variant, var)
+	});
 
 	/*
 	module.new_usertype<UA_NumericRange>("NumericRange",
@@ -250,76 +704,9 @@ void reg_opcua_types(sol::table& module) {
 		"copyRange", [](UA_Variant& var, const UA_Variant& src, const UA_NumericRange range) { return UA_Variant_copyRange(&src, &var, range); },
 		"setRange", [](UA_Variant& var, void* array, size_t arraySize, const UA_NumericRange range) { return UA_Variant_setRange(&var, array, arraySize, range); },
 		"setRangeCopy", [](UA_Variant& var, void* array, size_t arraySize, const UA_NumericRange range) { return UA_Variant_setRangeCopy(&var, array, arraySize, range); },
-		"asLong", [](const UA_Variant& var, sol::this_state L) {
-			std::int64_t val = 0;
-			if (!UA_Variant_isScalar(&var))
-				RETURN_ERROR("not scalar type")
-			if (var.type == &UA_TYPES[UA_TYPES_BOOLEAN])
-				val = *(UA_Boolean*)var.data ? 1 : 0;
-			else if (var.type == &UA_TYPES[UA_TYPES_SBYTE])
-				val = *(UA_SByte*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_BYTE])
-				val = *(UA_Byte*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT16])
-				val = *(UA_Int16*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT16])
-				val = *(UA_UInt16*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT32])
-				val = *(UA_Int32*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT32])
-				val = *(UA_UInt32*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT64])
-				val = *(UA_Int64*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT64])
-				val = *(UA_UInt64*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_FLOAT])
-				val = *(UA_Float*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_DOUBLE])
-				val = *(UA_Double*)var.data;
-			else
-				RETURN_ERROR("not buildin numeric type")
-			RETURN_OK(std::int64_t, val)
-		},
-		"asDouble", [](const UA_Variant& var, sol::this_state L) {
-			double val = 0;
-			if (!UA_Variant_isScalar(&var))
-				RETURN_ERROR("not scalar type")
-			if (var.type == &UA_TYPES[UA_TYPES_BOOLEAN])
-				val = *(UA_Boolean*)var.data ? 1 : 0;
-			else if (var.type == &UA_TYPES[UA_TYPES_SBYTE])
-				val = *(UA_SByte*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_BYTE])
-				val = *(UA_Byte*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT16])
-				val = *(UA_Int16*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT16])
-				val = *(UA_UInt16*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT32])
-				val = *(UA_Int32*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT32])
-				val = *(UA_UInt32*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_INT64])
-				val = *(UA_Int64*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_UINT64])
-				val = *(UA_UInt64*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_FLOAT])
-				val = *(UA_Float*)var.data;
-			else if (var.type == &UA_TYPES[UA_TYPES_DOUBLE])
-				val = *(UA_Double*)var.data;
-			else
-				RETURN_ERROR("not buildin numeric type")
-			RETURN_OK(double, val)
-		},
-		"asString", [](const UA_Variant& var, sol::this_state L) {
-			if (!UA_Variant_isScalar(&var))
-				RETURN_ERROR("not scalar type")
-			if (var.type == &UA_TYPES[UA_TYPES_STRING] || var.type == &UA_TYPES[UA_TYPES_BYTESTRING]) {
-				UA_String str = *(UA_String*)var.data;
-				RETURN_OK(std::string, std::string((const char*)str.data, str.length))
-			} else {
-				RETURN_ERROR("not string type")
-			}
-		},
+		"asLong", &variantAsLong,
+		"asDouble", &variantAsDouble,
+		"asString", &variantAsString,
 		"asBytes", [](const UA_Variant& var, int32_t cnt, sol::this_state L) {
 			RETURN_OK(std::string, std::string((const char*)var.data, cnt))
 		},
@@ -335,41 +722,50 @@ void reg_opcua_types(sol::table& module) {
 				RETURN_ERROR("not string type")
 			}
 		},
-		"asValue", [](const UA_Variant& var, sol::this_state L) {
-			if (var.type == &UA_TYPES[UA_TYPES_BOOLEAN] ) {
-				RETURN_OK(UA_Boolean, *(UA_Boolean*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_BOOLEAN]) {
-				RETURN_OK(UA_Boolean, *(UA_Boolean*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_SBYTE]) {
-				RETURN_OK(UA_SByte, *(UA_SByte*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_BYTE]) {
-				RETURN_OK(UA_Byte, *(UA_Byte*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_INT16]) {
-				RETURN_OK(UA_Int16, *(UA_Int32*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_UINT16]) {
-				RETURN_OK(UA_UInt16, *(UA_UInt32*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_INT32]) {
-				RETURN_OK(UA_Int32, *(UA_Int32*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_UINT32]) {
-				RETURN_OK(UA_UInt32, *(UA_UInt32*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_INT64]) {
-				RETURN_OK(UA_Int64, *(UA_Int64*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_UINT64]) {
-				RETURN_OK(UA_UInt64, *(UA_UInt64*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_FLOAT]) {
-				RETURN_OK(UA_Float, *(UA_Float*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_DOUBLE]) {
-				RETURN_OK(UA_Double, *(UA_Double*)var.data);
-			} else if (var.type == &UA_TYPES[UA_TYPES_STRING]) {
-				UA_String str = *(UA_String*)var.data;
-				RETURN_OK(std::string, std::string((const char*)str.data, str.length))
-			}  else if (var.type == &UA_TYPES[UA_TYPES_DATETIME] ) {
-				UA_DateTime dt = 0L;
-				dt = *(UA_DateTime*)var.data;
-				RETURN_OK(UA_DateTime, dt)
+		// Array of the given type (UA_TYPES index) from a table of numbers (converted in one loop),
+		// a packed binary string (copied as is, e.g. from string.pack) or any table for fromLua
+		"array", [](int typeIndex, sol::object src, sol::this_state L) {
+			if (typeIndex < 0 || typeIndex >= UA_TYPES_COUNT)
+				RETURN_ERROR("invalid type index")
+			const UA_DataType* type = &UA_TYPES[typeIndex];
+			UA_Variant var;
+			UA_Variant_init(&var);
+			if (src.get_type() == sol::type::string) {
+				size_t len = 0;
+				src.push();
+				const char* data = lua_tolstring(L, -1, &len);
+				lua_pop(L, 1);
+				if (!type->pointerFree || len % type->memSize != 0)
+					RETURN_ERROR("buffer does not match the type")
+				UA_Variant_setArrayCopy(&var, data, len / type->memSize, type);     // pointer free: one memcpy
+				RETURN_OK(UA_Variant, var)
 			}
-			RETURN_ERROR("not supported data type")
-		}
+			if (src.get_type() != sol::type::table)
+				RETURN_ERROR("table or string expected")
+			sol::table tbl = src.as<sol::table>();
+			size_t count = tbl.size();
+			sol::object first = count > 0 ? tbl.get<sol::object>(1) : sol::object();
+			if (first.get_type() == sol::type::number) {
+				void* data = UA_Array_new(count, type);
+				if (data == NULL)
+					RETURN_ERROR("out of memory")
+				tbl.push();
+				bool ok = fillNumberArray(L, lua_gettop(L), type, data, count);
+				lua_pop(L, 1);
+				if (ok) {
+					UA_Variant_setArray(&var, data, count, type);
+					RETURN_OK(UA_Variant, var)
+				}
+				UA_Array_delete(data, count, type);
+			}
+			// other element types (and nested tables) element by element
+			if (!variantFromLua(src, type, &var))
+				RETURN_ERROR("cannot convert value")
+			RETURN_OK(UA_Variant, var)
+		},
+		// scalars as lua values, arrays as (nested) tables, types without lua representation as Variant
+		"toLua", [](const UA_Variant& var, sol::this_state L) { return variantToLua(L, var); },
+		"asValue", &variantAsValue
 	);
 
 	module.new_usertype<UA_DataValue>("DataValue",
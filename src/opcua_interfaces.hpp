@@ -1,9 +1,36 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "open62541.h"
 
 namespace lua_opcua {
 
+// Target node of a resolved browse path
+struct BrowsePathTarget {
+	UA_NodeId nodeId;
+	UA_NodeClass nodeClass;
+
+	BrowsePathTarget(const UA_NodeId& id, UA_NodeClass cls) : nodeClass(cls) {
+		UA_NodeId_copy(&id, &nodeId);
+	}
+	BrowsePathTarget(const BrowsePathTarget& obj) : nodeClass(obj.nodeClass) {
+		UA_NodeId_copy(&obj.nodeId, &nodeId);
+	}
+	BrowsePathTarget& operator=(const BrowsePathTarget& that) {
+		if (this != &that) {
+			UA_NodeId_clear(&nodeId);
+			UA_NodeId_copy(&that.nodeId, &nodeId);
+			nodeClass = that.nodeClass;
+		}
+		return *this;
+	}
+	~BrowsePathTarget() {
+		UA_NodeId_clear(&nodeId);
+	}
+};
+
 class AttributeReader {
 public:
 	virtual UA_StatusCode readNodeId(const UA_NodeId nodeId, UA_NodeId *outNodeId) = 0;
@@ -31,6 +58,9 @@ public:
 	virtual UA_StatusCode readHistorizing(const UA_NodeId nodeId, UA_Boolean *outHistorizing) = 0;
 	virtual UA_StatusCode readExecutable(const UA_NodeId nodeId, UA_Boolean *outExecutable) = 0;
 	virtual UA_StatusCode readUserExecutable(const UA_NodeId nodeId, UA_Boolean *outUserExecutable) = 0;
+	// Read many attributes (of many nodes) at once. The values appended to outDataValues
+	// are owned by the caller (one entry per item, in the same order).
+	virtual UA_StatusCode readAttributes(size_t itemsSize, const UA_ReadValueId *items, std::vector<UA_DataValue>& outDataValues) = 0;
 };
 
 class AttributeWriter {
@@ -59,10 +89,18 @@ public:
 	virtual UA_StatusCode writeHistorizing(const UA_NodeId nodeId, const UA_Boolean *newHistorizing) = 0;
 	virtual UA_StatusCode writeExecutable(const UA_NodeId nodeId, const UA_Boolean *newExecutable) = 0;
 	virtual UA_StatusCode writeUserExecutable(const UA_NodeId nodeId, const UA_Boolean *newUserExecutable) = 0;
+
+	// Write many attributes (of many nodes) at once. One status code per item is appended
+	// to outResults (in the same order).
+	virtual UA_StatusCode writeAttributes(size_t itemsSize, const UA_WriteValue *items, std::vector<UA_StatusCode>& outResults) = 0;
 };
 
 class NodeMgr {
 public:
+	// Cleared when the manager is destroyed, for lua objects which may be collected after it
+	std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+	virtual ~NodeMgr() { *alive = false; }
+
 	virtual AttributeReader* getAttributeReader() = 0;
 	virtual AttributeWriter* getAttributeWriter() = 0;
 	virtual UA_StatusCode addReference(const UA_NodeId sourceNodeId,
@@ -143,6 +181,22 @@ public:
 	virtual UA_StatusCode forEachChildNodeCall(UA_NodeId parentNodeId, 
 			UA_NodeIteratorCallback callback,
 			void *handle) = 0;
+	// Browse all forward references of the node (following continuation points). The references
+	// carry ReferenceTypeId, NodeClass, BrowseName and DisplayName and are owned by the caller.
+	virtual UA_StatusCode browseChildren(const UA_NodeId parentNodeId,
+			std::vector<UA_ReferenceDescription>& outReferences) = 0;
+	// Resolve many browse paths at once. outTargets gets one entry per path (in the same order),
+	// which is empty if the path does not exist.
+	virtual UA_StatusCode resolveBrowsePaths(size_t pathsSize, const UA_BrowsePath* paths,
+			std::vector< std::vector<BrowsePathTarget> >& outTargets) = 0;
+
+	// Read one page (up to numValuesPerNode values) of the raw history of a node. Pass the
+	// continuation point of the previous page (empty for the first one), it is replaced by
+	// the next one (empty after the last page). release frees the continuation point on the
+	// server without reading. The values appended to outValues are owned by the caller.
+	virtual UA_StatusCode historyReadRaw(const UA_NodeId nodeId, UA_DateTime startTime, UA_DateTime endTime,
+			UA_UInt32 numValuesPerNode, UA_Boolean returnBounds, UA_TimestampsToReturn timestamps,
+			UA_ByteString* continuationPoint, bool release, std::vector<UA_DataValue>& outValues) = 0;
 
 	virtual UA_StatusCode resolveExtensionObjectType(const UA_NodeId& nodeId, const std::string& Name) = 0;
 };
@@ -173,6 +227,29 @@ do {\
 	return _result; \
 } while(0);\
 
+// Raw lua_CFunction bindings (static int f(lua_State* L)) for the hot paths. They push
+// their results directly onto the stack instead of building a variadic_results vector.
+#define RAW_SELF(T, VAR) \
+	T* VAR = NULL; \
+	{ \
+		auto _self = sol::stack::check_get<T*>(L, 1); \
+		if (_self) VAR = *_self; \
+	} \
+	if (VAR == NULL) \
+		return luaL_argerror(L, 1, #T " expected");
+
+#define RAW_RETURN_ERROR(ERR) \
+do {\
+	lua_pushnil(L); \
+	lua_pushstring(L, ERR); \
+	return 2; \
+} while(0);\
+
+#define RAW_RETURN_RESULT(XT, X) \
+	if (re != UA_STATUSCODE_GOOD) \
+		RAW_RETURN_ERROR(UA_StatusCode_name(re)) \
+	return sol::stack::push<XT>(L, X);
+
 
 #define MAP_PROPERTY(CLASS, DT, DN) \
 	#DN, sol::property( \
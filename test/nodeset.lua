@@ -0,0 +1,68 @@
+---------------
+-- NodeSet import / export example
+-- Imports nodeset_nested.xml (a structure with a nested structure), exports the nodes
+-- with a client and imports the export into a second server
+
+local opcua = require 'opcua'
+
+local NS_URI = "http://freeioe.org/nodeset/nested/"
+
+local server = opcua.Server.new(4841)
+server.config:setApplicationURI("urn:freeioe:nodeset:test")
+
+local info = assert(server:importNodeSet("nodeset_nested.xml"))
+print('imported', info.nodes, info.existing, info.references, info.types, info.failed)
+assert(info.failed == 0)
+assert(info.types == 2, "Line and its nested Point")
+
+local ns = assert(server:getNamespaceByName(NS_URI))
+
+-- the structure by its name, its data type id and the string of the id
+local line = assert(server:getTypeInfo("Line"))
+assert(assert(server:getTypeInfo(opcua.NodeId.new(ns, 3002))).name == line.name)
+assert(assert(server:getTypeInfo("ns="..ns..";i=3002")).name == line.name)
+assert(server:getTypeInfo(opcua.NodeId.new(ns, 3001)).name == "Point")
+-- Pen has no ParentNodeId, Plotter refers to it
+local plotter = assert(server:getNode(opcua.NodeId.new(ns, 5100)))
+assert(plotter:getChild("Pen").id == opcua.NodeId.new(ns, 6003))
+
+local function dump(tbl, indent)
+	indent = indent or ''
+	for k, v in pairs(tbl) do
+		if type(v) == 'table' then
+			print(indent..tostring(k))
+			dump(v, indent..'  ')
+		else
+			print(indent..tostring(k), v)
+		end
+	end
+end
+dump(assert(line:asTable()))
+
+server:startup()
+assert(server:startNetworkThread())
+
+local client = opcua.Client.new()
+client.config:setTimeout(5000)
+local r, err = client:connect("opc.tcp://127.0.0.1:4841")
+assert(r == 0, err)
+
+-- the whole address space: the data types (below Structure) and the Plotter object
+local count = assert(client:exportNodeSet(client:getRootNode(), "nodeset_export.xml"))
+print('exported', count)
+assert(count == 6, "Line, Point, Plotter, Speed, Segment, Pen")
+client:disconnect()
+server:shutdown()
+
+-- the export is a valid NodeSet of the same nodes (the structure definitions are not exported)
+local server2 = opcua.Server.new(4842)
+local info2 = assert(server2:importNodeSet("nodeset_export.xml"))
+print('reimported', info2.nodes, info2.existing, info2.references, info2.types, info2.failed)
+assert(info2.nodes == count and info2.failed == 0)
+
+local ns2 = assert(server2:getNamespaceByName(NS_URI))
+local speed = assert(server2:getNode(opcua.NodeId.new(ns2, 6001)))
+assert(speed.value:asValue() == 1.5)
+assert(server2:getNode(opcua.NodeId.new(ns2, 6002)).dataType == opcua.NodeId.new(ns2, 3002))
+
+print('done')